@@ -1,11 +1,141 @@
 #include "liboblivious/algorithms.h"
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include "liboblivious/internal/util.h"
 #include "liboblivious/primitives.h"
 
 /* Sorting. */
 
+/* Size-optimal sorting networks for up to SORT_NETWORK_MAX_N elements, except
+ * for 13 elements, which uses one comparator more than the optimal 45. The
+ * comparators are listed in the order they must be applied. */
+
+#define SORT_NETWORK_MAX_N 16
+
+struct sort_network {
+    const unsigned char (*pairs)[2];
+    size_t num_pairs;
+};
+
+static const unsigned char sort_network_2[][2] = {
+    { 0, 1 }
+};
+static const unsigned char sort_network_3[][2] = {
+    { 0, 1 }, { 0, 2 }, { 1, 2 }
+};
+static const unsigned char sort_network_4[][2] = {
+    { 0, 1 }, { 2, 3 }, { 0, 2 }, { 1, 3 }, { 1, 2 }
+};
+static const unsigned char sort_network_5[][2] = {
+    { 0, 1 }, { 2, 3 }, { 0, 2 }, { 1, 3 }, { 1, 2 }, { 0, 4 }, { 2, 4 },
+    { 1, 2 }, { 3, 4 }
+};
+static const unsigned char sort_network_6[][2] = {
+    { 0, 5 }, { 1, 3 }, { 2, 4 }, { 1, 2 }, { 3, 4 }, { 0, 3 }, { 2, 5 },
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 1, 2 }, { 3, 4 }
+};
+static const unsigned char sort_network_7[][2] = {
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 0, 2 }, { 1, 3 }, { 4, 6 }, { 1, 2 },
+    { 5, 6 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 2, 4 }, { 3, 5 }, { 1, 2 },
+    { 3, 4 }, { 5, 6 }
+};
+static const unsigned char sort_network_8[][2] = {
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, { 0, 2 }, { 1, 3 }, { 4, 6 },
+    { 5, 7 }, { 1, 2 }, { 5, 6 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 },
+    { 2, 4 }, { 3, 5 }, { 1, 2 }, { 3, 4 }, { 5, 6 }
+};
+static const unsigned char sort_network_9[][2] = {
+    { 0, 3 }, { 1, 7 }, { 2, 5 }, { 4, 8 }, { 0, 7 }, { 2, 4 }, { 3, 8 },
+    { 5, 6 }, { 0, 2 }, { 1, 3 }, { 4, 5 }, { 7, 8 }, { 1, 4 }, { 3, 6 },
+    { 5, 7 }, { 0, 1 }, { 2, 4 }, { 3, 5 }, { 6, 8 }, { 2, 3 }, { 4, 5 },
+    { 6, 7 }, { 1, 2 }, { 3, 4 }, { 5, 6 }
+};
+static const unsigned char sort_network_10[][2] = {
+    { 0, 8 }, { 1, 9 }, { 2, 7 }, { 3, 5 }, { 4, 6 }, { 0, 2 }, { 1, 4 },
+    { 5, 8 }, { 7, 9 }, { 0, 3 }, { 2, 4 }, { 5, 7 }, { 6, 9 }, { 0, 1 },
+    { 3, 6 }, { 8, 9 }, { 1, 5 }, { 2, 3 }, { 4, 8 }, { 6, 7 }, { 1, 2 },
+    { 3, 5 }, { 4, 6 }, { 7, 8 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, { 3, 4 },
+    { 5, 6 }
+};
+static const unsigned char sort_network_11[][2] = {
+    { 0, 8 }, { 1, 7 }, { 2, 6 }, { 4, 10 }, { 5, 9 }, { 0, 1 }, { 2, 5 },
+    { 3, 4 }, { 6, 9 }, { 7, 8 }, { 0, 2 }, { 1, 6 }, { 5, 10 }, { 0, 3 },
+    { 1, 2 }, { 4, 6 }, { 5, 7 }, { 9, 10 }, { 1, 4 }, { 3, 5 }, { 6, 8 },
+    { 7, 10 }, { 1, 3 }, { 2, 5 }, { 6, 9 }, { 8, 10 }, { 2, 3 }, { 4, 5 },
+    { 6, 7 }, { 8, 9 }, { 4, 6 }, { 5, 7 }, { 3, 4 }, { 5, 6 }, { 7, 8 }
+};
+static const unsigned char sort_network_12[][2] = {
+    { 0, 8 }, { 1, 7 }, { 2, 6 }, { 3, 11 }, { 4, 10 }, { 5, 9 }, { 0, 1 },
+    { 2, 5 }, { 3, 4 }, { 6, 9 }, { 7, 8 }, { 10, 11 }, { 0, 2 }, { 1, 6 },
+    { 5, 10 }, { 9, 11 }, { 0, 3 }, { 1, 2 }, { 4, 6 }, { 5, 7 }, { 8, 11 },
+    { 9, 10 }, { 1, 4 }, { 3, 5 }, { 6, 8 }, { 7, 10 }, { 1, 3 }, { 2, 5 },
+    { 6, 9 }, { 8, 10 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, { 8, 9 }, { 4, 6 },
+    { 5, 7 }, { 3, 4 }, { 5, 6 }, { 7, 8 }
+};
+static const unsigned char sort_network_13[][2] = {
+    { 1, 12 }, { 4, 8 }, { 5, 6 }, { 7, 11 }, { 9, 10 }, { 0, 5 }, { 1, 7 },
+    { 2, 9 }, { 3, 4 }, { 11, 12 }, { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 8 },
+    { 7, 9 }, { 10, 11 }, { 0, 2 }, { 1, 3 }, { 4, 10 }, { 5, 11 }, { 6, 7 },
+    { 8, 9 }, { 1, 2 }, { 3, 12 }, { 4, 6 }, { 5, 7 }, { 8, 10 }, { 9, 11 },
+    { 1, 4 }, { 2, 6 }, { 5, 8 }, { 7, 10 }, { 2, 4 }, { 3, 6 }, { 9, 12 },
+    { 3, 5 }, { 6, 8 }, { 7, 9 }, { 10, 12 }, { 3, 4 }, { 5, 6 }, { 7, 8 },
+    { 9, 10 }, { 11, 12 }, { 6, 7 }, { 8, 9 }
+};
+static const unsigned char sort_network_14[][2] = {
+    { 0, 13 }, { 1, 12 }, { 4, 8 }, { 5, 6 }, { 7, 11 }, { 9, 10 }, { 0, 5 },
+    { 1, 7 }, { 2, 9 }, { 3, 4 }, { 6, 13 }, { 11, 12 }, { 0, 1 }, { 2, 3 },
+    { 4, 5 }, { 6, 8 }, { 7, 9 }, { 10, 11 }, { 12, 13 }, { 0, 2 }, { 1, 3 },
+    { 4, 10 }, { 5, 11 }, { 6, 7 }, { 8, 9 }, { 1, 2 }, { 3, 12 }, { 4, 6 },
+    { 5, 7 }, { 8, 10 }, { 9, 11 }, { 1, 4 }, { 2, 6 }, { 5, 8 }, { 7, 10 },
+    { 9, 13 }, { 2, 4 }, { 3, 6 }, { 9, 12 }, { 11, 13 }, { 3, 5 }, { 6, 8 },
+    { 7, 9 }, { 10, 12 }, { 3, 4 }, { 5, 6 }, { 7, 8 }, { 9, 10 }, { 11, 12 },
+    { 6, 7 }, { 8, 9 }
+};
+static const unsigned char sort_network_15[][2] = {
+    { 0, 13 }, { 1, 12 }, { 3, 14 }, { 4, 8 }, { 5, 6 }, { 7, 11 }, { 9, 10 },
+    { 0, 5 }, { 1, 7 }, { 2, 9 }, { 3, 4 }, { 6, 13 }, { 8, 14 }, { 11, 12 },
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 8 }, { 7, 9 }, { 10, 11 }, { 12, 13 },
+    { 0, 2 }, { 1, 3 }, { 4, 10 }, { 5, 11 }, { 6, 7 }, { 8, 9 }, { 12, 14 },
+    { 1, 2 }, { 3, 12 }, { 4, 6 }, { 5, 7 }, { 8, 10 }, { 9, 11 }, { 13, 14 },
+    { 1, 4 }, { 2, 6 }, { 5, 8 }, { 7, 10 }, { 9, 13 }, { 11, 14 }, { 2, 4 },
+    { 3, 6 }, { 9, 12 }, { 11, 13 }, { 3, 5 }, { 6, 8 }, { 7, 9 }, { 10, 12 },
+    { 3, 4 }, { 5, 6 }, { 7, 8 }, { 9, 10 }, { 11, 12 }, { 6, 7 }, { 8, 9 }
+};
+static const unsigned char sort_network_16[][2] = {
+    { 0, 13 }, { 1, 12 }, { 2, 15 }, { 3, 14 }, { 4, 8 }, { 5, 6 }, { 7, 11 },
+    { 9, 10 }, { 0, 5 }, { 1, 7 }, { 2, 9 }, { 3, 4 }, { 6, 13 }, { 8, 14 },
+    { 10, 15 }, { 11, 12 }, { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 8 }, { 7, 9 },
+    { 10, 11 }, { 12, 13 }, { 14, 15 }, { 0, 2 }, { 1, 3 }, { 4, 10 },
+    { 5, 11 }, { 6, 7 }, { 8, 9 }, { 12, 14 }, { 13, 15 }, { 1, 2 }, { 3, 12 },
+    { 4, 6 }, { 5, 7 }, { 8, 10 }, { 9, 11 }, { 13, 14 }, { 1, 4 }, { 2, 6 },
+    { 5, 8 }, { 7, 10 }, { 9, 13 }, { 11, 14 }, { 2, 4 }, { 3, 6 }, { 9, 12 },
+    { 11, 13 }, { 3, 5 }, { 6, 8 }, { 7, 9 }, { 10, 12 }, { 3, 4 }, { 5, 6 },
+    { 7, 8 }, { 9, 10 }, { 11, 12 }, { 6, 7 }, { 8, 9 }
+};
+
+#define SORT_NETWORK(N) \
+    { sort_network_##N, sizeof(sort_network_##N) / sizeof(*sort_network_##N) }
+static const struct sort_network sort_networks[SORT_NETWORK_MAX_N + 1] = {
+    [2] = SORT_NETWORK(2),
+    [3] = SORT_NETWORK(3),
+    [4] = SORT_NETWORK(4),
+    [5] = SORT_NETWORK(5),
+    [6] = SORT_NETWORK(6),
+    [7] = SORT_NETWORK(7),
+    [8] = SORT_NETWORK(8),
+    [9] = SORT_NETWORK(9),
+    [10] = SORT_NETWORK(10),
+    [11] = SORT_NETWORK(11),
+    [12] = SORT_NETWORK(12),
+    [13] = SORT_NETWORK(13),
+    [14] = SORT_NETWORK(14),
+    [15] = SORT_NETWORK(15),
+    [16] = SORT_NETWORK(16),
+};
+#undef SORT_NETWORK
+
 static void merge_slice(size_t start, size_t n, size_t skip, bool right_heavy,
         void (*func)(size_t a, size_t b, void *aux), void *aux) {
     switch (n) {
@@ -55,29 +185,26 @@ static void merge_slice(size_t start, size_t n, size_t skip, bool right_heavy,
 
 static void sort_slice(size_t start, size_t n, size_t skip,
         void (*func)(size_t a, size_t b, void *aux), void *aux) {
-    switch (n) {
-        case 0:
-        case 1:
-            /* Do nothing. */
-            break;
-        case 2: {
-            func(start, start + skip, aux);
-            break;
-        }
-        default: {
-            /* Sort left and right halves. Sorting doesn't care if it's
-             * right-heavy. */
-            size_t left_length = (n + 1) / 2;
-            size_t right_length = n / 2;
-            sort_slice(start, left_length, skip, func, aux);
-            sort_slice(start + skip * left_length, right_length, skip, func,
-                    aux);
-
-            /* Odd-even merge. */
-            merge_slice(start, n, skip, false, func, aux);
-            break;
+    /* Small slices are sorted with a hard-coded network instead of
+     * recursing. */
+    if (n <= SORT_NETWORK_MAX_N) {
+        const struct sort_network *network = &sort_networks[n];
+        for (size_t i = 0; i < network->num_pairs; i++) {
+            func(start + skip * network->pairs[i][0],
+                    start + skip * network->pairs[i][1], aux);
         }
+        return;
     }
+
+    /* Sort left and right halves. Sorting doesn't care if it's
+     * right-heavy. */
+    size_t left_length = (n + 1) / 2;
+    size_t right_length = n / 2;
+    sort_slice(start, left_length, skip, func, aux);
+    sort_slice(start + skip * left_length, right_length, skip, func, aux);
+
+    /* Odd-even merge. */
+    merge_slice(start, n, skip, false, func, aux);
 }
 
 void o_sort_generate_swaps(size_t n,
@@ -88,6 +215,43 @@ void o_sort_generate_swaps(size_t n,
     sort_slice(0, n, 1, func, aux);
 }
 
+int o_sort_generate_swap_layers(size_t n,
+        void (*func)(const struct o_swap_pair *pairs, size_t num_pairs,
+            void *aux),
+        void *aux) {
+    /* No index appears twice in a layer, so a layer has at most N / 2 pairs. */
+    struct o_swap_pair *pairs = malloc((n / 2 ? n / 2 : 1) * sizeof(*pairs));
+    if (!pairs) {
+        return -1;
+    }
+
+    /* This is the iterative formulation of Batcher's odd-even mergesort, which
+     * works for arbitrary-sized arrays by dropping the comparators of the
+     * next-largest power-of-2 network that touch indices past N. Merging runs
+     * of length P happens in layers comparing elements at distance K, and each
+     * layer consists of runs of K consecutive comparators that are either all
+     * within a block of 2 * P elements or all crossing a block boundary. */
+    for (size_t p = 1; p < n; p *= 2) {
+        for (size_t k = p; k; k /= 2) {
+            size_t num_pairs = 0;
+            for (size_t j = k % p; j + k < n; j += k * 2) {
+                if (j / (p * 2) != (j + k) / (p * 2)) {
+                    continue;
+                }
+                for (size_t i = j; i < j + k && i + k < n; i++) {
+                    pairs[num_pairs].a = i;
+                    pairs[num_pairs].b = i + k;
+                    num_pairs++;
+                }
+            }
+            func(pairs, num_pairs, aux);
+        }
+    }
+
+    free(pairs);
+    return 0;
+}
+
 struct sort_swap_aux {
     unsigned char *data;
     size_t elem_size;
@@ -102,6 +266,48 @@ static void sort_swap(size_t a, size_t b, void *aux_) {
     o_memswap(a_addr, b_addr, aux->elem_size, comp > 0);
 }
 
+/* Number of comparators to prefetch ahead of in a layer. */
+#define SORT_PREFETCH_DISTANCE 8
+
+static void sort_swap_layer(const struct o_swap_pair *pairs, size_t num_pairs,
+        void *aux_) {
+    struct sort_swap_aux *aux = aux_;
+    for (size_t i = 0; i < num_pairs; i++) {
+#ifdef __GNUC__
+        if (i + SORT_PREFETCH_DISTANCE < num_pairs) {
+            const struct o_swap_pair *next = &pairs[i + SORT_PREFETCH_DISTANCE];
+            __builtin_prefetch(aux->data + aux->elem_size * next->a, 1);
+            __builtin_prefetch(aux->data + aux->elem_size * next->b, 1);
+        }
+#endif
+        sort_swap(pairs[i].a, pairs[i].b, aux);
+    }
+}
+
+/* Layers stream over the whole array, whereas the recursive network finishes
+ * small subarrays while they are still in cache, so layers only pay off for
+ * large arrays of small elements, where prefetching hides the memory latency of
+ * each pass. */
+#define SORT_LAYERED_MIN_N 262144
+#define SORT_LAYERED_MAX_ELEM_SIZE 64
+
+void o_sort_small(void *data_, size_t n, size_t elem_size,
+        int (*comparator)(const void *a, const void *b, void *aux), void *aux) {
+    unsigned char *data = data_;
+
+    if (n > SORT_NETWORK_MAX_N) {
+        o_sort(data, n, elem_size, comparator, aux);
+        return;
+    }
+
+    const struct sort_network *network = &sort_networks[n];
+    for (size_t i = 0; i < network->num_pairs; i++) {
+        unsigned char *a = data + elem_size * network->pairs[i][0];
+        unsigned char *b = data + elem_size * network->pairs[i][1];
+        o_memswap(a, b, elem_size, comparator(a, b, aux) > 0);
+    }
+}
+
 void o_sort(void *data, size_t n, size_t elem_size,
         int (*comparator)(const void *a, const void *b, void *aux), void *aux) {
     struct sort_swap_aux sort_swap_aux = {
@@ -110,13 +316,126 @@ void o_sort(void *data, size_t n, size_t elem_size,
         .comparator = comparator,
         .aux = aux,
     };
+    /* The layered network needs scratch space for a layer of pairs. If it
+     * cannot be allocated, fall back to the recursive network. */
+    if (n >= SORT_LAYERED_MIN_N && elem_size <= SORT_LAYERED_MAX_ELEM_SIZE
+            && !o_sort_generate_swap_layers(n, sort_swap_layer,
+                &sort_swap_aux)) {
+        return;
+    }
     o_sort_generate_swaps(n, sort_swap, &sort_swap_aux);
 }
 
+struct sort_columns_aux {
+    unsigned char *keys;
+    size_t key_size;
+    void *const *columns;
+    const size_t *column_sizes;
+    size_t num_columns;
+    int (*comparator)(const void *a, const void *b, void *aux);
+    void *aux;
+};
+static void sort_columns_swap(size_t a, size_t b, void *aux_) {
+    struct sort_columns_aux *aux = aux_;
+    void *a_addr = aux->keys + aux->key_size * a;
+    void *b_addr = aux->keys + aux->key_size * b;
+    bool cond = aux->comparator(a_addr, b_addr, aux->aux) > 0;
+    o_memswap(a_addr, b_addr, aux->key_size, cond);
+    for (size_t i = 0; i < aux->num_columns; i++) {
+        unsigned char *column = aux->columns[i];
+        size_t column_size = aux->column_sizes[i];
+        o_memswap(column + column_size * a, column + column_size * b,
+                column_size, cond);
+    }
+}
+
+void o_sort_columns(void *keys, size_t n, size_t key_size,
+        void *const *columns, const size_t *column_sizes, size_t num_columns,
+        int (*comparator)(const void *a, const void *b, void *aux), void *aux) {
+    struct sort_columns_aux sort_columns_aux = {
+        .keys = keys,
+        .key_size = key_size,
+        .columns = columns,
+        .column_sizes = column_sizes,
+        .num_columns = num_columns,
+        .comparator = comparator,
+        .aux = aux,
+    };
+    o_sort_generate_swaps(n, sort_columns_swap, &sort_columns_aux);
+}
+
+/* Top-k selection. */
+
+struct topk_swap_aux {
+    size_t k;
+    size_t block_start;
+    struct sort_swap_aux *sort_swap_aux;
+};
+
+/* Maps the indices of a 2K-element merge onto the first K elements followed by
+ * the K elements starting at BLOCK_START. */
+static void topk_swap(size_t a, size_t b, void *aux_) {
+    struct topk_swap_aux *aux = aux_;
+    a = a < aux->k ? a : aux->block_start + a - aux->k;
+    b = b < aux->k ? b : aux->block_start + b - aux->k;
+    sort_swap(a, b, aux->sort_swap_aux);
+}
+
+void o_select_topk(void *data, size_t n, size_t elem_size, size_t k,
+        int (*comparator)(const void *a, const void *b, void *aux), void *aux) {
+    if (k == 0) {
+        return;
+    }
+    if (n < k * 2) {
+        o_sort(data, n, elem_size, comparator, aux);
+        return;
+    }
+
+    struct sort_swap_aux sort_swap_aux = {
+        .data = data,
+        .elem_size = elem_size,
+        .comparator = comparator,
+        .aux = aux,
+    };
+    struct topk_swap_aux topk_swap_aux = {
+        .k = k,
+        .sort_swap_aux = &sort_swap_aux,
+    };
+
+    /* Keep the running K smallest elements sorted at the front. Each
+     * subsequent block of K elements is sorted and merged with them, after
+     * which the front holds the K smallest of both, and the block holds the
+     * rest. The last block is shifted back to end at N if N is not a multiple
+     * of K, which is fine because the elements it overlaps with were already
+     * rejected and are no less than any element at the front. */
+    sort_slice(0, k, 1, sort_swap, &sort_swap_aux);
+    for (size_t start = k; start < n; start += k) {
+        topk_swap_aux.block_start = start + k <= n ? start : n - k;
+        sort_slice(topk_swap_aux.block_start, k, 1, sort_swap,
+                &sort_swap_aux);
+        merge_slice(0, k * 2, 1, false, topk_swap, &topk_swap_aux);
+    }
+}
+
 /* Compaction. */
 
+/* Counts the marked items among the N starting at START. Every count is taken
+ * before any swaps within that range, so if PREFIX is given, it is read off
+ * the running counts of marked items in the original order. */
+static size_t compact_count(size_t start, size_t n, const size_t *prefix,
+        bool (*is_marked)(size_t index, void *aux), void *aux) {
+    if (prefix) {
+        return prefix[start + n] - prefix[start];
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += is_marked(start + i, aux);
+    }
+    return count;
+}
+
 static void compact_offset(size_t start, size_t n, size_t offset,
-        bool (*is_marked)(size_t index, void *aux),
+        const size_t *prefix, bool (*is_marked)(size_t index, void *aux),
         void (*swap)(size_t a, size_t b, bool should_swap, void *aux),
         void *aux) {
     if (n < 2) {
@@ -124,26 +443,27 @@ static void compact_offset(size_t start, size_t n, size_t offset,
     }
 
     if (n == 2) {
-        bool left_is_marked = is_marked(start, aux);
-        bool right_is_marked = is_marked(start + 1, aux);
+        bool left_is_marked = compact_count(start, 1, prefix, is_marked, aux);
+        bool right_is_marked =
+            compact_count(start + 1, 1, prefix, is_marked, aux);
         swap(start, start + 1,
                 (!left_is_marked & right_is_marked) != (offset % 2 == 1), aux);
         return;
     }
 
     /* Count the number of marked items in the left half. */
-    size_t left_marked_count = 0;
-    for (size_t i = 0; i < n / 2; i++) {
-        left_marked_count += is_marked(start + i, aux);
-    }
+    size_t left_marked_count =
+        compact_count(start, n / 2, prefix, is_marked, aux);
 
     /* Compact the left half to an offset of OFFSET % (N / 2). */
-    compact_offset(start, n / 2, offset % (n / 2), is_marked, swap, aux);
+    compact_offset(start, n / 2, offset % (n / 2), prefix, is_marked, swap,
+            aux);
 
     /* Compact the right half to an offset of
      * (OFFSET + LEFT_MARKED_COUNT) % (N / 2). */
     compact_offset(start + n / 2, n / 2,
-            (offset + left_marked_count) % (n / 2), is_marked, swap, aux);
+            (offset + left_marked_count) % (n / 2), prefix, is_marked, swap,
+            aux);
 
     /* Perform a range of swaps to place the compaction result at the right
      * offset. */
@@ -155,7 +475,7 @@ static void compact_offset(size_t start, size_t n, size_t offset,
     }
 }
 
-void o_compact_generate_swaps(size_t n,
+static void compact_generate_swaps(size_t n, const size_t *prefix,
         bool (*is_marked)(size_t index, void *aux),
         void (*swap)(size_t a, size_t b, bool should_swap, void *aux),
         void *aux) {
@@ -167,15 +487,13 @@ void o_compact_generate_swaps(size_t n,
     size_t left_length = n - right_length;
 
     /* Count the number of marked items in the left half. */
-    size_t left_marked_count = 0;
-    for (size_t i = 0; i < left_length; i++) {
-        left_marked_count += is_marked(i, aux);
-    }
+    size_t left_marked_count =
+        compact_count(0, left_length, prefix, is_marked, aux);
 
-    o_compact_generate_swaps(left_length, is_marked, swap, aux);
+    compact_generate_swaps(left_length, prefix, is_marked, swap, aux);
     compact_offset(left_length, right_length,
             (right_length - left_length + left_marked_count) % right_length,
-            is_marked, swap, aux);
+            prefix, is_marked, swap, aux);
 
     for (size_t i = 0; i < left_length; i++) {
         bool should_swap = i >= left_marked_count;
@@ -183,6 +501,13 @@ void o_compact_generate_swaps(size_t n,
     }
 }
 
+void o_compact_generate_swaps(size_t n,
+        bool (*is_marked)(size_t index, void *aux),
+        void (*swap)(size_t a, size_t b, bool should_swap, void *aux),
+        void *aux) {
+    compact_generate_swaps(n, NULL, is_marked, swap, aux);
+}
+
 struct compact_aux {
     unsigned char *data;
     size_t elem_size;
@@ -211,3 +536,815 @@ void o_compact(void *data, size_t n, size_t elem_size,
     };
     o_compact_generate_swaps(n, compact_is_marked, compact_swap, &compact_aux);
 }
+
+/* Capacity of each bin in loose compaction. There are enough bins that each
+ * expects a quarter of this many marked elements, so a bin overflows with
+ * probability below 2^-58 by a Chernoff bound. */
+#define COMPACT_LOOSE_BIN_SIZE 64
+#define COMPACT_LOOSE_BIN_LOAD (COMPACT_LOOSE_BIN_SIZE / 4)
+
+int o_compact_loose(void *data_, size_t n, size_t elem_size, size_t k,
+        bool (*is_marked)(const void *elem, void *aux), void *aux,
+        size_t *out_n, uint64_t (*rand_func)(void)) {
+    unsigned char *data = data_;
+    size_t num_bins = CEIL_DIV(k, COMPACT_LOOSE_BIN_LOAD);
+    size_t *bins = NULL;
+    size_t *bin_offsets = NULL;
+    unsigned char *scratch = NULL;
+    int ret = -1;
+
+    /* Refuse a bound that does not hold rather than dropping marked elements
+     * from the output. Only whether the caller's bound holds is leaked. */
+    size_t marked_count = 0;
+    for (size_t i = 0; i < n; i++) {
+        marked_count += is_marked(data + i * elem_size, aux);
+    }
+    if (marked_count > k) {
+        goto exit;
+    }
+
+    if (num_bins * COMPACT_LOOSE_BIN_SIZE >= n || num_bins <= 1) {
+        /* The output would not be smaller than a full compaction. */
+        o_compact(data, n, elem_size, is_marked, aux);
+        *out_n = MIN(k, n);
+        return 0;
+    }
+
+    bins = malloc(n * sizeof(*bins));
+    if (!bins) {
+        goto exit;
+    }
+    bin_offsets = calloc(num_bins + 1, sizeof(*bin_offsets));
+    if (!bin_offsets) {
+        goto exit_free_bins;
+    }
+    scratch = malloc(n * elem_size);
+    if (!scratch) {
+        goto exit_free_bin_offsets;
+    }
+
+    /* Throw each element into a random bin. The bins are chosen independently
+     * of the data, so the scatter may be done in the clear. */
+    for (size_t i = 0; i < n; i++) {
+        bins[i] = rand_func() % num_bins;
+        bin_offsets[bins[i] + 1]++;
+    }
+    for (size_t i = 0; i < num_bins; i++) {
+        bin_offsets[i + 1] += bin_offsets[i];
+    }
+    for (size_t i = 0; i < n; i++) {
+        memcpy(scratch + bin_offsets[bins[i]] * elem_size,
+                data + i * elem_size, elem_size);
+        bin_offsets[bins[i]]++;
+    }
+    for (size_t i = num_bins; i > 0; i--) {
+        bin_offsets[i] = bin_offsets[i - 1];
+    }
+    bin_offsets[0] = 0;
+
+    /* Compact each bin and check that none overflowed. */
+    bool overflowed = false;
+    for (size_t i = 0; i < num_bins; i++) {
+        unsigned char *bin = scratch + bin_offsets[i] * elem_size;
+        size_t bin_len = bin_offsets[i + 1] - bin_offsets[i];
+        size_t bin_marked_count = 0;
+        for (size_t j = 0; j < bin_len; j++) {
+            bin_marked_count += is_marked(bin + j * elem_size, aux);
+        }
+        overflowed |= bin_marked_count > COMPACT_LOOSE_BIN_SIZE;
+        o_compact(bin, bin_len, elem_size, is_marked, aux);
+    }
+
+    /* Gather the head of each bin to the front of DATA, followed by the
+     * remainders. */
+    size_t head_idx = 0;
+    size_t tail_idx = 0;
+    for (size_t i = 0; i < num_bins; i++) {
+        tail_idx +=
+            MIN(bin_offsets[i + 1] - bin_offsets[i], COMPACT_LOOSE_BIN_SIZE);
+    }
+    *out_n = tail_idx;
+    for (size_t i = 0; i < num_bins; i++) {
+        unsigned char *bin = scratch + bin_offsets[i] * elem_size;
+        size_t bin_len = bin_offsets[i + 1] - bin_offsets[i];
+        size_t head_len = MIN(bin_len, COMPACT_LOOSE_BIN_SIZE);
+        memcpy(data + head_idx * elem_size, bin, head_len * elem_size);
+        memcpy(data + tail_idx * elem_size, bin + head_len * elem_size,
+                (bin_len - head_len) * elem_size);
+        head_idx += head_len;
+        tail_idx += bin_len - head_len;
+    }
+
+    /* Only the fact that the fallback was taken is leaked, which happens with
+     * negligible probability when K is a true bound. */
+    if (overflowed) {
+        o_compact(data, n, elem_size, is_marked, aux);
+        *out_n = MAX(*out_n, MIN(k, n));
+    }
+
+    ret = 0;
+
+    free(scratch);
+exit_free_bin_offsets:
+    free(bin_offsets);
+exit_free_bins:
+    free(bins);
+exit:
+    return ret;
+}
+
+/* Small-domain sorting. */
+
+struct radix_aux {
+    unsigned char *data;
+    size_t elem_size;
+    size_t n;
+    bool reverse;
+};
+
+static size_t radix_index(struct radix_aux *aux, size_t index) {
+    return aux->reverse ? aux->n - 1 - index : index;
+}
+
+static void radix_swap(size_t a, size_t b, bool should_swap, void *aux_) {
+    struct radix_aux *aux = aux_;
+    a = radix_index(aux, a);
+    b = radix_index(aux, b);
+    o_memswap(aux->data + aux->elem_size * a, aux->data + aux->elem_size * b,
+            aux->elem_size, should_swap);
+}
+
+/* Sets PREFIX[I] to the number of the first I elements, in the order given by
+ * RADIX_AUX, whose bit BIT of their key in KEYS equals VALUE. */
+static void radix_count(size_t *prefix, const size_t *keys, size_t bit,
+        bool value, struct radix_aux *radix_aux) {
+    prefix[0] = 0;
+    for (size_t i = 0; i < radix_aux->n; i++) {
+        bool key_bit = (keys[radix_index(radix_aux, i)] >> bit) & 1;
+        prefix[i + 1] = prefix[i] + (key_bit == value);
+    }
+}
+
+/* Largest element size for which a compaction swap is cheaper than an o_sort
+ * comparator. */
+#define SMALL_DOMAIN_SMALL_ELEM_SIZE 128
+
+/* The key of an element and its original index, to break ties by. */
+struct small_domain_tag {
+    size_t key;
+    size_t idx;
+};
+
+static int small_domain_comparator(const void *a_, const void *b_,
+        void *aux UNUSED) {
+    const struct small_domain_tag *a = a_;
+    const struct small_domain_tag *b = b_;
+    int comp = (a->key > b->key) - (a->key < b->key);
+    int idx_comp = (a->idx > b->idx) - (a->idx < b->idx);
+    return comp * 2 + idx_comp;
+}
+
+int o_sort_small_domain(void *data_, size_t n, size_t elem_size,
+        size_t (*get_key)(const void *elem, void *aux), size_t domain,
+        void *aux) {
+    unsigned char *data = data_;
+    int ret = -1;
+
+    if (n < 2) {
+        return 0;
+    }
+
+    /* A radix pass costs two compactions of about N / 2 * log2(N) swaps each,
+     * while o_sort costs about N / 4 * log2(N)^2 comparators. Measured, a
+     * compaction swap costs about half as much as a comparator for elements of
+     * up to SMALL_DOMAIN_SMALL_ELEM_SIZE bytes, which are dominated by the
+     * comparator call, and about as much for larger ones, which are dominated
+     * by moving the data, so radix sorting wins while the key has less than
+     * a half or a quarter as many bits as N, respectively. */
+    size_t bits = domain > 1 ? (size_t) ilog2l(domain - 1) + 1 : 0;
+    size_t log_n = ilog2l(n - 1) + 1;
+    size_t bits_factor = elem_size <= SMALL_DOMAIN_SMALL_ELEM_SIZE ? 2 : 4;
+    if (bits * bits_factor >= log_n) {
+        /* o_sort is not stable, so sort on the keys tagged with the original
+         * indices, moving the elements along with them. */
+        struct small_domain_tag *tags = malloc(n * sizeof(*tags));
+        if (!tags) {
+            goto exit;
+        }
+        for (size_t i = 0; i < n; i++) {
+            tags[i].key = get_key(data + elem_size * i, aux);
+            tags[i].idx = i;
+        }
+        void *columns[] = { data };
+        size_t column_sizes[] = { elem_size };
+        o_sort_columns(tags, n, sizeof(*tags), columns, column_sizes, 1,
+                small_domain_comparator, NULL);
+        free(tags);
+        return 0;
+    }
+
+    /* A single allocation holds the keys of DATA and the running counts of
+     * marked elements that drive the compactions, followed by a copy of
+     * DATA. */
+    size_t *keys = malloc(n * (sizeof(*keys) * 2 + elem_size) + sizeof(*keys));
+    if (!keys) {
+        goto exit;
+    }
+    size_t *prefix = keys + n;
+    unsigned char *copy = (unsigned char *) (prefix + n + 1);
+
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = get_key(data + elem_size * i, aux);
+    }
+
+    /* Least-significant-digit radix sort, one bit per pass. Each pass
+     * compacts the elements with a 0 bit to the front of DATA and the elements
+     * with a 1 bit to the back of the copy, which are both order-preserving,
+     * and then takes the back of the copy starting from the number of 0 bits,
+     * which results in a stable partition. The swaps of a compaction depend
+     * only on which elements are marked before it starts, so they are computed
+     * from a prefix count of the marks rather than by rescanning them. */
+    for (size_t bit = 0; bit < bits; bit++) {
+        memcpy(copy, data, n * elem_size);
+
+        struct radix_aux radix_aux = {
+            .data = data,
+            .elem_size = elem_size,
+            .n = n,
+            .reverse = false,
+        };
+        radix_count(prefix, keys, bit, false, &radix_aux);
+        size_t zero_count = prefix[n];
+        compact_generate_swaps(n, prefix, NULL, radix_swap, &radix_aux);
+        radix_aux.data = copy;
+        radix_aux.reverse = true;
+        radix_count(prefix, keys, bit, true, &radix_aux);
+        compact_generate_swaps(n, prefix, NULL, radix_swap, &radix_aux);
+
+        for (size_t i = 0; i < n; i++) {
+            o_memcpy(data + elem_size * i, copy + elem_size * i, elem_size,
+                    i >= zero_count);
+            keys[i] = get_key(data + elem_size * i, aux);
+        }
+    }
+
+    ret = 0;
+
+    free(keys);
+exit:
+    return ret;
+}
+
+/* Aggregation. */
+
+struct group_aggregate_aux {
+    unsigned char *data;
+    size_t elem_size;
+    bool *is_last;
+};
+
+static bool group_aggregate_is_marked(size_t index, void *aux_) {
+    struct group_aggregate_aux *aux = aux_;
+    return aux->is_last[index];
+}
+
+static void group_aggregate_swap(size_t a, size_t b, bool should_swap,
+        void *aux_) {
+    struct group_aggregate_aux *aux = aux_;
+    o_memswap(aux->data + aux->elem_size * a, aux->data + aux->elem_size * b,
+            aux->elem_size, should_swap);
+    o_swapbool(&aux->is_last[a], &aux->is_last[b], should_swap);
+}
+
+int o_group_aggregate(void *data_, size_t n, size_t elem_size,
+        int (*key_comparator)(const void *a, const void *b, void *aux),
+        void (*combine)(void *dest, const void *src, void *aux), void *aux,
+        size_t *num_groups) {
+    unsigned char *data = data_;
+
+    if (n == 0) {
+        *num_groups = 0;
+        return 0;
+    }
+
+    /* A single allocation holds the fold buffer followed by the per-element
+     * flags marking the last element of each group. */
+    unsigned char *scratch = malloc(elem_size + n * sizeof(bool));
+    if (!scratch) {
+        return -1;
+    }
+    unsigned char *folded = scratch;
+    bool *is_last = (bool *) (scratch + elem_size);
+
+    o_sort(data, n, elem_size, key_comparator, aux);
+
+    /* Segmented reduction. Each element folds in the running aggregate of its
+     * predecessor iff they share a key, so the last element of each group ends
+     * up holding the aggregate of the whole group. The group boundaries are
+     * marked in the same pass. */
+    size_t group_count = 1;
+    for (size_t i = 1; i < n; i++) {
+        unsigned char *prev = data + elem_size * (i - 1);
+        unsigned char *cur = data + elem_size * i;
+        bool same_group = key_comparator(prev, cur, aux) == 0;
+        memcpy(folded, cur, elem_size);
+        combine(folded, prev, aux);
+        o_memcpy(cur, folded, elem_size, same_group);
+        is_last[i - 1] = !same_group;
+        group_count += !same_group;
+    }
+    is_last[n - 1] = true;
+
+    /* Compact the aggregates to the front. Compaction is order-preserving, so
+     * the groups stay sorted by key. */
+    struct group_aggregate_aux group_aggregate_aux = {
+        .data = data,
+        .elem_size = elem_size,
+        .is_last = is_last,
+    };
+    o_compact_generate_swaps(n, group_aggregate_is_marked,
+            group_aggregate_swap, &group_aggregate_aux);
+
+    *num_groups = group_count;
+
+    free(scratch);
+    return 0;
+}
+
+/* Histograms. */
+
+/* Above this many buckets, a histogram sorts the bucket indices instead of
+ * touching every bucket for every element. */
+#define HISTOGRAM_SCAN_MAX_BUCKETS 256
+
+struct histogram_entry {
+    size_t bucket;
+    size_t count;
+    bool is_marker;     /* Whether this is the end marker for its bucket. */
+};
+
+/* Comparator to sort entries by bucket, with each marker after the elements of
+ * its bucket. */
+static int histogram_comparator(const void *a_, const void *b_,
+        void *aux UNUSED) {
+    const struct histogram_entry *a = a_;
+    const struct histogram_entry *b = b_;
+    int bucket_comp =
+        (int) (a->bucket > b->bucket) - (int) (a->bucket < b->bucket);
+    int marker_comp = (int) a->is_marker - (int) b->is_marker;
+    return bucket_comp * 2 + marker_comp;
+}
+
+static bool histogram_is_marker(const void *elem, void *aux UNUSED) {
+    const struct histogram_entry *entry = elem;
+    return entry->is_marker;
+}
+
+int o_histogram(const void *data_, size_t n, size_t elem_size,
+        size_t (*get_bucket)(const void *elem, void *aux), void *aux,
+        size_t num_buckets, size_t *counts) {
+    const unsigned char *data = data_;
+
+    if (num_buckets <= HISTOGRAM_SCAN_MAX_BUCKETS) {
+        /* Add to every bucket for every element. The inner loop has no
+         * data-dependent accesses and vectorizes. */
+        memset(counts, 0, num_buckets * sizeof(*counts));
+        for (size_t i = 0; i < n; i++) {
+            size_t bucket = get_bucket(data + i * elem_size, aux);
+            for (size_t j = 0; j < num_buckets; j++) {
+                counts[j] += j == bucket;
+            }
+        }
+        return 0;
+    }
+
+    /* Sort the bucket indices together with a marker for each bucket, count
+     * the run ending at each marker, and compact the markers to the front in
+     * bucket order. Only the bucket indices are copied, not the input. */
+    struct histogram_entry *entries =
+        malloc((n + num_buckets) * sizeof(*entries));
+    if (!entries) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        entries[i].bucket = get_bucket(data + i * elem_size, aux);
+        entries[i].is_marker = false;
+    }
+    for (size_t i = 0; i < num_buckets; i++) {
+        entries[n + i].bucket = i;
+        entries[n + i].is_marker = true;
+    }
+
+    o_sort(entries, n + num_buckets, sizeof(*entries), histogram_comparator,
+            NULL);
+
+    entries[0].count = !entries[0].is_marker;
+    for (size_t i = 1; i < n + num_buckets; i++) {
+        entries[i].count =
+            entries[i - 1].count * (entries[i - 1].bucket == entries[i].bucket)
+                + !entries[i].is_marker;
+    }
+
+    o_compact(entries, n + num_buckets, sizeof(*entries), histogram_is_marker,
+            NULL);
+    for (size_t i = 0; i < num_buckets; i++) {
+        counts[i] = entries[i].count;
+    }
+
+    free(entries);
+    return 0;
+}
+
+size_t o_count_distinct(void *data_, size_t n, size_t elem_size,
+        int (*comparator)(const void *a, const void *b, void *aux),
+        void *aux) {
+    unsigned char *data = data_;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    o_sort(data, n, elem_size, comparator, aux);
+
+    size_t count = 1;
+    for (size_t i = 1; i < n; i++) {
+        count += comparator(data + (i - 1) * elem_size, data + i * elem_size,
+                aux) != 0;
+    }
+    return count;
+}
+
+/* Batch lookups. */
+
+struct lookup_entry {
+    uint64_t key;
+    uint64_t query_idx;     /* The index of the query, if a query. */
+    bool is_query;          /* Whether the entry is a query. */
+    bool found;             /* Whether the query found a match. */
+    unsigned char value[1]; /* The table value, or the query's answer. */
+};
+
+/* Comparator to sort entries by key, with table entries before queries. */
+static int lookup_key_comparator(const void *a_, const void *b_,
+        void *aux UNUSED) {
+    const struct lookup_entry *a = a_;
+    const struct lookup_entry *b = b_;
+    int key_comp = (int) (a->key > b->key) - (int) (a->key < b->key);
+    int query_comp = (int) a->is_query - (int) b->is_query;
+    return key_comp * 2 + query_comp;
+}
+
+/* Comparator to sort queries back into their original order. */
+static int lookup_index_comparator(const void *a_, const void *b_,
+        void *aux UNUSED) {
+    const struct lookup_entry *a = a_;
+    const struct lookup_entry *b = b_;
+    return (int) (a->query_idx > b->query_idx)
+        - (int) (a->query_idx < b->query_idx);
+}
+
+static bool lookup_is_query(const void *elem, void *aux UNUSED) {
+    const struct lookup_entry *entry = elem;
+    return entry->is_query;
+}
+
+int o_batch_lookup(const uint64_t *table_keys, const void *table_values_,
+        size_t n, size_t value_size, const uint64_t *query_keys, size_t m,
+        void *values_, bool *found) {
+    const unsigned char *table_values = table_values_;
+    unsigned char *values = values_;
+    size_t entry_size =
+        CEIL_DIV(offsetof(struct lookup_entry, value) + value_size,
+                sizeof(uint64_t))
+            * sizeof(uint64_t);
+
+    unsigned char *entries = calloc(n + m ? n + m : 1, entry_size);
+    if (!entries) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        struct lookup_entry *entry =
+            (struct lookup_entry *) (entries + i * entry_size);
+        entry->key = table_keys[i];
+        entry->is_query = false;
+        memcpy(entry->value, table_values + i * value_size, value_size);
+    }
+    for (size_t i = 0; i < m; i++) {
+        struct lookup_entry *entry =
+            (struct lookup_entry *) (entries + (n + i) * entry_size);
+        entry->key = query_keys[i];
+        entry->query_idx = i;
+        entry->is_query = true;
+    }
+
+    o_sort(entries, n + m, entry_size, lookup_key_comparator, NULL);
+
+    /* Propagate each table value to the queries that follow it with the same
+     * key. */
+    for (size_t i = 1; i < n + m; i++) {
+        struct lookup_entry *prev =
+            (struct lookup_entry *) (entries + (i - 1) * entry_size);
+        struct lookup_entry *cur =
+            (struct lookup_entry *) (entries + i * entry_size);
+        bool cond = cur->is_query & (cur->key == prev->key)
+            & (!prev->is_query | prev->found);
+        o_memcpy(cur->value, prev->value, value_size, cond);
+        cur->found = cond;
+    }
+
+    /* Route the answers back in query order. */
+    o_compact(entries, n + m, entry_size, lookup_is_query, NULL);
+    o_sort(entries, m, entry_size, lookup_index_comparator, NULL);
+
+    for (size_t i = 0; i < m; i++) {
+        struct lookup_entry *entry =
+            (struct lookup_entry *) (entries + i * entry_size);
+        memcpy(values + i * value_size, entry->value, value_size);
+        found[i] = entry->found;
+    }
+
+    free(entries);
+    return 0;
+}
+
+/* Joins. */
+
+/* Each entry of the tagged concatenation holds room for both a left and a right
+ * element, so that matches can be assembled in place. */
+struct join_entry {
+    uint64_t key;
+    uint64_t left_count;    /* Left elements in the entry's key group. */
+    uint64_t right_count;   /* Right elements in the entry's key group. */
+    uint64_t order;         /* Destination index or position in the group. */
+    bool is_right;          /* Whether the entry came from the right table. */
+    bool is_valid;          /* Whether the entry is marked or in use. */
+    unsigned char row[1];   /* The left element followed by the right one. */
+};
+
+struct join_aux {
+    unsigned char *entries;
+    size_t entry_size;
+};
+
+static size_t get_join_entry_size(size_t left_elem_size,
+        size_t right_elem_size) {
+    return CEIL_DIV(offsetof(struct join_entry, row) + left_elem_size
+                + right_elem_size, sizeof(uint64_t))
+        * sizeof(uint64_t);
+}
+
+static struct join_entry *get_join_entry(struct join_aux *join, size_t idx) {
+    return (struct join_entry *) (join->entries + idx * join->entry_size);
+}
+
+/* Comparator to sort valid entries by key, then order, with left entries
+ * before right entries, and invalid entries at the end. */
+static int join_comparator(const void *a_, const void *b_, void *aux UNUSED) {
+    const struct join_entry *a = a_;
+    const struct join_entry *b = b_;
+    int valid_comp = (int) !a->is_valid - (int) !b->is_valid;
+    int key_comp = (int) (a->key > b->key) - (int) (a->key < b->key);
+    int order_comp = (int) (a->order > b->order) - (int) (a->order < b->order);
+    int right_comp = (int) a->is_right - (int) b->is_right;
+    return valid_comp * 8 + key_comp * 4 + order_comp * 2 + right_comp;
+}
+
+static bool join_is_marked(const void *elem, void *aux UNUSED) {
+    const struct join_entry *entry = elem;
+    return entry->is_valid;
+}
+
+/* Writes the tagged concatenation of LEFT and RIGHT to the (zeroed) entries of
+ * JOIN and sorts it by key, with left entries first within each key. */
+static void join_concat(struct join_aux *join, const unsigned char *left,
+        size_t left_n, size_t left_elem_size, const unsigned char *right,
+        size_t right_n, size_t right_elem_size,
+        uint64_t (*get_key)(const void *elem, bool is_right, void *aux),
+        void *aux) {
+    for (size_t i = 0; i < left_n; i++) {
+        struct join_entry *entry = get_join_entry(join, i);
+        const unsigned char *elem = left + i * left_elem_size;
+        entry->key = get_key(elem, false, aux);
+        entry->is_right = false;
+        entry->is_valid = true;
+        memcpy(entry->row, elem, left_elem_size);
+    }
+    for (size_t i = 0; i < right_n; i++) {
+        struct join_entry *entry = get_join_entry(join, left_n + i);
+        const unsigned char *elem = right + i * right_elem_size;
+        entry->key = get_key(elem, true, aux);
+        entry->is_right = true;
+        entry->is_valid = true;
+        memcpy(entry->row + left_elem_size, elem, right_elem_size);
+    }
+    o_sort(join->entries, left_n + right_n, join->entry_size, join_comparator,
+            NULL);
+}
+
+int o_join_pk_fk(const void *left, size_t left_n, size_t left_elem_size,
+        const void *right, size_t right_n, size_t right_elem_size,
+        uint64_t (*get_key)(const void *elem, bool is_right, void *aux),
+        void *aux, void *out_, size_t *out_n) {
+    unsigned char *out = out_;
+    size_t n = left_n + right_n;
+    size_t row_size = left_elem_size + right_elem_size;
+
+    struct join_aux join = {
+        .entry_size = get_join_entry_size(left_elem_size, right_elem_size),
+    };
+    join.entries = calloc(n ? n : 1, join.entry_size);
+    if (!join.entries) {
+        return -1;
+    }
+
+    join_concat(&join, left, left_n, left_elem_size, right, right_n,
+            right_elem_size, get_key, aux);
+
+    /* Propagate each left element to the right elements that follow it with
+     * the same key. A right element is matched iff its predecessor has the same
+     * key and is either the left element or another matched right element. The
+     * validity flag now marks matched elements. */
+    size_t match_count = 0;
+    if (n) {
+        get_join_entry(&join, 0)->is_valid = false;
+    }
+    for (size_t i = 1; i < n; i++) {
+        struct join_entry *prev = get_join_entry(&join, i - 1);
+        struct join_entry *cur = get_join_entry(&join, i);
+        bool matched = cur->is_right & (cur->key == prev->key)
+            & (!prev->is_right | prev->is_valid);
+        o_memcpy(cur->row, prev->row, left_elem_size, matched);
+        cur->is_valid = matched;
+        match_count += matched;
+    }
+
+    o_compact(join.entries, n, join.entry_size, join_is_marked, NULL);
+
+    for (size_t i = 0; i < match_count; i++) {
+        memcpy(out + i * row_size, get_join_entry(&join, i)->row, row_size);
+    }
+    *out_n = match_count;
+
+    free(join.entries);
+    return 0;
+}
+
+/* Obliviously expands the first N entries of JOIN such that each left (or
+ * right, if IS_RIGHT) entry is repeated as many times as there are right (or
+ * left) entries with the same key, and all other entries are dropped. The
+ * result occupies the first TOTAL of M >= TOTAL entries, with the rest
+ * invalid. JOIN must have room for max(N, M) entries. */
+static void join_expand(struct join_aux *join, size_t n, size_t m,
+        size_t total, bool is_right) {
+    for (size_t i = 0; i < n; i++) {
+        struct join_entry *entry = get_join_entry(join, i);
+        uint64_t count = is_right ? entry->left_count : entry->right_count;
+        entry->is_valid &= (entry->is_right == is_right) & (count > 0);
+    }
+
+    /* Compact the entries to keep, preserving their order, and compute the
+     * index of each one's first copy. */
+    o_compact(join->entries, n, join->entry_size, join_is_marked, NULL);
+    uint64_t dest = 0;
+    for (size_t i = 0; i < m; i++) {
+        struct join_entry *entry = get_join_entry(join, i);
+        uint64_t count = is_right ? entry->left_count : entry->right_count;
+        entry->order = dest;
+        o_set64(&dest, dest + count, entry->is_valid);
+    }
+
+    /* Distribute each entry to its first copy's index. Destinations are
+     * strictly increasing and no less than the current index, so routing
+     * entries by decreasing powers of 2 never collides. */
+    if (m > 1) {
+        size_t j = 1;
+        while (j * 2 < m) {
+            j *= 2;
+        }
+        for (; j; j /= 2) {
+            for (size_t i = m - j; i-- > 0;) {
+                struct join_entry *entry = get_join_entry(join, i);
+                bool cond = entry->is_valid & (entry->order >= i + j);
+                o_memswap(entry, get_join_entry(join, i + j),
+                        join->entry_size, cond);
+            }
+        }
+    }
+
+    /* Fill the gaps with copies of the preceding entry. */
+    for (size_t i = 1; i < m; i++) {
+        struct join_entry *entry = get_join_entry(join, i);
+        bool cond = !entry->is_valid & (i < total);
+        o_memcpy(entry, get_join_entry(join, i - 1), join->entry_size, cond);
+    }
+}
+
+int o_join(const void *left, size_t left_n, size_t left_elem_size,
+        const void *right, size_t right_n, size_t right_elem_size,
+        uint64_t (*get_key)(const void *elem, bool is_right, void *aux),
+        void *aux, void *out_, size_t out_bound, size_t *out_n) {
+    unsigned char *out = out_;
+    size_t n = left_n + right_n;
+    size_t row_size = left_elem_size + right_elem_size;
+    size_t capacity = n > out_bound ? n : out_bound;
+    int ret = -1;
+
+    /* A single allocation holds the tagged concatenation, which is later
+     * expanded in place into the right side of the output, and a copy of it to
+     * be expanded into the left side. */
+    size_t entry_size = get_join_entry_size(left_elem_size, right_elem_size);
+    unsigned char *scratch = calloc(capacity ? capacity * 2 : 1, entry_size);
+    if (!scratch) {
+        goto exit;
+    }
+    struct join_aux right_join = {
+        .entries = scratch,
+        .entry_size = entry_size,
+    };
+    struct join_aux left_join = {
+        .entries = scratch + capacity * entry_size,
+        .entry_size = entry_size,
+    };
+
+    join_concat(&right_join, left, left_n, left_elem_size, right, right_n,
+            right_elem_size, get_key, aux);
+
+    /* Count the left and right elements of each key group. A forward scan
+     * computes running counts, and a backward scan propagates the totals from
+     * the last entry of each group. */
+    for (size_t i = 0; i < n; i++) {
+        struct join_entry *entry = get_join_entry(&right_join, i);
+        uint64_t left_count = 0;
+        uint64_t right_count = 0;
+        if (i > 0) {
+            struct join_entry *prev = get_join_entry(&right_join, i - 1);
+            bool same_group = entry->key == prev->key;
+            o_set64(&left_count, prev->left_count, same_group);
+            o_set64(&right_count, prev->right_count, same_group);
+        }
+        entry->left_count = left_count + !entry->is_right;
+        entry->right_count = right_count + entry->is_right;
+    }
+    size_t total = 0;
+    for (size_t i = n; i-- > 0;) {
+        struct join_entry *entry = get_join_entry(&right_join, i);
+        if (i + 1 < n) {
+            struct join_entry *next = get_join_entry(&right_join, i + 1);
+            bool same_group = entry->key == next->key;
+            o_set64(&entry->left_count, next->left_count, same_group);
+            o_set64(&entry->right_count, next->right_count, same_group);
+        }
+        total += !entry->is_right * entry->right_count;
+    }
+    if (total > out_bound) {
+        goto exit_free_scratch;
+    }
+
+    /* Expand both sides to the output size. Groups occupy the same ranges on
+     * both sides, with the left side repeating each left element for every
+     * right element in the group. */
+    memcpy(left_join.entries, right_join.entries, n * entry_size);
+    join_expand(&left_join, n, out_bound, total, false);
+    join_expand(&right_join, n, out_bound, total, true);
+
+    /* Within each group of LEFT_COUNT * RIGHT_COUNT entries, the right side
+     * repeats each right element LEFT_COUNT times, so the copy COPY of right
+     * element R is moved to COPY * RIGHT_COUNT + R to line up with the left
+     * side. */
+    uint64_t copy = 0;
+    uint64_t r = 0;
+    for (size_t i = 0; i < out_bound; i++) {
+        struct join_entry *entry = get_join_entry(&right_join, i);
+        if (i > 0) {
+            struct join_entry *prev = get_join_entry(&right_join, i - 1);
+            bool same_group = entry->key == prev->key;
+            bool wrap = copy + 1 == entry->left_count;
+            o_set64(&r, r + wrap, same_group);
+            o_set64(&copy, (copy + 1) * !wrap, same_group);
+            o_set64(&r, 0, !same_group);
+            o_set64(&copy, 0, !same_group);
+        }
+        entry->order = copy * entry->right_count + r;
+    }
+    o_sort(right_join.entries, out_bound, entry_size, join_comparator, NULL);
+
+    /* Copy out all OUT_BOUND rows, so that the number of real rows is only
+     * revealed through OUT_N. */
+    for (size_t i = 0; i < out_bound; i++) {
+        bool cond = i < total;
+        o_memcpy(out + i * row_size, get_join_entry(&left_join, i)->row,
+                left_elem_size, cond);
+        o_memcpy(out + i * row_size + left_elem_size,
+                get_join_entry(&right_join, i)->row + left_elem_size,
+                right_elem_size, cond);
+    }
+    *out_n = total;
+
+    ret = 0;
+
+exit_free_scratch:
+    free(scratch);
+exit:
+    return ret;
+}
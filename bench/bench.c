@@ -0,0 +1,333 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "liboblivious/algorithms.h"
+#include "liboblivious/primitives.h"
+#include "liboblivious/shardedoram.h"
+
+/* Every element has a 32-bit key in its first 4 bytes, which is the smallest
+ * element size benchmarked. */
+typedef uint32_t bench_key_t;
+
+static const size_t elem_sizes[] = { 4, 16, 64, 256, 1024, 4096 };
+
+#define ORAM_BENCH_BLOCK_SIZE 64
+#define ORAM_BENCH_NUM_BLOCKS 65536
+#define ORAM_BENCH_STASH_SIZE 64
+#define ORAM_BENCH_ACCESSES 8192
+#define ORAM_BENCH_MAX_THREADS 1024
+
+struct bench_aux {
+    unsigned char *data;
+    size_t elem_size;
+    unsigned long long count;
+};
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bench_key_t get_key(const void *elem) {
+    bench_key_t key;
+    memcpy(&key, elem, sizeof(key));
+    return key;
+}
+
+static void fill_data(unsigned char *data, size_t n, size_t elem_size) {
+    for (size_t i = 0; i < n; i++) {
+        bench_key_t key = rand();
+        memset(data + i * elem_size, 0, elem_size);
+        memcpy(data + i * elem_size, &key, sizeof(key));
+    }
+}
+
+static int counting_comparator(const void *a, const void *b, void *aux_) {
+    struct bench_aux *aux = aux_;
+    bench_key_t a_key = get_key(a);
+    bench_key_t b_key = get_key(b);
+    aux->count++;
+    return (a_key > b_key) - (a_key < b_key);
+}
+
+static void compare_swap(size_t a, size_t b, void *aux_) {
+    struct bench_aux *aux = aux_;
+    unsigned char *a_addr = aux->data + a * aux->elem_size;
+    unsigned char *b_addr = aux->data + b * aux->elem_size;
+    aux->count++;
+    o_memswap(a_addr, b_addr, aux->elem_size,
+            get_key(a_addr) > get_key(b_addr));
+}
+
+static bool is_marked(const void *elem, void *aux UNUSED) {
+    return get_key(elem) % 2;
+}
+
+static bool is_marked_index(size_t index, void *aux_) {
+    struct bench_aux *aux = aux_;
+    return is_marked(aux->data + index * aux->elem_size, NULL);
+}
+
+static void count_swap(size_t a UNUSED, size_t b UNUSED,
+        bool should_swap UNUSED, void *aux_) {
+    struct bench_aux *aux = aux_;
+    aux->count++;
+}
+
+static void print_result(const char *op, size_t n, size_t elem_size,
+        double seconds, unsigned long long comparators, bool *first) {
+    /* Each comparator reads and conditionally rewrites both elements. */
+    unsigned long long bytes_moved = comparators * 2 * elem_size;
+    printf("%s\n    {\"op\": \"%s\", \"n\": %zu, \"elem_size\": %zu, "
+            "\"seconds\": %.6f, \"comparators\": %llu, "
+            "\"comparators_per_sec\": %.0f, \"bytes_moved\": %llu}",
+            *first ? "" : ",", op, n, elem_size, seconds, comparators,
+            comparators / seconds, bytes_moved);
+    *first = false;
+    fflush(stdout);
+}
+
+/* Per-thread xorshift64 state, so that threads don't contend on rand(). This is
+ * not secure, but it is sufficient for benchmarking. */
+static _Thread_local uint64_t rand_state;
+
+static uint64_t get_random(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+struct oram_thread_args {
+    shardedoram_t *shardedoram;
+    size_t num_accesses;
+    uint64_t seed;
+    int ret;
+};
+
+static void *run_oram_thread(void *args_) {
+    struct oram_thread_args *args = args_;
+    unsigned char data[ORAM_BENCH_BLOCK_SIZE] = { 0 };
+
+    rand_state = args->seed;
+    args->ret = 0;
+    for (size_t i = 0; i < args->num_accesses; i++) {
+        uint64_t block_id = get_random() % ORAM_BENCH_NUM_BLOCKS;
+        if (shardedoram_write(args->shardedoram, block_id, data, true,
+                    get_random)) {
+            args->ret = -1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Runs ORAM_BENCH_ACCESSES accesses divided among NUM_THREADS threads. */
+static int bench_shardedoram(shardedoram_t *shardedoram, size_t num_threads,
+        bool *first) {
+    int ret = -1;
+
+    pthread_t *threads = malloc(num_threads * sizeof(*threads));
+    if (!threads) {
+        fprintf(stderr, "Failed to allocate threads\n");
+        goto exit;
+    }
+    struct oram_thread_args *args = malloc(num_threads * sizeof(*args));
+    if (!args) {
+        fprintf(stderr, "Failed to allocate thread arguments\n");
+        goto exit_free_threads;
+    }
+
+    double start = get_time();
+    size_t i;
+    for (i = 0; i < num_threads; i++) {
+        args[i].shardedoram = shardedoram;
+        args[i].num_accesses = ORAM_BENCH_ACCESSES / num_threads;
+        args[i].seed = ((uint64_t) rand() << 32) | rand() | 1;
+        if (pthread_create(&threads[i], NULL, run_oram_thread, &args[i])) {
+            fprintf(stderr, "Failed to create thread\n");
+            goto exit_join_threads;
+        }
+    }
+    ret = 0;
+
+exit_join_threads:
+    for (size_t j = 0; j < i; j++) {
+        pthread_join(threads[j], NULL);
+        ret |= args[j].ret;
+    }
+    if (ret) {
+        goto exit_free_args;
+    }
+
+    double seconds = get_time() - start;
+    size_t accesses = ORAM_BENCH_ACCESSES / num_threads * num_threads;
+    printf("%s\n    {\"op\": \"shardedoram\", \"n\": %d, "
+            "\"elem_size\": %d, \"threads\": %zu, \"shards\": %zu, "
+            "\"seconds\": %.6f, \"accesses\": %zu, "
+            "\"accesses_per_sec\": %.0f}",
+            *first ? "" : ",", ORAM_BENCH_NUM_BLOCKS, ORAM_BENCH_BLOCK_SIZE,
+            num_threads, shardedoram->num_shards, seconds, accesses,
+            accesses / seconds);
+    *first = false;
+    fflush(stdout);
+
+exit_free_args:
+    free(args);
+exit_free_threads:
+    free(threads);
+exit:
+    return ret;
+}
+
+/* Parses STR as a decimal integer in [MIN, MAX] into OUT. Returns 0 on success
+ * or -1 if STR is not such an integer. */
+static int parse_size(const char *str, size_t min, size_t max, size_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long long val = strtoull(str, &end, 10);
+    if (errno || end == str || *end || strchr(str, '-') || val < min
+            || val > max) {
+        return -1;
+    }
+    *out = val;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-n max_n] [-m max_bytes] [-t max_threads]\n"
+            "Benchmarks o_sort, o_sort_generate_swaps, and o_compact for n from"
+            " 10^3 to\nmax_n (default 10^8), skipping inputs larger than"
+            " max_bytes (default 2^30),\nthen benchmarks a Circuit ORAM"
+            " sharded max_threads ways (default 8, at most %d)\nwith powers"
+            " of 2 up to max_threads threads, and prints the results as"
+            " JSON.\n",
+            prog, ORAM_BENCH_MAX_THREADS);
+}
+
+int main(int argc, char **argv) {
+    size_t max_n = 100000000;
+    size_t max_bytes = (size_t) 1 << 30;
+    size_t max_threads = 8;
+    int ret = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:t:")) != -1) {
+        switch (opt) {
+            case 'n':
+                if (parse_size(optarg, 1, SIZE_MAX / 10, &max_n)) {
+                    fprintf(stderr, "Invalid max_n: %s\n", optarg);
+                    goto exit;
+                }
+                break;
+            case 'm':
+                if (parse_size(optarg, 1, SIZE_MAX, &max_bytes)) {
+                    fprintf(stderr, "Invalid max_bytes: %s\n", optarg);
+                    goto exit;
+                }
+                break;
+            case 't':
+                if (parse_size(optarg, 1, ORAM_BENCH_MAX_THREADS,
+                            &max_threads)) {
+                    fprintf(stderr, "Invalid max_threads: %s\n", optarg);
+                    goto exit;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                goto exit;
+        }
+    }
+
+    srand(time(NULL));
+
+    bool first = true;
+    printf("[");
+    for (size_t n = 1000; n <= max_n; n *= 10) {
+        for (size_t i = 0; i < sizeof(elem_sizes) / sizeof(*elem_sizes); i++) {
+            size_t elem_size = elem_sizes[i];
+            if (n > max_bytes / elem_size) {
+                continue;
+            }
+
+            unsigned char *data = malloc(n * elem_size);
+            if (!data) {
+                fprintf(stderr, "Failed to allocate %zu bytes\n",
+                        n * elem_size);
+                goto exit_close;
+            }
+            struct bench_aux aux = {
+                .data = data,
+                .elem_size = elem_size,
+            };
+            double start;
+
+            fill_data(data, n, elem_size);
+            aux.count = 0;
+            start = get_time();
+            o_sort(data, n, elem_size, counting_comparator, &aux);
+            print_result("o_sort", n, elem_size, get_time() - start, aux.count,
+                    &first);
+
+            fill_data(data, n, elem_size);
+            aux.count = 0;
+            start = get_time();
+            o_sort_generate_swaps(n, compare_swap, &aux);
+            print_result("o_sort_generate_swaps", n, elem_size,
+                    get_time() - start, aux.count, &first);
+
+            /* The swaps are counted separately so that counting does not
+             * perturb the timed o_compact. */
+            fill_data(data, n, elem_size);
+            aux.count = 0;
+            o_compact_generate_swaps(n, is_marked_index, count_swap, &aux);
+            start = get_time();
+            o_compact(data, n, elem_size, is_marked, NULL);
+            print_result("o_compact", n, elem_size, get_time() - start,
+                    aux.count, &first);
+
+            free(data);
+        }
+    }
+
+    shardedoram_t shardedoram;
+    struct oram_config config = {
+        .type = ORAM_TYPE_CIRCUIT,
+        .block_size = ORAM_BENCH_BLOCK_SIZE,
+        .blocks_per_bucket = 4,
+        .num_blocks = ORAM_BENCH_NUM_BLOCKS,
+        .stash_size = ORAM_BENCH_STASH_SIZE,
+    };
+    if (shardedoram_init(&shardedoram, &config, max_threads)) {
+        fprintf(stderr, "Failed to initialize sharded ORAM\n");
+        goto exit_close;
+    }
+    for (size_t t = 1; t <= max_threads; t *= 2) {
+        if (bench_shardedoram(&shardedoram, t, &first)) {
+            fprintf(stderr, "Sharded ORAM access failed\n");
+            shardedoram_destroy(&shardedoram);
+            goto exit_close;
+        }
+    }
+    shardedoram_destroy(&shardedoram);
+    ret = 0;
+
+exit_close:
+    /* Close the array even after a failure, so that the output remains valid
+     * JSON. */
+    printf("\n]\n");
+exit:
+    return ret;
+}
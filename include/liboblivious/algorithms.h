@@ -3,15 +3,69 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "liboblivious/internal/defs.h"
 
 LIBOBLIVIOUS_EXTERNC_BEGIN
 
+struct o_swap_pair {
+    size_t a;
+    size_t b;
+};
+
+/* Sorts DATA with Batcher's odd-even merge sort. Arrays of at least 262144
+ * elements of at most 64 bytes are sorted a layer of the network at a time,
+ * which temporarily allocates N / 2 pairs of indices, about 8 bytes per element
+ * on 64-bit platforms. If that allocation fails, the array is sorted with the
+ * recursive network, which needs no extra memory, so o_sort always succeeds. */
 void o_sort(void *data, size_t n, size_t elem_size,
         int (*comparator)(const void *a, const void *b, void *aux), void *aux);
 void o_sort_generate_swaps(size_t n,
         void (*func)(size_t a, size_t b, void *aux), void *aux);
 
+/* Like o_sort, but sorts arrays of up to 16 elements with a hard-coded
+ * size-optimal sorting network and direct swaps. Larger arrays are passed to
+ * o_sort. */
+void o_sort_small(void *data, size_t n, size_t elem_size,
+        int (*comparator)(const void *a, const void *b, void *aux), void *aux);
+
+/* Like o_sort_generate_swaps, but delivers the comparators of a sorting network
+ * one layer at a time as an array of NUM_PAIRS pairs. The pairs within a layer
+ * touch disjoint indices, so they may be executed in any order or in parallel,
+ * but layers must be executed in the order they are delivered. Returns 0 on
+ * success or -1 if scratch space could not be allocated. */
+int o_sort_generate_swap_layers(size_t n,
+        void (*func)(const struct o_swap_pair *pairs, size_t num_pairs,
+            void *aux),
+        void *aux);
+
+/* Sorts N rows stored column-wise. KEYS holds the rows' KEY_SIZE-byte keys,
+ * which are compared by COMPARATOR, and each of the NUM_COLUMNS arrays in
+ * COLUMNS holds COLUMN_SIZES[i] bytes per row. Every conditional swap of two
+ * keys is applied to the same rows of all columns. */
+void o_sort_columns(void *keys, size_t n, size_t key_size,
+        void *const *columns, const size_t *column_sizes, size_t num_columns,
+        int (*comparator)(const void *a, const void *b, void *aux), void *aux);
+
+/* Stably sorts DATA by the keys returned by GET_KEY, which must be less than
+ * DOMAIN. When the key has less than half as many bits as N, or a quarter as
+ * many for elements larger than 128 bytes, this performs a radix sort whose
+ * passes stably partition the data with compaction networks, using
+ * O(N log N log DOMAIN) swaps instead of the O(N log^2 N) of o_sort, which is
+ * faster at those sizes. Otherwise, it falls back to o_sort with ties broken by
+ * the original index. For a 256-value domain and small elements, the radix
+ * sort thus takes over above N = 2^16. Returns 0 on success or -1 if scratch
+ * space could not be allocated. */
+int o_sort_small_domain(void *data, size_t n, size_t elem_size,
+        size_t (*get_key)(const void *elem, void *aux), size_t domain,
+        void *aux);
+
+/* Rearranges DATA such that its first K elements are the K smallest elements
+ * according to COMPARATOR, in sorted order. This uses O(N log^2 K)
+ * comparators, rather than the O(N log^2 N) of a full o_sort. */
+void o_select_topk(void *data, size_t n, size_t elem_size, size_t k,
+        int (*comparator)(const void *a, const void *b, void *aux), void *aux);
+
 void o_compact(void *data, size_t n, size_t elem_size,
         bool (*is_marked)(const void *elem, void *aux), void *aux);
 void o_compact_generate_swaps(size_t n,
@@ -19,6 +73,85 @@ void o_compact_generate_swaps(size_t n,
         void (*swap)(size_t a, size_t b, bool should_swap, void *aux),
         void *aux);
 
+/* Loosely compacts DATA, given that at most K of its N elements are marked by
+ * IS_MARKED, so that every marked element ends up within the first OUT_N
+ * elements of DATA, where OUT_N is at most about 4K and is written to OUT_N.
+ * The order of elements is not preserved, and unmarked elements may be
+ * interleaved among the marked ones. Elements are thrown into random bins using
+ * RAND_FUNC, and each bin is compacted on its own, for O(N log (N / K)) work
+ * instead of O(N log N). If a bin overflows, which happens with probability
+ * below 2^-58 per bin when K is a true bound, this falls back to o_compact, and
+ * only the fact that the fallback was taken is leaked. If more than K elements
+ * are marked, this returns -1 without modifying DATA, which leaks only that the
+ * bound did not hold. Otherwise, returns 0 on success or -1 if scratch space
+ * could not be allocated. */
+int o_compact_loose(void *data, size_t n, size_t elem_size, size_t k,
+        bool (*is_marked)(const void *elem, void *aux), void *aux,
+        size_t *out_n, uint64_t (*rand_func)(void));
+
+/* Sorts DATA by KEY_COMPARATOR and folds each group of elements with equal keys
+ * into a single element using COMBINE, which folds SRC into DEST. COMBINE must
+ * be associative and commutative and must not branch on its inputs. The
+ * aggregated groups are compacted to the front of DATA in key order, and the
+ * number of groups, which is the only quantity leaked, is written to
+ * NUM_GROUPS. Returns 0 on success or -1 if scratch space could not be
+ * allocated. */
+int o_group_aggregate(void *data, size_t n, size_t elem_size,
+        int (*key_comparator)(const void *a, const void *b, void *aux),
+        void (*combine)(void *dest, const void *src, void *aux), void *aux,
+        size_t *num_groups);
+
+/* Counts the N elements of DATA into NUM_BUCKETS buckets, writing the number
+ * of elements for which GET_BUCKET returns each bucket to COUNTS. GET_BUCKET
+ * must return a value less than NUM_BUCKETS. For few buckets, every bucket is
+ * updated for every element; otherwise, the bucket indices are sorted, for
+ * O((N + NUM_BUCKETS) log^2 (N + NUM_BUCKETS)) work. Returns 0 on success or -1
+ * if scratch space could not be allocated. */
+int o_histogram(const void *data, size_t n, size_t elem_size,
+        size_t (*get_bucket)(const void *elem, void *aux), void *aux,
+        size_t num_buckets, size_t *counts);
+
+/* Returns the number of distinct elements of DATA under COMPARATOR. DATA is
+ * sorted in place rather than copied. */
+size_t o_count_distinct(void *data, size_t n, size_t elem_size,
+        int (*comparator)(const void *a, const void *b, void *aux),
+        void *aux);
+
+/* Looks up each of the M keys in QUERY_KEYS in a table of N entries with unique
+ * keys TABLE_KEYS and values TABLE_VALUES of VALUE_SIZE bytes each. For each
+ * query, in order, the matching value is written to VALUES and whether there
+ * was a match is written to FOUND. This takes a single sort of the table and
+ * queries together, for O((N + M) log^2 (N + M)) work in total. Returns 0 on
+ * success or -1 if scratch space could not be allocated. */
+int o_batch_lookup(const uint64_t *table_keys, const void *table_values,
+        size_t n, size_t value_size, const uint64_t *query_keys, size_t m,
+        void *values, bool *found);
+
+/* Joins LEFT, whose keys must be unique, with RIGHT on equal keys, as returned
+ * by GET_KEY with IS_RIGHT set according to the table the element came from.
+ * Each output element is the matching left element immediately followed by the
+ * right element, so OUT must have room for RIGHT_N elements of
+ * LEFT_ELEM_SIZE + RIGHT_ELEM_SIZE bytes. The output is ordered by key, and the
+ * number of output elements, which is the only quantity leaked, is written to
+ * OUT_N. Returns 0 on success or -1 if scratch space could not be allocated. */
+int o_join_pk_fk(const void *left, size_t left_n, size_t left_elem_size,
+        const void *right, size_t right_n, size_t right_elem_size,
+        uint64_t (*get_key)(const void *elem, bool is_right, void *aux),
+        void *aux, void *out, size_t *out_n);
+
+/* Like o_join_pk_fk, but keys need not be unique in either table, and every
+ * pair of left and right elements with equal keys is output. OUT_BOUND is the
+ * declared maximum number of output elements, and all OUT_BOUND rows of OUT are
+ * accessed. The access pattern depends only on LEFT_N, RIGHT_N, and OUT_BOUND,
+ * except that whether the output would exceed OUT_BOUND is leaked by failing.
+ * The number of output elements is written to OUT_N. Returns 0 on success or -1
+ * if scratch space could not be allocated or the output would exceed
+ * OUT_BOUND. */
+int o_join(const void *left, size_t left_n, size_t left_elem_size,
+        const void *right, size_t right_n, size_t right_elem_size,
+        uint64_t (*get_key)(const void *elem, bool is_right, void *aux),
+        void *aux, void *out, size_t out_bound, size_t *out_n);
+
 LIBOBLIVIOUS_EXTERNC_END
 
 #endif /* liboblivious/algorithms.h */
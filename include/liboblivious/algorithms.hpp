@@ -0,0 +1,156 @@
+#ifndef LIBOBLIVIOUS_ALGORITHMS_HPP
+#define LIBOBLIVIOUS_ALGORITHMS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include "liboblivious/primitives.h"
+
+namespace liboblivious {
+
+namespace internal {
+
+/* The widest word that evenly divides an object of SIZE bytes, which is what
+ * conditional swaps of the object are done in. */
+template <std::size_t Size>
+struct swap_word {
+    typedef typename std::conditional<Size % sizeof(std::uint64_t) == 0,
+            std::uint64_t,
+            typename std::conditional<Size % sizeof(std::uint32_t) == 0,
+                std::uint32_t,
+                typename std::conditional<Size % sizeof(std::uint16_t) == 0,
+                    std::uint16_t,
+                    unsigned char>::type>::type>::type type;
+};
+
+inline void swap_words(std::uint64_t *a, std::uint64_t *b, bool cond) {
+    o_swap64(a, b, cond);
+}
+
+inline void swap_words(std::uint32_t *a, std::uint32_t *b, bool cond) {
+    o_swap32(a, b, cond);
+}
+
+inline void swap_words(std::uint16_t *a, std::uint16_t *b, bool cond) {
+    o_swap16(a, b, cond);
+}
+
+inline void swap_words(unsigned char *a, unsigned char *b, bool cond) {
+    o_swapc(a, b, cond);
+}
+
+/* Swaps A and B iff COND, a word at a time. The word size and count are fixed
+ * by sizeof(T), so the loop is fully unrolled for small types. */
+template <typename T>
+inline void cond_swap(T &a, T &b, bool cond) {
+    typedef typename swap_word<sizeof(T)>::type word_t;
+    unsigned char *a_bytes = reinterpret_cast<unsigned char *>(&a);
+    unsigned char *b_bytes = reinterpret_cast<unsigned char *>(&b);
+    for (std::size_t i = 0; i < sizeof(T) / sizeof(word_t); i++) {
+        word_t a_word;
+        word_t b_word;
+        std::memcpy(&a_word, a_bytes + i * sizeof(word_t), sizeof(word_t));
+        std::memcpy(&b_word, b_bytes + i * sizeof(word_t), sizeof(word_t));
+        swap_words(&a_word, &b_word, cond);
+        std::memcpy(a_bytes + i * sizeof(word_t), &a_word, sizeof(word_t));
+        std::memcpy(b_bytes + i * sizeof(word_t), &b_word, sizeof(word_t));
+    }
+}
+
+/* The recursive odd-even merge sort from algorithms.c, instantiated for a
+ * concrete T and COMPARE so that both the comparison and the swap inline. */
+template <typename T, typename Compare>
+class sorter {
+public:
+    sorter(T *data, Compare comp) : data(data), comp(comp) {}
+
+    void sort_slice(std::size_t start, std::size_t n, std::size_t skip) {
+        switch (n) {
+            case 0:
+            case 1:
+                /* Do nothing. */
+                break;
+            case 2:
+                compare_swap(start, start + skip);
+                break;
+            default: {
+                /* Sort left and right halves. Sorting doesn't care if it's
+                 * right-heavy. */
+                std::size_t left_length = (n + 1) / 2;
+                std::size_t right_length = n / 2;
+                sort_slice(start, left_length, skip);
+                sort_slice(start + skip * left_length, right_length, skip);
+
+                /* Odd-even merge. */
+                merge_slice(start, n, skip, false);
+                break;
+            }
+        }
+    }
+
+private:
+    T *data;
+    Compare comp;
+
+    void compare_swap(std::size_t a, std::size_t b) {
+        cond_swap(data[a], data[b], comp(data[b], data[a]));
+    }
+
+    void merge_slice(std::size_t start, std::size_t n, std::size_t skip,
+            bool right_heavy) {
+        switch (n) {
+            case 0:
+            case 1:
+                /* Do nothing. */
+                break;
+            case 2:
+                compare_swap(start, start + skip);
+                break;
+            default: {
+                /* See merge_slice in algorithms.c for how right-heaviness is
+                 * propagated to the even and odd slices. */
+                std::size_t even_length = (n + 1) / 2;
+                bool even_right_heavy = even_length % 2 == 1 && right_heavy;
+                merge_slice(start, even_length, skip * 2, even_right_heavy);
+                std::size_t odd_length = n / 2;
+                bool odd_right_heavy = odd_length % 2 == 1
+                    && (right_heavy || n % 2 == 0);
+                merge_slice(start + skip, odd_length, skip * 2,
+                        odd_right_heavy);
+
+                for (std::size_t i =
+                            1 - (n / 2 + (n % 2 == 1 && !right_heavy)) % 2;
+                        i < n - 1; i += 2) {
+                    compare_swap(start + skip * i, start + skip * (i + 1));
+                }
+                break;
+            }
+        }
+    }
+};
+
+} /* namespace internal */
+
+/* Sorts the N elements of DATA in ascending order under COMP, which returns
+ * whether its first argument orders strictly before its second, like
+ * std::sort. COMP must not branch on its arguments. T must be trivially
+ * copyable, since elements are swapped as raw words. Like o_sort, this runs
+ * Batcher's odd-even merge sort, but with the comparator and the conditional
+ * swap for sizeof(T) inlined. */
+template <typename T, typename Compare>
+inline void o_sort(T *data, std::size_t n, Compare comp) {
+    static_assert(std::is_trivially_copyable<T>::value,
+            "T must be trivially copyable");
+    internal::sorter<T, Compare>(data, comp).sort_slice(0, n, 1);
+}
+
+template <typename T>
+inline void o_sort(T *data, std::size_t n) {
+    o_sort(data, n, std::less<T>());
+}
+
+} /* namespace liboblivious */
+
+#endif /* liboblivious/algorithms.hpp */
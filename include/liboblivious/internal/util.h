@@ -4,6 +4,8 @@
 #include <limits.h>
 
 #define CEIL_DIV(a, b) (((a) + (b) - 1) / (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 static inline long ilog2(unsigned int x) {
 #ifdef __GNUC__
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include "liboblivious/internal/defs.h"
 #include "liboblivious/oram.h"
+#include "liboblivious/oramallocator.h"
 
 #define OPAGEDMEM_ORAM_BLOCKS_PER_BUCKET 4
 #define OPAGEDMEM_ORAM_STASH_SIZE 160
@@ -39,14 +40,25 @@ struct opagedmem_table {
 
 typedef struct opagedmem {
     oram_t oram;
+    struct oram_allocator *allocator;
     struct opagedmem_entry *first_level;
     struct opagedmem_table *buffer;
     void *data_buffer;
 } opagedmem_t;
 
 int opagedmem_init(opagedmem_t *opagedmem, size_t num_bytes);
+/* Initializes the paged memory with its ORAM and page tables allocated from
+ * ALLOCATOR, which must outlive it. */
+int opagedmem_init_allocator(opagedmem_t *opagedmem, size_t num_bytes,
+        struct oram_allocator *allocator);
 void opagedmem_destroy(opagedmem_t *opagedmem);
 
+/* Saves a snapshot of the paged memory to the file at PATH, or loads one into
+ * an uninitialized paged memory, as with oram_save and oram_load with no
+ * storage, so that the loaded ORAM's tree is mapped into memory. */
+int opagedmem_save(opagedmem_t *opagedmem, const char *path);
+int opagedmem_load(opagedmem_t *opagedmem, const char *path);
+
 /* Performs an oblivious access within a single page of the oblivious paged
  * memory. Accesses that span multiple pages are rejected non-obliviously. */
 int opagedmem_pageaccess(opagedmem_t *opagedmem, uint64_t addr, void *data,
@@ -4,40 +4,277 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "liboblivious/oramallocator.h"
+#include "liboblivious/oramstorage.h"
 #include "liboblivious/internal/defs.h"
 
 LIBOBLIVIOUS_EXTERNC_BEGIN
 
-struct oram_block {
-    bool valid;                 /* Whether this is a valid block. */
+enum oram_type {
+    /* Path ORAM. Each access reads a path into the stash and evicts it back.
+     * Blocks are assigned to buckets with a scan of the metadata, two
+     * compactions of the stash move the assigned blocks to the end and the
+     * remaining valid blocks to the front, and only the blocks to write back
+     * are sorted by bucket. The stash size must include room for
+     * 2 * depth * blocks_per_bucket + 1 transient blocks on top of the
+     * persistent stash. */
+    ORAM_TYPE_PATH,
+    /* Circuit ORAM. Each access removes the block from its path and then
+     * evicts along two paths in reverse-lexicographic order, moving at most
+     * one held block per level, for O(log N) block moves per access. The stash
+     * size is only the persistent stash, which may be much smaller than for
+     * Path ORAM. */
+    ORAM_TYPE_CIRCUIT,
+    /* Ring ORAM. Each bucket additionally holds dummies_per_bucket dummy slots
+     * in a random order, and each access reads only one block per bucket.
+     * Paths are evicted every evict_rate accesses in reverse-lexicographic
+     * order, and buckets are reshuffled early once all of their dummies have
+     * been read. The stash size must include room for
+     * depth * (2 * blocks_per_bucket + dummies_per_bucket) + evict_rate
+     * transient blocks on top of the persistent stash. */
+    ORAM_TYPE_RING,
+};
+
+struct oram_config {
+    enum oram_type type;
+    size_t block_size;
+    size_t blocks_per_bucket;
+    size_t num_blocks;
+    size_t stash_size;
+
+    /* Ring ORAM. */
+    size_t dummies_per_bucket;
+    size_t evict_rate;
+
+    /* Position map. If set, the ORAM keeps the leaf of every block ID in
+     * [0, num_blocks) so that blocks can be accessed with oram_read and
+     * oram_write. Maps for up to posmap_cutoff blocks are scanned linearly on
+     * the client side, and larger maps are stored recursively in an ORAM of
+     * the same type with blocks of posmap_block_size bytes. Zero values select
+     * ORAM_POSMAP_BLOCK_SIZE and ORAM_POSMAP_CUTOFF. */
+    bool position_map;
+    size_t posmap_block_size;
+    size_t posmap_cutoff;
+
+    /* Bucket storage. If NULL, the buckets are kept in memory. Otherwise, the
+     * storage must outlive the ORAM and is not destroyed by oram_destroy. The
+     * recursive position map, if any, is always kept in memory. */
+    struct oram_storage *storage;
+
+    /* Bucket layout. The top treetop_levels levels of the tree are kept in a
+     * separate array in memory, even if a storage is given, since every path
+     * crosses them. The levels below are stored in subtrees of subtree_levels
+     * levels each, so that a path crosses depth / subtree_levels contiguous
+     * subtrees rather than depth scattered buckets. A subtree_levels of 0 or
+     * 1 stores the buckets in heap order. */
+    size_t subtree_levels;
+    size_t treetop_levels;
+
+    /* Allocator for all of the ORAM's arrays: the in-memory tree, the
+     * treetop, the stash, the path buffer, the Ring ORAM bucket metadata, and
+     * the position map. It must outlive the ORAM. If NULL, these are allocated
+     * from the heap. */
+    struct oram_allocator *allocator;
+};
+
+#define ORAM_POSMAP_BLOCK_SIZE 256
+#define ORAM_POSMAP_CUTOFF 4096
+
+/* The maximum depth of the tree, so that leaf indices plus one fit in
+ * oram_block_meta.leaf_idx_plus_one. Configurations needing a deeper tree are
+ * rejected. */
+#define ORAM_MAX_DEPTH 31
+
+/* Block metadata is stored separately from the block data, in parallel arrays,
+ * so that scans over the metadata don't pull the data through the cache. */
+struct oram_block_meta {
     uint64_t id;                /* The block ID. */
-    uint64_t leaf_idx_plus_one; /* The block's leaf's index, plus one. */
-    unsigned char data[1];      /* The data in the block. */
+    uint32_t leaf_idx_plus_one; /* The block's leaf's index, plus one. */
+    bool valid;                 /* Whether this is a valid block. */
 };
 
-struct oram_stash_block {
+struct oram_stash_meta {
     uint64_t bucket_idx_plus_one;   /* Temporary - The index of the bucket to
                                        evict this block to, plus one. */
-    struct oram_block block;
+    struct oram_block_meta block;
+};
+
+/* Phases of an access, for statistics. */
+enum oram_phase {
+    /* Reading buckets from the treetop or the storage. */
+    ORAM_PHASE_READ,
+    /* Scanning the stash, or for Circuit ORAM the path, for the accessed block
+     * and inserting new blocks. */
+    ORAM_PHASE_SCAN,
+    /* Assigning blocks to the deepest possible bucket for Path and Ring ORAM,
+     * or preparing and performing an eviction for Circuit ORAM. */
+    ORAM_PHASE_EVICT,
+    /* Compacting and sorting the stash, and shuffling Ring ORAM buckets. */
+    ORAM_PHASE_SORT,
+    /* Writing buckets to the treetop or the storage. */
+    ORAM_PHASE_WRITE,
+    ORAM_NUM_PHASES,
+};
+
+#define ORAM_STASH_HISTOGRAM_SIZE 64
+
+/* Statistics, which are only collected if the library is built with
+ * LIBOBLIVIOUS_ORAM_STATS defined. These depend on the blocks accessed and must
+ * not be revealed where that would break obliviousness. */
+struct oram_stats {
+    uint64_t accesses;          /* The number of accesses, including dummy
+                                   accesses and the requests of batches. */
+    uint64_t failed_accesses;   /* The number of accesses that failed, such as
+                                   from a stash overflow. */
+    uint64_t cycles[ORAM_NUM_PHASES];   /* The time spent in each phase, in time
+                                           stamp counter ticks on x86-64 or
+                                           else in nanoseconds. */
+    uint64_t stash_histogram[ORAM_STASH_HISTOGRAM_SIZE];
+                                /* The number of accesses or batches after
+                                   which the stash held each number of valid
+                                   blocks, with the last entry counting all
+                                   larger numbers. */
+    size_t stash_high_water;    /* The most valid blocks the stash has held
+                                   after an access or batch. */
+};
+
+struct oram_ring_bucket {
+    uint32_t count;         /* The number of reads since the last reshuffle. */
+    uint32_t next_dummy;    /* The index of the next dummy slot to read. */
 };
 
 typedef struct oram {
+    enum oram_type type;
     size_t block_size;
     size_t blocks_per_bucket;
+    size_t slots_per_bucket;
     size_t depth;
     size_t stash_size;
-    struct oram_block *buckets;
-    struct oram_stash_block *stash;
+    struct oram_allocator *allocator;
+    struct oram_storage *storage;
+    struct oram_memory_storage memory_storage;
+    bool storage_error;         /* Set once a storage read or write has failed,
+                                   after which accesses fail. */
+    size_t subtree_levels;
+    size_t treetop_levels;
+    unsigned char *treetop;     /* The buckets in the top treetop_levels levels,
+                                   in heap order. */
+    struct oram_stash_meta *stash_metas;
+    unsigned char *stash_data;
+
+    /* Circuit and Ring ORAM. */
+    uint64_t evict_counter;     /* The number of evictions performed. */
+    struct oram_block_meta *path_metas;
+    unsigned char *path_data;   /* Circuit ORAM: The path buffer, followed by
+                                   the held and to-write blocks. Ring ORAM:
+                                   A bucket being reshuffled. */
+
+    /* Ring ORAM. */
+    size_t dummies_per_bucket;
+    size_t evict_rate;
+    size_t round;               /* The number of accesses since the last
+                                   eviction. */
+    struct oram_ring_bucket *ring_buckets;
+    uint32_t *ring_slot_idxs;   /* The logical index of each slot in the tree,
+                                   where indices of at least blocks_per_bucket
+                                   are dummy slots. */
+
+    /* Position map. */
+    size_t num_blocks;
+    size_t posmap_entries_per_block;
+    struct oram *posmap;        /* The recursive position map, if any. */
+    uint32_t *posmap_leaves;    /* The client-side position map, if any. Each
+                                   entry is the block's leaf ID plus one, or 0
+                                   if the block has never been written. */
+
+    struct oram_stats stats;
 } oram_t;
 
+/* Initializes a Path ORAM. This is equivalent to oram_init_config with a type
+ * of ORAM_TYPE_PATH. */
 int oram_init(oram_t *oram, size_t block_size, size_t blocks_per_bucket,
         size_t num_blocks, size_t stash_size);
+int oram_init_config(oram_t *oram, const struct oram_config *config);
 void oram_destroy(oram_t *oram);
 
+/* Initializes an ORAM as with oram_init_config, holding the CONFIG->num_blocks
+ * blocks of data in BLOCKS as blocks 0 through num_blocks - 1. Every block
+ * gets a random leaf, and the blocks are placed into the tree with oblivious
+ * sorts and scans in O(N log^2 N) time rather than with N accesses, using
+ * scratch space for about as many blocks as the tree has slots. If LEAF_IDS is
+ * not NULL, the leaf of each block is written to it, for use with oram_access.
+ * If CONFIG->position_map is set, the position map is filled in as well, so
+ * that the blocks can be read with oram_read. Fails if the blocks that don't
+ * fit in the tree overflow the stash. */
+int oram_init_from_blocks(oram_t *oram, const struct oram_config *config,
+        const void *blocks, uint64_t *leaf_ids, uint64_t (*rand_func)(void));
+
+/* Reads or writes the block with BLOCK_ID, which is on LEAF_ID, through DATA,
+ * and writes the leaf the block was moved to to NEW_LEAF_ID. If the access
+ * fails, for example because the stash would overflow, NEW_LEAF_ID is left
+ * unchanged, and the block can still be accessed on LEAF_ID. */
 int oram_access(oram_t *oram, uint64_t block_id, uint64_t leaf_id, void *data,
         bool write, uint64_t *new_leaf_id, bool is_real_access,
         uint64_t (*rand_func)(void));
 
+/* Performs NUM_REQUESTS accesses as with oram_access, where DATA holds
+ * NUM_REQUESTS blocks of data and the other arrays hold one entry per request.
+ * Requests for the same block ID are applied in order. They must all give the
+ * block's leaf before the batch in LEAF_IDS, and they are all given the leaf
+ * the block ends up on in NEW_LEAF_IDS. If any real request has an invalid leaf
+ * ID, nothing is accessed or output. For Path ORAM, the union of the paths is
+ * read once, all requests are served in a single scan of the stash, and the
+ * union is evicted at once, so the stash must have room for
+ * 2 * U * blocks_per_bucket + NUM_REQUESTS transient blocks, where U is at most
+ * NUM_REQUESTS * depth buckets. NUM_REQUESTS should be fixed by the caller,
+ * independently of the data. */
+int oram_access_batch(oram_t *oram, size_t num_requests,
+        const uint64_t *block_ids, const uint64_t *leaf_ids, void *data,
+        const bool *writes, uint64_t *new_leaf_ids,
+        const bool *is_real_accesses, uint64_t (*rand_func)(void));
+
+/* Reads or writes the block with BLOCK_ID using the ORAM's position map, which
+ * must have been enabled with position_map in the config. Reading a block that
+ * has never been written yields zeroes. If the access fails, the block's entry
+ * in the position map is restored, so the block can still be accessed. */
+int oram_read(oram_t *oram, uint64_t block_id, void *data, bool is_real_access,
+        uint64_t (*rand_func)(void));
+int oram_write(oram_t *oram, uint64_t block_id, const void *data,
+        bool is_real_access, uint64_t (*rand_func)(void));
+
+#define ORAM_SNAPSHOT_VERSION 1
+#define ORAM_SNAPSHOT_ALIGNMENT 4096
+
+/* Saves a snapshot of the ORAM, including its recursive position map, to the
+ * file at PATH, or loads one into an uninitialized ORAM, which must then be
+ * destroyed with oram_destroy as usual. The format is versioned and stores the
+ * tree in its storage layout at an aligned offset. Snapshots are only portable
+ * between builds with the same byte order and struct layouts. A load fails,
+ * leaving the ORAM uninitialized, if the header has unknown parameters or
+ * sections that do not lie within the file where a save would put them.
+ *
+ * The storage and allocator of the saved ORAM are not part of the snapshot and
+ * are dropped on load. If STORAGE is not NULL, the loaded ORAM uses it as if it
+ * had been given in the config: it is allocated for the tree, the tree is
+ * copied into it, and it must outlive the ORAM. Otherwise, the tree is mapped
+ * copy-on-write rather than read, so writes to it never reach the file and its
+ * dirty pages are held in memory, up to the whole tree. Recursive position
+ * maps are always loaded into memory, as they are always kept there. */
+int oram_save(oram_t *oram, const char *path);
+int oram_load(oram_t *oram, const char *path, struct oram_storage *storage);
+
+/* Saves or loads a snapshot at OFFSET in the open file FD, which should be a
+ * multiple of ORAM_SNAPSHOT_ALIGNMENT for the tree to be mapped. oram_save_fd
+ * sets SIZE to the size of the snapshot. */
+int oram_save_fd(oram_t *oram, int fd, uint64_t offset, uint64_t *size);
+int oram_load_fd(oram_t *oram, int fd, uint64_t offset,
+        struct oram_storage *storage);
+
+/* Copies the statistics of the ORAM, not including its recursive position map,
+ * to STATS. Returns -1 if the library was built without
+ * LIBOBLIVIOUS_ORAM_STATS. */
+int oram_get_stats(const oram_t *oram, struct oram_stats *stats);
+
 LIBOBLIVIOUS_EXTERNC_END
 
 #endif /* liboblivious/oram.h */
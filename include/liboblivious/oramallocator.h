@@ -0,0 +1,50 @@
+#ifndef LIBOBLIVIOUS_ORAMALLOCATOR_H
+#define LIBOBLIVIOUS_ORAMALLOCATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "liboblivious/internal/defs.h"
+
+LIBOBLIVIOUS_EXTERNC_BEGIN
+
+#define ORAM_CACHE_LINE_SIZE 64
+
+/* Allocator for the arrays of an ORAM, such as the in-memory tree, the
+ * treetop, and the stash. Implementations embed this struct as their first
+ * member. */
+struct oram_allocator {
+    /* Returns SIZE zeroed bytes aligned to ORAM_CACHE_LINE_SIZE, or NULL. */
+    void *(*allocate)(struct oram_allocator *allocator, size_t size);
+    /* Frees PTR, which was returned by allocate with SIZE. */
+    void (*free)(struct oram_allocator *allocator, void *ptr, size_t size);
+};
+
+/* Allocates or frees with ALLOCATOR, or with the default allocator if
+ * ALLOCATOR is NULL. The default allocator maps large allocations directly, so
+ * that their zeroed pages are only faulted in as they are first accessed, and
+ * takes small ones from the heap, aligned to a cache line. */
+void *oram_allocate(struct oram_allocator *allocator, size_t size);
+void oram_free(struct oram_allocator *allocator, void *ptr, size_t size);
+
+#define ORAM_HUGEPAGE_2MB ((size_t) 1 << 21)
+#define ORAM_HUGEPAGE_1GB ((size_t) 1 << 30)
+
+/* Allocator that maps each allocation with huge pages of PAGE_SIZE, which
+ * should be ORAM_HUGEPAGE_2MB or ORAM_HUGEPAGE_1GB, to cut TLB misses on large
+ * trees. If no huge pages of that size are reserved, the allocation falls back
+ * to a PAGE_SIZE-aligned mapping advised for transparent huge pages. If
+ * PREFAULT is set, every page is faulted in at allocation time rather than on
+ * first access. Each allocation is rounded up to a whole huge page, so this
+ * should only be used for large ORAMs. */
+struct oram_hugepage_allocator {
+    struct oram_allocator base;
+    size_t page_size;
+    bool prefault;
+};
+
+void oram_hugepage_allocator_init(struct oram_hugepage_allocator *allocator,
+        size_t page_size, bool prefault);
+
+LIBOBLIVIOUS_EXTERNC_END
+
+#endif /* liboblivious/oramallocator.h */
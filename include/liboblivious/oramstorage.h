@@ -0,0 +1,92 @@
+#ifndef LIBOBLIVIOUS_ORAMSTORAGE_H
+#define LIBOBLIVIOUS_ORAMSTORAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "liboblivious/oramallocator.h"
+#include "liboblivious/internal/defs.h"
+
+LIBOBLIVIOUS_EXTERNC_BEGIN
+
+/* A buffer to read into or write from, as part of a vectored transfer. The
+ * buffer is only read from for writes. */
+struct oram_storage_segment {
+    void *buf;
+    size_t size;
+};
+
+/* Untrusted storage for the buckets of an ORAM tree, as a range of bytes. Each
+ * bucket is a contiguous range holding the metadata of its slots followed by
+ * their data, and the ORAM reads and writes each whole bucket it accesses with
+ * a single vectored transfer. Ring ORAM additionally reads and writes single
+ * slots. The addresses accessed are thus exactly those of the ORAM's access
+ * pattern, although the buckets of a path are separate transfers, since they
+ * are not contiguous. Snapshots read or write the whole range in chunks.
+ * Implementations embed this struct as their first member. */
+struct oram_storage {
+    /* Allocates SIZE zeroed bytes of storage. This is called once by
+     * oram_init_config. */
+    int (*allocate)(struct oram_storage *storage, uint64_t size);
+    /* Reads or writes SIZE bytes at OFFSET. */
+    int (*read)(struct oram_storage *storage, uint64_t offset, void *buf,
+            size_t size);
+    int (*write)(struct oram_storage *storage, uint64_t offset,
+            const void *buf, size_t size);
+    /* Reads or writes the contiguous bytes at OFFSET to or from the
+     * NUM_SEGMENTS buffers in SEGMENTS, in order, as a single transfer, like
+     * preadv and pwritev. These may be NULL, in which case each segment is
+     * transferred with read or write. */
+    int (*readv)(struct oram_storage *storage, uint64_t offset,
+            const struct oram_storage_segment *segments, size_t num_segments);
+    int (*writev)(struct oram_storage *storage, uint64_t offset,
+            const struct oram_storage_segment *segments, size_t num_segments);
+};
+
+/* Performs a vectored transfer with STORAGE, falling back to one read or write
+ * per segment if the storage does not implement readv or writev. */
+int oram_storage_readv(struct oram_storage *storage, uint64_t offset,
+        const struct oram_storage_segment *segments, size_t num_segments);
+int oram_storage_writev(struct oram_storage *storage, uint64_t offset,
+        const struct oram_storage_segment *segments, size_t num_segments);
+
+/* Storage in memory allocated with ALLOCATOR, or with the default allocator if
+ * ALLOCATOR is NULL. This is the default for ORAMs that are not given a
+ * storage. */
+struct oram_memory_storage {
+    struct oram_storage base;
+    struct oram_allocator *allocator;
+    unsigned char *data;
+    size_t size;
+    bool mapped;    /* Whether data is a private mapping of a file. */
+};
+
+void oram_memory_storage_init(struct oram_memory_storage *storage,
+        struct oram_allocator *allocator);
+/* Fills the storage with SIZE bytes at OFFSET in the open file FD in place of
+ * allocate. The bytes are mapped copy-on-write if OFFSET is page-aligned, so
+ * that they are only read from the file as they are accessed and writes don't
+ * reach the file, and are otherwise read into an allocation. */
+int oram_memory_storage_load(struct oram_memory_storage *storage, int fd,
+        uint64_t offset, uint64_t size);
+void oram_memory_storage_destroy(struct oram_memory_storage *storage);
+
+/* Storage in a file accessed with pread and pwrite, so that only the stash and
+ * the buffers for a path need to be in memory. The file at PATH is created if
+ * it does not exist and is truncated to the size of the tree. */
+struct oram_file_storage {
+    struct oram_storage base;
+    int fd;
+    bool owns_fd;
+};
+
+int oram_file_storage_init(struct oram_file_storage *storage,
+        const char *path);
+/* Initializes the storage on the open file FD, which is not closed by
+ * oram_file_storage_destroy and may be used without calling allocate. */
+void oram_file_storage_init_fd(struct oram_file_storage *storage, int fd);
+void oram_file_storage_destroy(struct oram_file_storage *storage);
+
+LIBOBLIVIOUS_EXTERNC_END
+
+#endif /* liboblivious/oramstorage.h */
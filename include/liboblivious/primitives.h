@@ -256,8 +256,8 @@ static inline void o_accessc(unsigned char *LIBOBLIVIOUS_RESTRICT readp,
 
 #ifdef LIBOBLIVIOUS_CMOV
 #define LIBOBLIVIOUS_DEF_ACCESS_T(NAME, T) \
-    static inline void NAME(T *restrict readp, T *restrict writep, bool write,\
-            bool cond) {\
+    static inline void NAME(T *LIBOBLIVIOUS_RESTRICT readp,\
+            T *LIBOBLIVIOUS_RESTRICT writep, bool write, bool cond) {\
         if (__builtin_constant_p(cond) && __builtin_constant_p(write)) {\
             if (cond) {\
                 if (write) {\
@@ -0,0 +1,73 @@
+#ifndef LIBOBLIVIOUS_SHARDEDORAM_H
+#define LIBOBLIVIOUS_SHARDEDORAM_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "liboblivious/internal/defs.h"
+#include "liboblivious/oram.h"
+
+LIBOBLIVIOUS_EXTERNC_BEGIN
+
+struct shardedoram_request;
+
+struct shardedoram_shard {
+    oram_t oram;
+    /* Scratch space for the shard's dummy accesses. */
+    unsigned char *dummy_data;
+};
+
+/* An ORAM partitioned into shards of num_blocks / num_shards blocks, each with
+ * its own tree, stash, and position map. Block IDs are assigned to shards
+ * round-robin.
+ *
+ * Accesses are served in rounds. Concurrent accesses join the same round, up
+ * to one per shard, and each round performs exactly one access on every shard:
+ * a real access for each shard with a request, and a dummy access on the
+ * rest. The threads of a round divide its shard accesses among themselves, so
+ * with T concurrent threads a round costs num_shards / T accesses per thread,
+ * and throughput rises with the thread count up to num_shards. The accesses
+ * made by a round reveal nothing about its block IDs, but an access whose
+ * shard already has a request in the current round waits for the next round,
+ * so the latency of concurrent accesses to the same shard is not hidden. */
+typedef struct shardedoram {
+    size_t num_shards;
+    size_t block_size;
+    size_t num_blocks;
+    struct shardedoram_shard *shards;
+
+    /* The round state, protected by lock. REQUESTS holds the request on each
+     * shard in the current round, or NULL. The round is started once every
+     * active thread has joined it or is waiting for its shard to be freed, and
+     * NEXT_SHARD and NUM_ACCESSED then track its shard accesses. */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct shardedoram_request **requests;
+    size_t num_requests;
+    size_t num_active;
+    size_t num_collided;
+    bool running;
+    size_t next_shard;
+    size_t num_accessed;
+    int round_ret;
+} shardedoram_t;
+
+/* Initializes a sharded ORAM with NUM_SHARDS shards. Each shard is initialized
+ * from CONFIG with num_blocks divided among the shards and its position map
+ * enabled. Shards can't share a storage, so CONFIG must not set one. */
+int shardedoram_init(shardedoram_t *shardedoram,
+        const struct oram_config *config, size_t num_shards);
+void shardedoram_destroy(shardedoram_t *shardedoram);
+
+/* Reads or writes the block with BLOCK_ID, as with oram_read and oram_write.
+ * These may be called concurrently from multiple threads, but RAND_FUNC must be
+ * thread-safe. */
+int shardedoram_read(shardedoram_t *shardedoram, uint64_t block_id, void *data,
+        bool is_real_access, uint64_t (*rand_func)(void));
+int shardedoram_write(shardedoram_t *shardedoram, uint64_t block_id,
+        const void *data, bool is_real_access, uint64_t (*rand_func)(void));
+
+LIBOBLIVIOUS_EXTERNC_END
+
+#endif /* liboblivious/shardedoram.h */
@@ -1,18 +1,29 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "liboblivious/opagedmem.h"
 #include <assert.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "liboblivious/internal/util.h"
 #include "liboblivious/oram.h"
+#include "liboblivious/oramallocator.h"
+#include "liboblivious/oramstorage.h"
 #include "liboblivious/primitives.h"
 
 static_assert((1 << OPAGEDMEM_OFFSET_BITS) == (1 << OPAGEDMEM_MID_BITS) * sizeof(struct opagedmem_entry),
         "1 << OPAGEDMEM_OFFSET_BITS must be equal to (1 << OPAGEDMEM_MID_BITS) * sizeof(struct opagedmem_entry)");
 
 int opagedmem_init(opagedmem_t *opagedmem, size_t num_bytes) {
+    return opagedmem_init_allocator(opagedmem, num_bytes, NULL);
+}
+
+int opagedmem_init_allocator(opagedmem_t *opagedmem, size_t num_bytes,
+        struct oram_allocator *allocator) {
     size_t num_blocks = (num_bytes + OPAGEDMEM_PAGE_SIZE - 1)
         / OPAGEDMEM_PAGE_SIZE;
 
@@ -28,15 +39,22 @@ int opagedmem_init(opagedmem_t *opagedmem, size_t num_bytes) {
         OPAGEDMEM_ORAM_STASH_SIZE
             + oram_stash_size * OPAGEDMEM_ORAM_BLOCKS_PER_BUCKET;
 
-    if (oram_init(&opagedmem->oram, OPAGEDMEM_PAGE_SIZE,
-                OPAGEDMEM_ORAM_BLOCKS_PER_BUCKET, num_blocks,
-                oram_stash_size)) {
+    struct oram_config config = {
+        .type = ORAM_TYPE_PATH,
+        .block_size = OPAGEDMEM_PAGE_SIZE,
+        .blocks_per_bucket = OPAGEDMEM_ORAM_BLOCKS_PER_BUCKET,
+        .num_blocks = num_blocks,
+        .stash_size = oram_stash_size,
+        .allocator = allocator,
+    };
+    opagedmem->allocator = allocator;
+    if (oram_init_config(&opagedmem->oram, &config)) {
         /* Obliviousness violation - ORAM init failed. */
         goto exit;
     }
 
-    opagedmem->first_level =
-        calloc(OPAGEDMEM_FIRST_SIZE, sizeof(struct opagedmem_entry));
+    opagedmem->first_level = oram_allocate(allocator,
+            OPAGEDMEM_FIRST_SIZE * sizeof(struct opagedmem_entry));
     if (!opagedmem->first_level) {
         /* Obliviousness violation - out of memory. */
         goto exit_destroy_oram;
@@ -44,7 +62,8 @@ int opagedmem_init(opagedmem_t *opagedmem, size_t num_bytes) {
 
     /* This can technically be a malloc, but Valgrind complains about
      * uninitialized memory. */
-    opagedmem->buffer = calloc(OPAGEDMEM_MID_COUNT, OPAGEDMEM_PAGE_SIZE);
+    opagedmem->buffer =
+        oram_allocate(allocator, OPAGEDMEM_MID_COUNT * OPAGEDMEM_PAGE_SIZE);
     if (!opagedmem->buffer) {
         /* Obliviousness violation - out of memory. */
         goto exit_free_first_level;
@@ -52,7 +71,7 @@ int opagedmem_init(opagedmem_t *opagedmem, size_t num_bytes) {
 
     /* This can technically be a calloc, but Valgrind complains about
      * uninitialized memory. */
-    opagedmem->data_buffer = calloc(1, OPAGEDMEM_PAGE_SIZE);
+    opagedmem->data_buffer = oram_allocate(allocator, OPAGEDMEM_PAGE_SIZE);
     if (!opagedmem->data_buffer) {
         /* Obliviousness violation - out of memory. */
         goto exit_free_buffer;
@@ -61,9 +80,11 @@ int opagedmem_init(opagedmem_t *opagedmem, size_t num_bytes) {
     return 0;
 
 exit_free_buffer:
-    free(opagedmem->buffer);
+    oram_free(allocator, opagedmem->buffer,
+            OPAGEDMEM_MID_COUNT * OPAGEDMEM_PAGE_SIZE);
 exit_free_first_level:
-    free(opagedmem->first_level);
+    oram_free(allocator, opagedmem->first_level,
+            OPAGEDMEM_FIRST_SIZE * sizeof(struct opagedmem_entry));
 exit_destroy_oram:
     oram_destroy(&opagedmem->oram);
 exit:
@@ -72,9 +93,12 @@ exit:
 
 void opagedmem_destroy(opagedmem_t *opagedmem) {
     oram_destroy(&opagedmem->oram);
-    free(opagedmem->first_level);
-    free(opagedmem->buffer);
-    free(opagedmem->data_buffer);
+    oram_free(opagedmem->allocator, opagedmem->first_level,
+            OPAGEDMEM_FIRST_SIZE * sizeof(struct opagedmem_entry));
+    oram_free(opagedmem->allocator, opagedmem->buffer,
+            OPAGEDMEM_MID_COUNT * OPAGEDMEM_PAGE_SIZE);
+    oram_free(opagedmem->allocator, opagedmem->data_buffer,
+            OPAGEDMEM_PAGE_SIZE);
 }
 
 static uint64_t get_addr_block_id(uint64_t addr, int level) {
@@ -274,3 +298,125 @@ int opagedmem_access(opagedmem_t *opagedmem, uint64_t addr, void *data_,
 exit:
     return ret;
 }
+
+/* Snapshots. A snapshot is a header, the first-level page table, and the ORAM
+ * snapshot, each at an offset that is a multiple of ORAM_SNAPSHOT_ALIGNMENT.
+ * The remaining page tables are stored in the ORAM. */
+
+#define SNAPSHOT_MAGIC "LOBPMEM"
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_FIRST_LEVEL_OFFSET ORAM_SNAPSHOT_ALIGNMENT
+#define SNAPSHOT_ORAM_OFFSET \
+    (SNAPSHOT_FIRST_LEVEL_OFFSET \
+        + CEIL_DIV(OPAGEDMEM_FIRST_SIZE * sizeof(struct opagedmem_entry), \
+            ORAM_SNAPSHOT_ALIGNMENT) * ORAM_SNAPSHOT_ALIGNMENT)
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t first_size;
+    uint64_t page_size;
+};
+
+int opagedmem_save(opagedmem_t *opagedmem, const char *path) {
+    struct oram_file_storage file;
+    struct snapshot_header header;
+    uint64_t oram_size;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        goto exit;
+    }
+    oram_file_storage_init_fd(&file, fd);
+
+    memset(&header, '\0', sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = ORAM_SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.first_size = OPAGEDMEM_FIRST_SIZE;
+    header.page_size = OPAGEDMEM_PAGE_SIZE;
+    if (file.base.write(&file.base, 0, &header, sizeof(header))
+            || file.base.write(&file.base, SNAPSHOT_FIRST_LEVEL_OFFSET,
+                opagedmem->first_level,
+                OPAGEDMEM_FIRST_SIZE * sizeof(struct opagedmem_entry))
+            || oram_save_fd(&opagedmem->oram, fd, SNAPSHOT_ORAM_OFFSET,
+                &oram_size)) {
+        goto exit_close;
+    }
+    if (close(fd)) {
+        goto exit;
+    }
+    return 0;
+
+exit_close:
+    close(fd);
+exit:
+    return -1;
+}
+
+int opagedmem_load(opagedmem_t *opagedmem, const char *path) {
+    struct oram_file_storage file;
+    struct snapshot_header header;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        goto exit;
+    }
+    oram_file_storage_init_fd(&file, fd);
+
+    if (file.base.read(&file.base, 0, &header, sizeof(header))) {
+        goto exit_close;
+    }
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic))
+            || header.version != ORAM_SNAPSHOT_VERSION
+            || header.byte_order != SNAPSHOT_BYTE_ORDER
+            || header.first_size != OPAGEDMEM_FIRST_SIZE
+            || header.page_size != OPAGEDMEM_PAGE_SIZE) {
+        goto exit_close;
+    }
+
+    opagedmem->allocator = NULL;
+    if (oram_load_fd(&opagedmem->oram, fd, SNAPSHOT_ORAM_OFFSET, NULL)) {
+        goto exit_close;
+    }
+
+    opagedmem->first_level = oram_allocate(NULL,
+            OPAGEDMEM_FIRST_SIZE * sizeof(struct opagedmem_entry));
+    if (!opagedmem->first_level) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_destroy_oram;
+    }
+    if (file.base.read(&file.base, SNAPSHOT_FIRST_LEVEL_OFFSET,
+                opagedmem->first_level,
+                OPAGEDMEM_FIRST_SIZE * sizeof(struct opagedmem_entry))) {
+        goto exit_free_first_level;
+    }
+    opagedmem->buffer =
+        oram_allocate(NULL, OPAGEDMEM_MID_COUNT * OPAGEDMEM_PAGE_SIZE);
+    if (!opagedmem->buffer) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_free_first_level;
+    }
+    opagedmem->data_buffer = oram_allocate(NULL, OPAGEDMEM_PAGE_SIZE);
+    if (!opagedmem->data_buffer) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_free_buffer;
+    }
+
+    close(fd);
+    return 0;
+
+exit_free_buffer:
+    oram_free(NULL, opagedmem->buffer,
+            OPAGEDMEM_MID_COUNT * OPAGEDMEM_PAGE_SIZE);
+exit_free_first_level:
+    oram_free(NULL, opagedmem->first_level,
+            OPAGEDMEM_FIRST_SIZE * sizeof(struct opagedmem_entry));
+exit_destroy_oram:
+    oram_destroy(&opagedmem->oram);
+exit_close:
+    close(fd);
+exit:
+    return -1;
+}
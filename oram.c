@@ -1,93 +1,560 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "liboblivious/oram.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "liboblivious/algorithms.h"
+#include "liboblivious/oramallocator.h"
+#include "liboblivious/oramstorage.h"
 #include "liboblivious/primitives.h"
+#include "liboblivious/internal/defs.h"
+#include "liboblivious/internal/util.h"
+
+/* Statistics. With LIBOBLIVIOUS_ORAM_STATS undefined, these compile to
+ * nothing. */
 
-/* Helper function for the size of an ORAM block. */
-static size_t get_block_size(oram_t *oram) {
-    return offsetof(struct oram_block, data) + oram->block_size;
+#ifdef LIBOBLIVIOUS_ORAM_STATS
+
+/* Returns the time stamp counter on x86-64 or else the monotonic clock in
+ * nanoseconds. */
+static uint64_t stats_now(void) {
+#if defined(__x86_64__) && defined(__GNUC__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
 }
 
-/* Helper function for the size of an ORAM stash block. */
-static size_t get_stash_block_size(oram_t *oram) {
-    return offsetof(struct oram_stash_block, block) + get_block_size(oram);
+static uint64_t stats_begin(void) {
+    return stats_now();
 }
 
-/* Helper function to return a pointer to a block in a bucket. */
-static struct oram_block *get_bucket_block(oram_t *oram, size_t bucket_idx,
-        size_t block_idx) {
-    return (struct oram_block *) ((unsigned char *) oram->buckets
-            + (bucket_idx * oram->blocks_per_bucket + block_idx)
-                * get_block_size(oram));
+static void stats_end(oram_t *oram, enum oram_phase phase, uint64_t start) {
+    oram->stats.cycles[phase] += stats_now() - start;
+}
+
+/* Records NUM_ACCESSES accesses that returned RET and the stash occupancy
+ * after them. */
+static void stats_record_access(oram_t *oram, size_t num_accesses, int ret) {
+    size_t occupancy = 0;
+    for (size_t i = 0; i < oram->stash_size; i++) {
+        occupancy += oram->stash_metas[i].block.valid;
+    }
+    oram->stats.accesses += num_accesses;
+    oram->stats.failed_accesses += ret ? num_accesses : 0;
+    oram->stats.stash_histogram[MIN(occupancy,
+            ORAM_STASH_HISTOGRAM_SIZE - 1)]++;
+    oram->stats.stash_high_water =
+        MAX(oram->stats.stash_high_water, occupancy);
+}
+
+#else /* LIBOBLIVIOUS_ORAM_STATS */
+
+static uint64_t stats_begin(void) {
+    return 0;
+}
+
+static void stats_end(oram_t *oram UNUSED, enum oram_phase phase UNUSED,
+        uint64_t start UNUSED) {}
+
+static void stats_record_access(oram_t *oram UNUSED,
+        size_t num_accesses UNUSED, int ret UNUSED) {}
+
+#endif /* LIBOBLIVIOUS_ORAM_STATS */
+
+/* Helper function for the size of the metadata of a bucket, which is padded to
+ * a cache line so that the data of the bucket starts on one. */
+static size_t get_bucket_metas_size(oram_t *oram) {
+    return CEIL_DIV(oram->slots_per_bucket * sizeof(struct oram_block_meta),
+            ORAM_CACHE_LINE_SIZE) * ORAM_CACHE_LINE_SIZE;
+}
+
+/* Helper function for the size of a bucket, which is stored as the metadata
+ * of its slots followed by their data. */
+static size_t get_bucket_size(oram_t *oram) {
+    return get_bucket_metas_size(oram)
+        + oram->slots_per_bucket * oram->block_size;
+}
+
+/* Helper function for the number of buckets in the treetop. */
+static size_t get_treetop_buckets(oram_t *oram) {
+    return ((size_t) 1 << oram->treetop_levels) - 1;
+}
+
+/* Helper function for the size of the treetop allocation. */
+static size_t get_treetop_size(oram_t *oram) {
+    return MAX(get_treetop_buckets(oram), 1) * get_bucket_size(oram);
+}
+
+/* Helper function for the offset of a bucket below the treetop in the storage.
+ * The levels below the treetop are split into bands of subtree_levels levels,
+ * and each band is stored as its subtrees in order, each of which is stored in
+ * heap order. A path thus crosses one contiguous subtree per band. With one
+ * level per band, this is the heap order of the tree. */
+static uint64_t get_bucket_offset(oram_t *oram, size_t bucket_idx) {
+    uint64_t node = (uint64_t) bucket_idx + 1;
+    size_t level = 0;
+    while (node >> (level + 1)) {
+        level++;
+    }
+
+    /* Find the band containing LEVEL and the subtree within the band. */
+    size_t band_level = oram->treetop_levels
+        + (level - oram->treetop_levels) / oram->subtree_levels
+            * oram->subtree_levels;
+    size_t subtree_levels = MIN(oram->subtree_levels,
+            oram->depth - band_level);
+    size_t subtree_depth = level - band_level;
+    uint64_t subtree_idx = (node >> subtree_depth)
+        - ((uint64_t) 1 << band_level);
+    uint64_t subtree_node = ((uint64_t) 1 << subtree_depth)
+        | (node & (((uint64_t) 1 << subtree_depth) - 1));
+
+    uint64_t position = ((uint64_t) 1 << band_level)
+        - ((uint64_t) 1 << oram->treetop_levels)
+        + subtree_idx * (((uint64_t) 1 << subtree_levels) - 1)
+        + subtree_node - 1;
+    return position * get_bucket_size(oram);
+}
+
+/* Helper functions to read or write SIZE bytes at OFFSET within a bucket, from
+ * the treetop or from the storage. A storage failure is recorded in
+ * oram->storage_error, which fails the access. */
+static void read_bucket(oram_t *oram, size_t bucket_idx, size_t offset,
+        void *buf, size_t size) {
+    uint64_t start = stats_begin();
+    if (bucket_idx < get_treetop_buckets(oram)) {
+        memcpy(buf, oram->treetop + bucket_idx * get_bucket_size(oram) + offset,
+                size);
+    } else if (oram->storage->read(oram->storage,
+                get_bucket_offset(oram, bucket_idx) + offset, buf, size)) {
+        oram->storage_error = true;
+    }
+    stats_end(oram, ORAM_PHASE_READ, start);
+}
+
+static void write_bucket(oram_t *oram, size_t bucket_idx, size_t offset,
+        const void *buf, size_t size) {
+    uint64_t start = stats_begin();
+    if (bucket_idx < get_treetop_buckets(oram)) {
+        memcpy(oram->treetop + bucket_idx * get_bucket_size(oram) + offset, buf,
+                size);
+    } else if (oram->storage->write(oram->storage,
+                get_bucket_offset(oram, bucket_idx) + offset, buf, size)) {
+        oram->storage_error = true;
+    }
+    stats_end(oram, ORAM_PHASE_WRITE, start);
+}
+
+/* Helper functions to read or write the metadata or data of NUM_SLOTS slots
+ * of a bucket, starting at SLOT_IDX. */
+static void read_bucket_metas(oram_t *oram, size_t bucket_idx,
+        size_t slot_idx, size_t num_slots, struct oram_block_meta *metas) {
+    read_bucket(oram, bucket_idx, slot_idx * sizeof(*metas), metas,
+            num_slots * sizeof(*metas));
+}
+
+static void read_bucket_data(oram_t *oram, size_t bucket_idx,
+        size_t slot_idx, size_t num_slots, unsigned char *data) {
+    read_bucket(oram, bucket_idx,
+            get_bucket_metas_size(oram) + slot_idx * oram->block_size,
+            data, num_slots * oram->block_size);
+}
+
+static void write_bucket_metas(oram_t *oram, size_t bucket_idx,
+        size_t slot_idx, size_t num_slots,
+        const struct oram_block_meta *metas) {
+    write_bucket(oram, bucket_idx, slot_idx * sizeof(*metas), metas,
+            num_slots * sizeof(*metas));
+}
+
+static void write_bucket_data(oram_t *oram, size_t bucket_idx,
+        size_t slot_idx, size_t num_slots, const unsigned char *data) {
+    write_bucket(oram, bucket_idx,
+            get_bucket_metas_size(oram) + slot_idx * oram->block_size,
+            data, num_slots * oram->block_size);
+}
+
+/* Helper functions to read or write a whole bucket, with the metadata of its
+ * slots in METAS and their data in DATA. A bucket in the storage is a single
+ * vectored transfer, with the padding after the metadata going through a
+ * scratch buffer. */
+static void read_whole_bucket(oram_t *oram, size_t bucket_idx,
+        struct oram_block_meta *metas, unsigned char *data) {
+    size_t metas_size = oram->slots_per_bucket * sizeof(*metas);
+    unsigned char padding[ORAM_CACHE_LINE_SIZE];
+    if (bucket_idx < get_treetop_buckets(oram)) {
+        read_bucket_metas(oram, bucket_idx, 0, oram->slots_per_bucket, metas);
+        read_bucket_data(oram, bucket_idx, 0, oram->slots_per_bucket, data);
+        return;
+    }
+
+    uint64_t start = stats_begin();
+    struct oram_storage_segment segments[] = {
+        { metas, metas_size },
+        { padding, get_bucket_metas_size(oram) - metas_size },
+        { data, oram->slots_per_bucket * oram->block_size },
+    };
+    if (oram_storage_readv(oram->storage, get_bucket_offset(oram, bucket_idx),
+                segments, 3)) {
+        oram->storage_error = true;
+    }
+    stats_end(oram, ORAM_PHASE_READ, start);
+}
+
+static void write_whole_bucket(oram_t *oram, size_t bucket_idx,
+        const struct oram_block_meta *metas, const unsigned char *data) {
+    size_t metas_size = oram->slots_per_bucket * sizeof(*metas);
+    unsigned char padding[ORAM_CACHE_LINE_SIZE] = { 0 };
+    if (bucket_idx < get_treetop_buckets(oram)) {
+        write_bucket_metas(oram, bucket_idx, 0, oram->slots_per_bucket, metas);
+        write_bucket_data(oram, bucket_idx, 0, oram->slots_per_bucket, data);
+        return;
+    }
+
+    /* The buffers are only read from for writes. */
+    uint64_t start = stats_begin();
+    struct oram_storage_segment segments[] = {
+        { (void *) metas, metas_size },
+        { padding, get_bucket_metas_size(oram) - metas_size },
+        { (void *) data, oram->slots_per_bucket * oram->block_size },
+    };
+    if (oram_storage_writev(oram->storage, get_bucket_offset(oram, bucket_idx),
+                segments, 3)) {
+        oram->storage_error = true;
+    }
+    stats_end(oram, ORAM_PHASE_WRITE, start);
 }
 
-/* Helper function to return a pointer to a block in the stash. */
-static struct oram_stash_block *get_stash_block(oram_t *oram,
+/* Helper function to return a pointer to a block's metadata in the stash. */
+static struct oram_stash_meta *get_stash_meta(oram_t *oram,
         size_t stash_idx) {
-    return (struct oram_stash_block *) ((unsigned char *) oram->stash
-            + stash_idx * get_stash_block_size(oram));
+    return &oram->stash_metas[stash_idx];
+}
+
+/* Helper function to return a pointer to a block's data in the stash. */
+static unsigned char *get_stash_data(oram_t *oram, size_t stash_idx) {
+    return oram->stash_data + stash_idx * oram->block_size;
+}
+
+/* Copies the block with metadata SRC_META and data SRC_DATA to DEST_META and
+ * DEST_DATA iff COND. */
+static void o_copy_block(oram_t *oram, struct oram_block_meta *dest_meta,
+        unsigned char *dest_data, const struct oram_block_meta *src_meta,
+        const unsigned char *src_data, bool cond) {
+    o_memcpy(dest_meta, src_meta, sizeof(*dest_meta), cond);
+    o_memcpy(dest_data, src_data, oram->block_size, cond);
+}
+
+/* Helper function for the number of stash slots that must be free at the start
+ * of an access. */
+static size_t get_stash_transient_size(oram_t *oram) {
+    size_t path_size = oram->depth * oram->blocks_per_bucket;
+    switch (oram->type) {
+        case ORAM_TYPE_PATH:
+            /* The path, the slot for a new block, and the padding. */
+            return path_size * 2 + 1;
+        case ORAM_TYPE_RING:
+            /* The slots for the blocks accessed between evictions, the path
+             * with its dummy slots, and the padding. */
+            return oram->evict_rate + oram->depth * oram->slots_per_bucket
+                + path_size;
+        case ORAM_TYPE_CIRCUIT:
+            break;
+    }
+    return 0;
+}
+
+/* Helper function for the number of blocks in the path buffer: the path plus
+ * the held and to-write blocks for Circuit ORAM, or the bucket being
+ * reshuffled for Ring ORAM. */
+static size_t get_path_blocks(oram_t *oram) {
+    switch (oram->type) {
+        case ORAM_TYPE_CIRCUIT:
+            return oram->depth * oram->slots_per_bucket + 2;
+        case ORAM_TYPE_RING:
+            return oram->slots_per_bucket;
+        case ORAM_TYPE_PATH:
+            break;
+    }
+    return 0;
+}
+
+/* Helper function for the size of the Ring ORAM slot indices. */
+static size_t get_ring_slot_idxs_size(oram_t *oram) {
+    size_t num_buckets = (1u << oram->depth) - 1;
+    return num_buckets * oram->slots_per_bucket
+        * sizeof(*oram->ring_slot_idxs);
+}
+
+/* Helper function for the size of the client-side position map. */
+static size_t get_posmap_leaves_size(oram_t *oram) {
+    return MAX(oram->num_blocks, 1) * sizeof(*oram->posmap_leaves);
+}
+
+/* Helper function for the position map block size and cutoff of CONFIG, with
+ * the defaults for zero values. */
+static void get_posmap_params(const struct oram_config *config,
+        size_t *block_size, size_t *cutoff) {
+    *block_size = config->posmap_block_size
+        ? config->posmap_block_size
+        : ORAM_POSMAP_BLOCK_SIZE;
+    *cutoff = config->posmap_cutoff
+        ? config->posmap_cutoff
+        : ORAM_POSMAP_CUTOFF;
 }
 
 int oram_init(oram_t *oram, size_t block_size, size_t blocks_per_bucket,
         size_t num_blocks, size_t stash_size) {
-    oram->block_size = block_size;
-    oram->blocks_per_bucket = blocks_per_bucket;
+    struct oram_config config = {
+        .type = ORAM_TYPE_PATH,
+        .block_size = block_size,
+        .blocks_per_bucket = blocks_per_bucket,
+        .num_blocks = num_blocks,
+        .stash_size = stash_size,
+    };
+    return oram_init_config(oram, &config);
+}
+
+int oram_init_config(oram_t *oram, const struct oram_config *config) {
+    oram->type = config->type;
+    oram->block_size = config->block_size;
+    oram->blocks_per_bucket = config->blocks_per_bucket;
+    oram->dummies_per_bucket = 0;
+    oram->evict_rate = 0;
+    if (oram->type == ORAM_TYPE_RING) {
+        if (!config->dummies_per_bucket || !config->evict_rate) {
+            goto exit;
+        }
+        oram->dummies_per_bucket = config->dummies_per_bucket;
+        oram->evict_rate = config->evict_rate;
+    }
+    oram->slots_per_bucket = oram->blocks_per_bucket + oram->dummies_per_bucket;
 
     /* Ceiling divide number of blocks by blocks per bucket to get the number
      * of buckets. */
     size_t requested_buckets =
-        (num_blocks + oram->blocks_per_bucket - 1) / oram->blocks_per_bucket;
+        (config->num_blocks + oram->blocks_per_bucket - 1)
+            / oram->blocks_per_bucket;
 
     /* Round up to the nearest power of 2, minus 1. */
     size_t depth = 1;
-    while ((1u << depth) - 1 < requested_buckets) {
+    while (((uint64_t) 1 << depth) - 1 < requested_buckets) {
         depth++;
+        if (depth > ORAM_MAX_DEPTH) {
+            goto exit;
+        }
+    }
+    oram->depth = depth;
+
+    oram->stash_size = config->stash_size;
+    if (oram->stash_size < get_stash_transient_size(oram)) {
+        goto exit;
     }
 
-    /* Allocate buckets. */
+    memset(&oram->stats, '\0', sizeof(oram->stats));
+
+    /* Allocate the treetop in memory and the remaining buckets in the given
+     * storage, or else in memory. Zeroed buckets hold only invalid blocks. */
     size_t num_buckets = (1u << depth) - 1;
-    oram->depth = depth;
-    oram->buckets = calloc(num_buckets,
-            blocks_per_bucket * get_block_size(oram));
-    if (!oram->buckets) {
+    oram->subtree_levels = MAX(config->subtree_levels, 1);
+    oram->treetop_levels = MIN(config->treetop_levels, depth);
+    oram->allocator = config->allocator;
+    oram->treetop = oram_allocate(oram->allocator, get_treetop_size(oram));
+    if (!oram->treetop) {
         /* Obliviousness violation - out of memory. */
         goto exit;
     }
+    oram_memory_storage_init(&oram->memory_storage, oram->allocator);
+    oram->storage =
+        config->storage ? config->storage : &oram->memory_storage.base;
+    oram->storage_error = false;
+    if (oram->storage->allocate(oram->storage,
+                (uint64_t) (num_buckets - get_treetop_buckets(oram))
+                    * get_bucket_size(oram))) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_free_memory_storage;
+    }
 
     /* Allocate stash. */
-    oram->stash_size = stash_size;
-    oram->stash = calloc(stash_size, get_stash_block_size(oram));
-    if (!oram->stash) {
+    oram->stash_metas = oram_allocate(oram->allocator,
+            oram->stash_size * sizeof(*oram->stash_metas));
+    if (!oram->stash_metas) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_free_memory_storage;
+    }
+    oram->stash_data = oram_allocate(oram->allocator,
+            oram->stash_size * oram->block_size);
+    if (!oram->stash_data) {
         /* Obliviousness violation - out of memory. */
-        goto exit_free_buckets;
+        goto exit_free_stash_metas;
+    }
+
+    /* Allocate the path buffer. */
+    oram->evict_counter = 0;
+    size_t path_blocks = get_path_blocks(oram);
+    oram->path_metas = NULL;
+    oram->path_data = NULL;
+    if (path_blocks) {
+        oram->path_metas = oram_allocate(oram->allocator,
+                path_blocks * sizeof(*oram->path_metas));
+        if (!oram->path_metas) {
+            /* Obliviousness violation - out of memory. */
+            goto exit_free_stash_data;
+        }
+        oram->path_data = oram_allocate(oram->allocator,
+                path_blocks * oram->block_size);
+        if (!oram->path_data) {
+            /* Obliviousness violation - out of memory. */
+            goto exit_free_path_metas;
+        }
+    }
+
+    /* Allocate the Ring ORAM metadata. Every bucket starts out empty, so the
+     * slots need not be shuffled until the first eviction. */
+    oram->round = 0;
+    oram->ring_buckets = NULL;
+    oram->ring_slot_idxs = NULL;
+    if (oram->type == ORAM_TYPE_RING) {
+        oram->ring_buckets = oram_allocate(oram->allocator,
+                num_buckets * sizeof(*oram->ring_buckets));
+        if (!oram->ring_buckets) {
+            /* Obliviousness violation - out of memory. */
+            goto exit_free_path_data;
+        }
+        oram->ring_slot_idxs =
+            oram_allocate(oram->allocator, get_ring_slot_idxs_size(oram));
+        if (!oram->ring_slot_idxs) {
+            /* Obliviousness violation - out of memory. */
+            goto exit_free_ring_buckets;
+        }
+        for (size_t i = 0; i < num_buckets * oram->slots_per_bucket; i++) {
+            oram->ring_slot_idxs[i] = i % oram->slots_per_bucket;
+        }
+    }
+
+    /* Allocate the position map, either on the client side or recursively as
+     * an ORAM of the same type with num_blocks / posmap_entries_per_block
+     * blocks. */
+    oram->num_blocks = config->num_blocks;
+    oram->posmap_entries_per_block = 0;
+    oram->posmap = NULL;
+    oram->posmap_leaves = NULL;
+    if (config->position_map) {
+        size_t posmap_block_size;
+        size_t posmap_cutoff;
+        get_posmap_params(config, &posmap_block_size, &posmap_cutoff);
+        oram->posmap_entries_per_block = posmap_block_size / sizeof(uint32_t);
+        if (oram->posmap_entries_per_block < 2) {
+            goto exit_free_ring_slot_idxs;
+        }
+
+        if (oram->num_blocks <= posmap_cutoff) {
+            oram->posmap_leaves = oram_allocate(oram->allocator,
+                    get_posmap_leaves_size(oram));
+            if (!oram->posmap_leaves) {
+                /* Obliviousness violation - out of memory. */
+                goto exit_free_ring_slot_idxs;
+            }
+        } else {
+            struct oram_config posmap_config = *config;
+            posmap_config.block_size = posmap_block_size;
+            posmap_config.storage = NULL;
+            posmap_config.num_blocks =
+                CEIL_DIV(oram->num_blocks, oram->posmap_entries_per_block);
+            oram->posmap = malloc(sizeof(*oram->posmap));
+            if (!oram->posmap) {
+                /* Obliviousness violation - out of memory. */
+                goto exit_free_ring_slot_idxs;
+            }
+            if (oram_init_config(oram->posmap, &posmap_config)) {
+                goto exit_free_posmap;
+            }
+        }
     }
 
     return 0;
 
-exit_free_buckets:
-    free(oram->buckets);
+exit_free_posmap:
+    free(oram->posmap);
+exit_free_ring_slot_idxs:
+    oram_free(oram->allocator, oram->ring_slot_idxs,
+            get_ring_slot_idxs_size(oram));
+exit_free_ring_buckets:
+    oram_free(oram->allocator, oram->ring_buckets,
+            num_buckets * sizeof(*oram->ring_buckets));
+exit_free_path_data:
+    oram_free(oram->allocator, oram->path_data,
+            path_blocks * oram->block_size);
+exit_free_path_metas:
+    oram_free(oram->allocator, oram->path_metas,
+            path_blocks * sizeof(*oram->path_metas));
+exit_free_stash_data:
+    oram_free(oram->allocator, oram->stash_data,
+            oram->stash_size * oram->block_size);
+exit_free_stash_metas:
+    oram_free(oram->allocator, oram->stash_metas,
+            oram->stash_size * sizeof(*oram->stash_metas));
+exit_free_memory_storage:
+    oram_memory_storage_destroy(&oram->memory_storage);
+    oram_free(oram->allocator, oram->treetop, get_treetop_size(oram));
 exit:
     return -1;
 }
 
 void oram_destroy(oram_t *oram) {
-    free(oram->buckets);
-    free(oram->stash);
+    oram_free(oram->allocator, oram->treetop, get_treetop_size(oram));
+    oram_memory_storage_destroy(&oram->memory_storage);
+    oram_free(oram->allocator, oram->stash_metas,
+            oram->stash_size * sizeof(*oram->stash_metas));
+    oram_free(oram->allocator, oram->stash_data,
+            oram->stash_size * oram->block_size);
+    size_t path_blocks = get_path_blocks(oram);
+    oram_free(oram->allocator, oram->path_metas,
+            path_blocks * sizeof(*oram->path_metas));
+    oram_free(oram->allocator, oram->path_data,
+            path_blocks * oram->block_size);
+    oram_free(oram->allocator, oram->ring_buckets,
+            ((1u << oram->depth) - 1) * sizeof(*oram->ring_buckets));
+    oram_free(oram->allocator, oram->ring_slot_idxs,
+            get_ring_slot_idxs_size(oram));
+    if (oram->posmap) {
+        oram_destroy(oram->posmap);
+        free(oram->posmap);
+    }
+    oram_free(oram->allocator, oram->posmap_leaves,
+            get_posmap_leaves_size(oram));
 }
 
-/* Comparator to sort blocks from highest to lowest bucket index. */
+/* Path ORAM. The stash holds the persistent blocks packed at the front, and
+ * the last get_stash_transient_size(oram) slots are free between accesses. The
+ * path is read into the start of that region, and the last
+ * oram->depth * oram->blocks_per_bucket slots are reserved for dummy padding
+ * during eviction. */
+
+/* Comparator to sort the blocks to write back from highest to lowest bucket
+ * index, with valid blocks before dummies within a bucket. Subtracting one
+ * would wrap unassigned blocks around to the highest value, but none are left
+ * by the time of the sort. */
 static int stash_comparator(const void *a_, const void *b_, void *aux UNUSED) {
-    const struct oram_stash_block *a = a_;
-    const struct oram_stash_block *b = b_;
+    const struct oram_stash_meta *a = a_;
+    const struct oram_stash_meta *b = b_;
+    uint64_t a_bucket_idx = a->bucket_idx_plus_one - 1;
+    uint64_t b_bucket_idx = b->bucket_idx_plus_one - 1;
 
     /* If A < B, this adds 1 + (1 - 1) == 1.
      * If A > B, this adds 0 + (0 - 1) == -1.
      * If A == B, this adds 0 + (1 - 1) == 0. */
-    int comp = (int) (a->bucket_idx_plus_one < b->bucket_idx_plus_one)
-        + ((int) (a->bucket_idx_plus_one <= b->bucket_idx_plus_one) - 1);
+    int comp = (int) (a_bucket_idx < b_bucket_idx)
+        + ((int) (a_bucket_idx <= b_bucket_idx) - 1);
 
     comp <<= 2;
 
@@ -98,10 +565,184 @@ static int stash_comparator(const void *a_, const void *b_, void *aux UNUSED) {
     return comp;
 }
 
-int oram_access(oram_t *oram, uint64_t block_id, uint64_t leaf_id, void *data,
-        bool write, uint64_t *new_leaf_id, bool is_real_access,
+static bool stash_is_unassigned(size_t index, void *oram_) {
+    oram_t *oram = oram_;
+    return !get_stash_meta(oram, index)->bucket_idx_plus_one;
+}
+
+static bool stash_is_valid(size_t index, void *oram_) {
+    oram_t *oram = oram_;
+    return get_stash_meta(oram, index)->block.valid;
+}
+
+static void stash_swap(size_t a, size_t b, bool should_swap, void *oram_) {
+    oram_t *oram = oram_;
+    o_memswap(get_stash_meta(oram, a), get_stash_meta(oram, b),
+            sizeof(*oram->stash_metas), should_swap);
+    o_memswap(get_stash_data(oram, a), get_stash_data(oram, b),
+            oram->block_size, should_swap);
+}
+
+/* Returns the leaf index, plus one, of the next path to evict along, in
+ * reverse-lexicographic order. */
+static uint64_t get_evict_leaf_idx_plus_one(oram_t *oram) {
+    uint64_t evict_leaf_id = 0;
+    for (size_t i = 0; i < oram->depth - 1; i++) {
+        evict_leaf_id |= ((oram->evict_counter >> i) & 1)
+            << (oram->depth - 2 - i);
+    }
+    oram->evict_counter++;
+    return evict_leaf_id + (1u << (oram->depth - 1));
+}
+
+/* Copies every slot of the buckets in BUCKET_IDXS_PLUS_ONE into the stash
+ * starting at STASH_IDX. Every bucket read is written back in full before the
+ * access ends, so the blocks need not be invalidated in the tree. */
+static void path_read_buckets(oram_t *oram,
+        const uint64_t *bucket_idxs_plus_one, size_t num_buckets,
+        size_t stash_idx) {
+    struct oram_block_meta metas[oram->slots_per_bucket];
+    for (size_t j = 0; j < num_buckets; j++) {
+        size_t bucket_idx = bucket_idxs_plus_one[j] - 1;
+        read_whole_bucket(oram, bucket_idx, metas,
+                get_stash_data(oram, stash_idx));
+        for (size_t i = 0; i < oram->slots_per_bucket; i++) {
+            get_stash_meta(oram, stash_idx)->block = metas[i];
+            stash_idx++;
+        }
+    }
+}
+
+/* Copies every slot of the buckets on the path to LEAF_IDX_PLUS_ONE into the
+ * stash starting at STASH_IDX, from the leaf to the root. */
+static void path_read_path(oram_t *oram, uint64_t leaf_idx_plus_one,
+        size_t stash_idx) {
+    uint64_t bucket_idxs_plus_one[oram->depth];
+    for (size_t i = 0; i < oram->depth; i++) {
+        bucket_idxs_plus_one[i] = leaf_idx_plus_one >> i;
+    }
+    path_read_buckets(oram, bucket_idxs_plus_one, oram->depth, stash_idx);
+}
+
+/* Writes the last NUM_BUCKETS * oram->blocks_per_bucket blocks of the stash
+ * back to the buckets in BUCKET_IDXS_PLUS_ONE, invalidating them in the
+ * stash. */
+static void path_write_buckets(oram_t *oram,
+        const uint64_t *bucket_idxs_plus_one, size_t num_buckets) {
+    struct oram_block_meta metas[oram->blocks_per_bucket];
+    size_t stash_idx = oram->stash_size - num_buckets * oram->blocks_per_bucket;
+    for (size_t j = 0; j < num_buckets; j++) {
+        size_t bucket_idx = bucket_idxs_plus_one[j] - 1;
+        unsigned char *data = get_stash_data(oram, stash_idx);
+        for (size_t i = 0; i < oram->blocks_per_bucket; i++) {
+            metas[i] = get_stash_meta(oram, stash_idx)->block;
+            /* Invalidate it in the stash. */
+            get_stash_meta(oram, stash_idx)->block.valid = false;
+            stash_idx++;
+        }
+        write_whole_bucket(oram, bucket_idx, metas, data);
+    }
+}
+
+/* Assigns the blocks in the stash to the deepest bucket possible among the
+ * NUM_BUCKETS buckets in BUCKET_IDXS_PLUS_ONE, which must be a union of paths
+ * sorted from highest to lowest bucket index, pads each bucket to exactly
+ * oram->blocks_per_bucket blocks with dummies, and rearranges the stash.
+ * Afterwards, the last NUM_BUCKETS * oram->blocks_per_bucket blocks of the
+ * stash are the blocks to write back, in the order of BUCKET_IDXS_PLUS_ONE,
+ * and the remaining valid blocks are packed at the front. Only the compactions
+ * and the final sort of the assigned blocks touch the block data. */
+static void path_prepare_buckets_eviction(oram_t *oram,
+        uint64_t *bucket_idxs_plus_one, size_t num_buckets) {
+    size_t padding_size = num_buckets * oram->blocks_per_bucket;
+    size_t bucket_fullness[num_buckets];
+    size_t bucket_shifts[num_buckets];
+    uint64_t start = stats_begin();
+
+    /* A block can go in a bucket iff its leaf index shifted to the bucket's
+     * level equals the bucket index. */
+    for (size_t j = 0; j < num_buckets; j++) {
+        bucket_shifts[j] = oram->depth - 1;
+        for (uint64_t idx = bucket_idxs_plus_one[j]; idx > 1; idx >>= 1) {
+            bucket_shifts[j]--;
+        }
+    }
+
+    /* Assign all blocks in the stash to the deepest bucket index possible.
+     * Unassigned blocks get the bucket value 0 to get sorted to the front. We
+     * stop before the last padding_size positions, for dummy padding. */
+    memset(bucket_fullness, '\0', sizeof(bucket_fullness));
+    for (size_t i = 0; i < oram->stash_size - padding_size; i++) {
+        struct oram_stash_meta *meta = get_stash_meta(oram, i);
+        bool assigned = !meta->block.valid;
+        uint64_t leaf_idx_plus_one = meta->block.leaf_idx_plus_one;
+        meta->bucket_idx_plus_one = 0;
+        for (size_t j = 0; j < num_buckets; j++) {
+            bool cond = !assigned
+                & ((leaf_idx_plus_one >> bucket_shifts[j])
+                        == bucket_idxs_plus_one[j])
+                & (bucket_fullness[j] < oram->blocks_per_bucket);
+            o_set64(&meta->bucket_idx_plus_one, bucket_idxs_plus_one[j], cond);
+            o_setsize(&bucket_fullness[j], bucket_fullness[j] + 1, cond);
+            assigned |= cond;
+        }
+    }
+
+    /* Pad the stash with padding_size dummy blocks, with an assigned bucket
+     * index if needed and an unassigned index if not, based on the bucket
+     * fullness. */
+    size_t stash_idx = oram->stash_size - padding_size;
+    for (size_t j = 0; j < num_buckets; j++) {
+        for (size_t i = 0; i < oram->blocks_per_bucket; i++) {
+            struct oram_stash_meta *meta = get_stash_meta(oram, stash_idx);
+            bool cond = bucket_fullness[j] + i < oram->blocks_per_bucket;
+            meta->block.valid = false;
+            meta->bucket_idx_plus_one = 0;
+            o_set64(&meta->bucket_idx_plus_one, bucket_idxs_plus_one[j], cond);
+            stash_idx++;
+        }
+    }
+    stats_end(oram, ORAM_PHASE_EVICT, start);
+
+    /* At this point, exactly padding_size blocks are assigned, with exactly
+     * oram->blocks_per_bucket blocks per bucket. Compact the unassigned blocks
+     * to the front so that the assigned blocks fill the last padding_size
+     * slots, and then compact the valid unassigned blocks to the front. Each
+     * compaction moves every block O(log N) times, whereas sorting the whole
+     * stash would move every block O(log^2 N) times. */
+    start = stats_begin();
+    o_compact_generate_swaps(oram->stash_size, stash_is_unassigned,
+            stash_swap, oram);
+    o_compact_generate_swaps(oram->stash_size - padding_size, stash_is_valid,
+            stash_swap, oram);
+
+    /* Sort only the assigned blocks from highest to lowest bucket index. */
+    void *columns[] = { get_stash_data(oram, oram->stash_size - padding_size) };
+    size_t column_sizes[] = { oram->block_size };
+    o_sort_columns(get_stash_meta(oram, oram->stash_size - padding_size),
+            padding_size, sizeof(*oram->stash_metas), columns, column_sizes, 1,
+            stash_comparator, NULL);
+    stats_end(oram, ORAM_PHASE_SORT, start);
+}
+
+/* Prepares the eviction of the path to LEAF_IDX_PLUS_ONE. Afterwards, the last
+ * oram->depth * oram->blocks_per_bucket blocks of the stash are the blocks to
+ * write back, from the leaf to the root. */
+static void path_prepare_eviction(oram_t *oram, uint64_t leaf_idx_plus_one) {
+    uint64_t bucket_idxs_plus_one[oram->depth];
+    for (size_t i = 0; i < oram->depth; i++) {
+        bucket_idxs_plus_one[i] = leaf_idx_plus_one >> i;
+    }
+    path_prepare_buckets_eviction(oram, bucket_idxs_plus_one, oram->depth);
+}
+
+static int path_access(oram_t *oram, uint64_t block_id, uint64_t leaf_id,
+        void (*op)(void *block_data, bool cond, void *aux), void *aux,
+        bool create, uint64_t new_leaf_id, bool is_real_access,
         uint64_t (*rand_func)(void)) {
-    size_t bucket_fullness[oram->depth];
+    size_t path_size = oram->depth * oram->blocks_per_bucket;
+    size_t transient_idx = oram->stash_size - get_stash_transient_size(oram);
+    uint64_t bucket_idxs_plus_one[oram->depth];
 
     /* If this is a dummy access, choose a random leaf ID. */
     o_set64(&leaf_id, rand_func() % (1u << (oram->depth - 1)), !is_real_access);
@@ -111,151 +752,1747 @@ int oram_access(oram_t *oram, uint64_t block_id, uint64_t leaf_id, void *data,
         goto exit;
     }
 
-    /* We will eventually need to pad the last
-     * oram->depth * oram->blocks_per_bucket blocks with dummy blocks, and we
-     * also need 1 additional slot for a potential new write if the block isn't
-     * found, so we ensure that there is at least that much space at the end of
-     * the stash. All the dummy blocks other than the initial path are at the
-     * end, so it is sufficient to just check one element. */
-
-    if (get_stash_block(oram, oram->stash_size - oram->depth * oram->blocks_per_bucket - 1)->block.valid) {
+    /* The persistent blocks are packed at the front of the stash, so it is
+     * sufficient to check that the first transient slot is a dummy. */
+    if (get_stash_meta(oram, transient_idx)->block.valid) {
         /* Obliviousness violation - stash overflowed. */
         goto exit;
     }
 
-    /* Iterate from leaf to root, keeping track of whether the searched block
-     * was written and obliviously either writing to or reading from
-     * (o_memaccess) the data. We read the blocks into the beginning of the
-     * stash, since the first oram->depth * oram->blocks_per_bucket positions
-     * should contain the path of stash blocks that was evicted last time and
-     * are thus invalid. */
-
-    size_t leaf_idx_plus_one = leaf_id + (1u << (oram->depth - 1));
-    size_t stash_idx = 0;
-
-    for (size_t bucket_idx_plus_one = leaf_idx_plus_one; bucket_idx_plus_one;
-            bucket_idx_plus_one >>= 1) {
-        for (size_t i = 0; i < oram->blocks_per_bucket; i++) {
-            /* Copy block to stash. */
-            memcpy(&get_stash_block(oram, stash_idx)->block,
-                    get_bucket_block(oram, bucket_idx_plus_one - 1, i),
-                    get_block_size(oram));
-            /* Invalidate it in the tree. */
-            get_bucket_block(oram, bucket_idx_plus_one - 1, i)->valid = false;
-            stash_idx++;
-        }
+    /* Read the path into the transient region of the stash. */
+    uint64_t leaf_idx_plus_one = leaf_id + (1u << (oram->depth - 1));
+    for (size_t i = 0; i < oram->depth; i++) {
+        bucket_idxs_plus_one[i] = leaf_idx_plus_one >> i;
     }
+    path_read_buckets(oram, bucket_idxs_plus_one, oram->depth, transient_idx);
 
-    /* Obliviously scan through the stash and access the block. The last
-     * (oram->depth * oram->blocks_per_bucket - 1) positions should be a
-     * dummies if we have reached this point, so we skip it. The accessed
-     * block gets assigned the new leaf. If this is a dummy access, start with
-     * accessed == true to begin with and don't change anything. */
-    o_set64(new_leaf_id, rand_func() % (1u << (oram->depth - 1)),
-                is_real_access);
-    size_t new_leaf_idx_plus_one = *new_leaf_id + (1u << (oram->depth - 1));
+    /* Obliviously scan through the stash and apply OP to every block, with
+     * COND set only for the requested block. The last path_size + 1 positions
+     * are dummies, so we skip them. The accessed block gets assigned the new
+     * leaf. */
+    uint64_t start = stats_begin();
+    uint32_t new_leaf_idx_plus_one = new_leaf_id + (1u << (oram->depth - 1));
     bool accessed = false;
-    for (size_t i = 0;
-            i < oram->stash_size - oram->depth * oram->blocks_per_bucket - 1;
-            i++) {
+    for (size_t i = 0; i < oram->stash_size - path_size - 1; i++) {
         /* Access the block and set its new leaf if it was requested. */
-        bool cond = (get_stash_block(oram, i)->block.id == block_id)
-            & get_stash_block(oram, i)->block.valid & is_real_access;
-        o_set64(&get_stash_block(oram, i)->block.leaf_idx_plus_one,
-                new_leaf_idx_plus_one, cond);
-        o_memaccess(data, get_stash_block(oram, i)->block.data,
-                oram->block_size, write, cond);
+        struct oram_block_meta *meta = &get_stash_meta(oram, i)->block;
+        bool cond = (meta->id == block_id) & meta->valid & is_real_access;
+        o_set32(&meta->leaf_idx_plus_one, new_leaf_idx_plus_one, cond);
+        op(get_stash_data(oram, i), cond, aux);
         accessed |= cond;
     }
 
-    stash_idx = oram->stash_size - oram->depth * oram->blocks_per_bucket - 1;
+    size_t stash_idx = oram->stash_size - path_size - 1;
 
-    /* Write to the next position in the stash iff this is a write, the desired
-     * block was not accessed, and this is a real access, meaning this is a new
-     * block ID. Assignments don't need to be conditional because the end of
-     * the stash will always be invalid (dummy). */
-    bool cond = write & !accessed & is_real_access;
-    get_stash_block(oram, stash_idx)->block.valid = cond;
-    get_stash_block(oram, stash_idx)->block.id = block_id;
-    get_stash_block(oram, stash_idx)->block.leaf_idx_plus_one =
-        new_leaf_idx_plus_one;
-    memcpy(get_stash_block(oram, stash_idx)->block.data, data,
-            oram->block_size);
+    /* Create a zeroed block in the next position in the stash and apply OP to
+     * it iff CREATE is set, the desired block was not accessed, and this is a
+     * real access, meaning this is a new block ID. Assignments don't need to be
+     * conditional because this position will always be invalid (dummy). */
+    bool cond = create & !accessed & is_real_access;
+    struct oram_block_meta *meta = &get_stash_meta(oram, stash_idx)->block;
+    meta->valid = cond;
+    meta->id = block_id;
+    meta->leaf_idx_plus_one = new_leaf_idx_plus_one;
+    memset(get_stash_data(oram, stash_idx), '\0', oram->block_size);
+    op(get_stash_data(oram, stash_idx), cond, aux);
     accessed |= cond;
-    stash_idx++;
+    stats_end(oram, ORAM_PHASE_SCAN, start);
 
-    /* Assign all blocks in the stash to the deepest bucket index possible.
-     * Dummy blocks get the max bucket value to get sorted to the end. We stop
-     * before the last (oram->depth * oram->blocks_per_bucket) positions, for
-     * dummy padding. */
-    memset(bucket_fullness, '\0', sizeof(bucket_fullness));
-    for (size_t i = 0;
-            i < oram->stash_size - oram->depth * oram->blocks_per_bucket; i++) {
-        bool assigned = !get_stash_block(oram, i)->block.valid;
-        get_stash_block(oram, i)->bucket_idx_plus_one = 0;
-        uint64_t curr_idx_plus_one =
-            get_stash_block(oram, i)->block.leaf_idx_plus_one;
-        uint64_t bucket_idx_plus_one = leaf_idx_plus_one;
-        size_t bufu_idx = 0;
-        while (bucket_idx_plus_one) {
-            bool cond = !assigned & (bucket_idx_plus_one == curr_idx_plus_one)
-                & (bucket_fullness[bufu_idx] < oram->blocks_per_bucket);
-            o_set64(&get_stash_block(oram, i)->bucket_idx_plus_one,
-                    bucket_idx_plus_one, cond);
-            o_setsize(&bucket_fullness[bufu_idx], bucket_fullness[bufu_idx] + 1,
-                    cond);
-            assigned |= cond;
-            curr_idx_plus_one >>= 1;
-            bucket_idx_plus_one >>= 1;
-            bufu_idx++;
+    /* The last path_size blocks of the stash now contain the blocks to evict
+     * back to the path, so we write them back. */
+    path_prepare_buckets_eviction(oram, bucket_idxs_plus_one, oram->depth);
+    path_write_buckets(oram, bucket_idxs_plus_one, oram->depth);
+
+    if (!accessed & is_real_access) {
+        goto exit;
+    }
+
+    return 0;
+
+exit:
+    return -1;
+}
+
+/* Comparator to sort bucket indices in descending order, which orders buckets
+ * from the leaves to the root. This is only used on public bucket indices. */
+static int bucket_idx_comparator(const void *a_, const void *b_) {
+    const uint64_t *a = a_;
+    const uint64_t *b = b_;
+    return (*a < *b) - (*a > *b);
+}
+
+/* Applies the request for BLOCK_ID to the block with metadata META and data
+ * BLOCK_DATA iff it matches, as part of a batch. */
+static void path_batch_apply(oram_t *oram, struct oram_block_meta *meta,
+        unsigned char *block_data, uint64_t block_id, void *data, bool write,
+        uint32_t new_leaf_idx_plus_one, bool is_real_access, bool *accessed) {
+    bool cond = (meta->id == block_id) & meta->valid & is_real_access;
+    o_set32(&meta->leaf_idx_plus_one, new_leaf_idx_plus_one, cond);
+    o_memaccess(data, block_data, oram->block_size, write, cond);
+    *accessed |= cond;
+}
+
+static int path_access_batch(oram_t *oram, size_t num_requests,
+        const uint64_t *block_ids, const uint64_t *leaf_ids, void *data_,
+        const bool *writes, uint64_t *new_leaf_ids,
+        const bool *is_real_accesses, uint64_t (*rand_func)(void)) {
+    unsigned char *data = data_;
+    uint64_t num_leaves = 1u << (oram->depth - 1);
+    uint64_t leaf_idxs_plus_one[num_requests];
+    uint32_t new_leaf_idxs_plus_one[num_requests];
+    bool accessed[num_requests];
+    int ret = -1;
+
+    uint64_t *bucket_idxs_plus_one =
+        malloc(num_requests * oram->depth * sizeof(*bucket_idxs_plus_one));
+    if (!bucket_idxs_plus_one) {
+        /* Obliviousness violation - out of memory. */
+        goto exit;
+    }
+
+    /* Choose a random leaf ID for dummy accesses and a new leaf ID for real
+     * accesses. */
+    for (size_t j = 0; j < num_requests; j++) {
+        uint64_t leaf_id = leaf_ids[j];
+        o_set64(&leaf_id, rand_func() % num_leaves, !is_real_accesses[j]);
+        if (leaf_id >= num_leaves) {
+            /* Obliviousness violation - invalid leaf ID. */
+            goto exit_free_bucket_idxs;
         }
+        leaf_idxs_plus_one[j] = leaf_id + num_leaves;
+        new_leaf_idxs_plus_one[j] = rand_func() % num_leaves + num_leaves;
     }
 
-    /* Pad the stash with (oram->depth * oram->blocks_per_bucket) dummy blocks,
-     * with an assigned bucket index if needed and an invalid value if not,
-     * based on the bucket fullness. */
-    size_t bufu_idx = 0;
-    for (size_t bucket_idx_plus_one = leaf_idx_plus_one; bucket_idx_plus_one;
-            bucket_idx_plus_one >>= 1) {
-        for (size_t i = 0; i < oram->blocks_per_bucket; i++) {
-            bool cond = bucket_fullness[bufu_idx] + i < oram->blocks_per_bucket;
-            get_stash_block(oram, stash_idx)->bucket_idx_plus_one = 0;
-            o_set64(&get_stash_block(oram, stash_idx)->bucket_idx_plus_one,
-                    bucket_idx_plus_one, cond);
-            stash_idx++;
+    /* Take the union of the buckets on all of the paths. The leaves are
+     * revealed by the access anyway, so this need not be oblivious. */
+    for (size_t j = 0; j < num_requests; j++) {
+        for (size_t i = 0; i < oram->depth; i++) {
+            bucket_idxs_plus_one[j * oram->depth + i] =
+                leaf_idxs_plus_one[j] >> i;
+        }
+    }
+    qsort(bucket_idxs_plus_one, num_requests * oram->depth,
+            sizeof(*bucket_idxs_plus_one), bucket_idx_comparator);
+    size_t num_buckets = 1;
+    for (size_t i = 1; i < num_requests * oram->depth; i++) {
+        if (bucket_idxs_plus_one[i] != bucket_idxs_plus_one[num_buckets - 1]) {
+            bucket_idxs_plus_one[num_buckets] = bucket_idxs_plus_one[i];
+            num_buckets++;
         }
-        bufu_idx++;
     }
 
-    /* Sort blocks from highest to lowest bucket index, with 0 (invalid) at the
-     * end. At this point, each valid index has exactly oram->blocks_per_bucket
-     * blocks. */
-    o_sort(oram->stash, oram->stash_size, get_stash_block_size(oram),
-            stash_comparator, NULL);
+    /* The transient region holds the buckets, the slots for new blocks, and
+     * the padding. */
+    size_t buckets_size = num_buckets * oram->blocks_per_bucket;
+    size_t transient_size = buckets_size * 2 + num_requests;
+    if (oram->stash_size < transient_size) {
+        goto exit_free_bucket_idxs;
+    }
+    size_t transient_idx = oram->stash_size - transient_size;
+    if (get_stash_meta(oram, transient_idx)->block.valid) {
+        /* Obliviousness violation - stash overflowed. */
+        goto exit_free_bucket_idxs;
+    }
 
-    /* The first oram->depth * oram->blocks_per_bucket of the stash now
-     * contains the blocks to evict back to the path, so we write them back,
-     * invalidating them in the stash. */
-    stash_idx = 0;
-    for (size_t bucket_idx_plus_one = leaf_idx_plus_one; bucket_idx_plus_one;
-            bucket_idx_plus_one >>= 1) {
-        for (size_t i = 0; i < oram->blocks_per_bucket; i++) {
-            /* Copy block to path. */
-            memcpy(get_bucket_block(oram, bucket_idx_plus_one - 1, i),
-                    &get_stash_block(oram, stash_idx)->block,
-                    get_block_size(oram));
-            /* Invalidate it in the stash. */
-            get_stash_block(oram, stash_idx)->block.valid = false;
-            stash_idx++;
+    /* Read the buckets into the transient region of the stash. */
+    path_read_buckets(oram, bucket_idxs_plus_one, num_buckets, transient_idx);
+
+    /* Serve all of the requests in a single scan of the stash, applying them
+     * to each block in order. */
+    uint64_t start = stats_begin();
+    size_t new_idx = oram->stash_size - buckets_size - num_requests;
+    memset(accessed, '\0', sizeof(accessed));
+    for (size_t i = 0; i < new_idx; i++) {
+        for (size_t j = 0; j < num_requests; j++) {
+            path_batch_apply(oram, &get_stash_meta(oram, i)->block,
+                    get_stash_data(oram, i), block_ids[j],
+                    data + j * oram->block_size, writes[j],
+                    new_leaf_idxs_plus_one[j], is_real_accesses[j],
+                    &accessed[j]);
         }
     }
 
-    if (!accessed & is_real_access) {
-        goto exit;
+    /* Create new blocks for writes to new block IDs. Each request also sees
+     * the blocks created by the requests before it. */
+    for (size_t j = 0; j < num_requests; j++) {
+        for (size_t k = 0; k < j; k++) {
+            path_batch_apply(oram, &get_stash_meta(oram, new_idx + k)->block,
+                    get_stash_data(oram, new_idx + k), block_ids[j],
+                    data + j * oram->block_size, writes[j],
+                    new_leaf_idxs_plus_one[j], is_real_accesses[j],
+                    &accessed[j]);
+        }
+
+        bool cond = writes[j] & !accessed[j] & is_real_accesses[j];
+        struct oram_block_meta *meta =
+            &get_stash_meta(oram, new_idx + j)->block;
+        meta->valid = cond;
+        meta->id = block_ids[j];
+        meta->leaf_idx_plus_one = new_leaf_idxs_plus_one[j];
+        memcpy(get_stash_data(oram, new_idx + j), data + j * oram->block_size,
+                oram->block_size);
+        accessed[j] |= cond;
     }
+    stats_end(oram, ORAM_PHASE_SCAN, start);
 
-    return 0;
+    path_prepare_buckets_eviction(oram, bucket_idxs_plus_one, num_buckets);
+    path_write_buckets(oram, bucket_idxs_plus_one, num_buckets);
+
+    /* The new leaf IDs are only output once every request has been
+     * validated. */
+    ret = 0;
+    for (size_t j = 0; j < num_requests; j++) {
+        o_set64(&new_leaf_ids[j], new_leaf_idxs_plus_one[j] - num_leaves,
+                is_real_accesses[j]);
+        if (!accessed[j] & is_real_accesses[j]) {
+            ret = -1;
+        }
+    }
 
+exit_free_bucket_idxs:
+    free(bucket_idxs_plus_one);
 exit:
-    return -1;
+    return ret;
+}
+
+/* Circuit ORAM. The path being evicted is copied into oram->path_metas and
+ * oram->path_data, where level 0 is the stash and levels 1 through oram->depth
+ * are the buckets from the root to the leaf. */
+
+/* Helper function to return the number of blocks at a level of the path. */
+static size_t circuit_get_level_size(oram_t *oram, size_t level) {
+    return level ? oram->blocks_per_bucket : oram->stash_size;
+}
+
+/* Helper function to return a pointer to a block's metadata at a level of the
+ * path. */
+static struct oram_block_meta *circuit_get_meta(oram_t *oram, size_t level,
+        size_t block_idx) {
+    if (!level) {
+        return &get_stash_meta(oram, block_idx)->block;
+    }
+    return &oram->path_metas[(level - 1) * oram->blocks_per_bucket
+        + block_idx];
+}
+
+/* Helper function to return a pointer to a block's data at a level of the
+ * path. */
+static unsigned char *circuit_get_data(oram_t *oram, size_t level,
+        size_t block_idx) {
+    if (!level) {
+        return get_stash_data(oram, block_idx);
+    }
+    return oram->path_data
+        + ((level - 1) * oram->blocks_per_bucket + block_idx)
+            * oram->block_size;
+}
+
+/* Helper functions to return pointers to the held block, which is also used as
+ * the temporary block during an access, and the to-write block, which follow
+ * the path. */
+static struct oram_block_meta *circuit_get_hold(oram_t *oram) {
+    return circuit_get_meta(oram, oram->depth + 1, 0);
+}
+
+static unsigned char *circuit_get_hold_data(oram_t *oram) {
+    return circuit_get_data(oram, oram->depth + 1, 0);
+}
+
+static struct oram_block_meta *circuit_get_towrite(oram_t *oram) {
+    return circuit_get_meta(oram, oram->depth + 1, 1);
+}
+
+static unsigned char *circuit_get_towrite_data(oram_t *oram) {
+    return circuit_get_data(oram, oram->depth + 1, 1);
+}
+
+static void circuit_read_path(oram_t *oram, uint64_t leaf_idx_plus_one) {
+    for (size_t level = 1; level <= oram->depth; level++) {
+        uint64_t bucket_idx_plus_one =
+            leaf_idx_plus_one >> (oram->depth - level);
+        read_whole_bucket(oram, bucket_idx_plus_one - 1,
+                circuit_get_meta(oram, level, 0),
+                circuit_get_data(oram, level, 0));
+    }
+}
+
+static void circuit_write_path(oram_t *oram, uint64_t leaf_idx_plus_one) {
+    for (size_t level = 1; level <= oram->depth; level++) {
+        uint64_t bucket_idx_plus_one =
+            leaf_idx_plus_one >> (oram->depth - level);
+        write_whole_bucket(oram, bucket_idx_plus_one - 1,
+                circuit_get_meta(oram, level, 0),
+                circuit_get_data(oram, level, 0));
+    }
+}
+
+/* Returns the deepest level of the path to LEAF_IDX_PLUS_ONE that BLOCK may
+ * reside at, or 0 if BLOCK is invalid. Since the leaf indices share a prefix
+ * up to the deepest common bucket, this is the number of levels at which their
+ * ancestors match. */
+static size_t circuit_get_reach(oram_t *oram,
+        const struct oram_block_meta *block, uint64_t leaf_idx_plus_one) {
+    size_t reach = 0;
+    for (size_t shift = 0; shift < oram->depth; shift++) {
+        reach += (block->leaf_idx_plus_one >> shift)
+            == (leaf_idx_plus_one >> shift);
+    }
+    return reach * block->valid;
+}
+
+/* Evicts along the path to LEAF_IDX_PLUS_ONE, which must already be in the
+ * path buffer. All decisions are made on metadata by the two preparation
+ * scans, so that the eviction itself moves at most one held block down the
+ * path and touches every level identically. */
+static void circuit_evict_once(oram_t *oram, uint64_t leaf_idx_plus_one) {
+    size_t deepest_plus_one[oram->depth + 1];
+    size_t deepest_block_idx[oram->depth + 1];
+    size_t target_plus_one[oram->depth + 1];
+    bool has_empty[oram->depth + 1];
+    uint64_t start = stats_begin();
+
+    /* Prepare deepest. For each level, find the highest level above it
+     * holding a block that can be moved at least as deep as this level, as
+     * well as the block at this level that can be moved deepest. */
+    size_t src_plus_one = 0;
+    size_t goal = 0;
+    for (size_t level = 0; level <= oram->depth; level++) {
+        size_t level_reach = 0;
+        size_t level_block_idx = 0;
+        has_empty[level] = false;
+        for (size_t i = 0; i < circuit_get_level_size(oram, level); i++) {
+            struct oram_block_meta *block = circuit_get_meta(oram, level, i);
+            size_t reach = circuit_get_reach(oram, block, leaf_idx_plus_one);
+            bool cond = reach > level_reach;
+            o_setsize(&level_reach, reach, cond);
+            o_setsize(&level_block_idx, i, cond);
+            has_empty[level] |= !block->valid;
+        }
+        deepest_block_idx[level] = level_block_idx;
+
+        deepest_plus_one[level] = 0;
+        o_setsize(&deepest_plus_one[level], src_plus_one, goal >= level);
+        bool cond = level_reach > goal;
+        o_setsize(&goal, level_reach, cond);
+        o_setsize(&src_plus_one, level + 1, cond);
+    }
+
+    /* Prepare target. Walking up from the leaf, pick up the deepest block
+     * destined for each level with free space or that is itself being vacated,
+     * and record at its source level where it should be dropped. */
+    size_t dest_plus_one = 0;
+    src_plus_one = 0;
+    for (size_t level = oram->depth + 1; level-- > 0;) {
+        bool cond = level + 1 == src_plus_one;
+        target_plus_one[level] = 0;
+        o_setsize(&target_plus_one[level], dest_plus_one, cond);
+        o_setsize(&dest_plus_one, 0, cond);
+        o_setsize(&src_plus_one, 0, cond);
+
+        cond = ((!dest_plus_one & has_empty[level])
+                    | (target_plus_one[level] != 0))
+            & (deepest_plus_one[level] != 0);
+        o_setsize(&src_plus_one, deepest_plus_one[level], cond);
+        o_setsize(&dest_plus_one, level + 1, cond);
+    }
+
+    /* Evict, walking down from the stash. At each level, the held block is
+     * dropped if this is its target, the level's deepest block is picked up if
+     * the level has a target, and the dropped block is written into a free
+     * slot. */
+    struct oram_block_meta *hold = circuit_get_hold(oram);
+    unsigned char *hold_data = circuit_get_hold_data(oram);
+    struct oram_block_meta *towrite = circuit_get_towrite(oram);
+    unsigned char *towrite_data = circuit_get_towrite_data(oram);
+    size_t hold_dest_plus_one = 0;
+    hold->valid = false;
+    for (size_t level = 0; level <= oram->depth; level++) {
+        towrite->valid = false;
+        bool cond = hold->valid & (hold_dest_plus_one == level + 1);
+        o_copy_block(oram, towrite, towrite_data, hold, hold_data, cond);
+        hold->valid &= !cond;
+
+        bool take = target_plus_one[level] != 0;
+        for (size_t i = 0; i < circuit_get_level_size(oram, level); i++) {
+            struct oram_block_meta *block = circuit_get_meta(oram, level, i);
+            cond = take & (i == deepest_block_idx[level]);
+            o_copy_block(oram, hold, hold_data, block,
+                    circuit_get_data(oram, level, i), cond);
+            block->valid &= !cond;
+        }
+        o_setsize(&hold_dest_plus_one, target_plus_one[level], take);
+
+        bool written = !towrite->valid;
+        for (size_t i = 0; i < circuit_get_level_size(oram, level); i++) {
+            struct oram_block_meta *block = circuit_get_meta(oram, level, i);
+            cond = !written & !block->valid;
+            o_copy_block(oram, block, circuit_get_data(oram, level, i),
+                    towrite, towrite_data, cond);
+            written |= cond;
+        }
+    }
+    stats_end(oram, ORAM_PHASE_EVICT, start);
+}
+
+static int circuit_access(oram_t *oram, uint64_t block_id, uint64_t leaf_id,
+        void (*op)(void *block_data, bool cond, void *aux), void *aux,
+        bool create, uint64_t new_leaf_id, bool is_real_access,
+        uint64_t (*rand_func)(void)) {
+    /* Check that the stash has a free slot for the block before changing
+     * anything, so that a block is never taken out of the tree without a
+     * place to put it, unless the block is in the stash already. An access
+     * that would overflow the stash is performed as a dummy access, whose
+     * evictions drain the stash, and then fails. */
+    size_t free_count = 0;
+    bool in_stash = false;
+    for (size_t i = 0; i < oram->stash_size; i++) {
+        struct oram_block_meta *block = circuit_get_meta(oram, 0, i);
+        free_count += !block->valid;
+        in_stash |= block->valid & (block->id == block_id);
+    }
+    bool overflowed = is_real_access & !free_count & !in_stash;
+    is_real_access &= !overflowed;
+
+    /* If this is a dummy access, choose a random leaf ID. */
+    o_set64(&leaf_id, rand_func() % (1u << (oram->depth - 1)), !is_real_access);
+
+    if (leaf_id >= 1u << (oram->depth - 1)) {
+        /* Obliviousness violation - invalid leaf ID. */
+        goto exit;
+    }
+
+    /* Read the path and obliviously remove the block from the path or the
+     * stash into the held block. */
+    uint64_t leaf_idx_plus_one = leaf_id + (1u << (oram->depth - 1));
+    circuit_read_path(oram, leaf_idx_plus_one);
+
+    uint64_t start = stats_begin();
+    struct oram_block_meta *hold = circuit_get_hold(oram);
+    unsigned char *hold_data = circuit_get_hold_data(oram);
+    hold->valid = false;
+    bool accessed = false;
+    for (size_t level = 0; level <= oram->depth; level++) {
+        for (size_t i = 0; i < circuit_get_level_size(oram, level); i++) {
+            struct oram_block_meta *block = circuit_get_meta(oram, level, i);
+            bool cond = (block->id == block_id) & block->valid
+                & is_real_access;
+            o_copy_block(oram, hold, hold_data, block,
+                    circuit_get_data(oram, level, i), cond);
+            block->valid &= !cond;
+            accessed |= cond;
+        }
+    }
+    stats_end(oram, ORAM_PHASE_SCAN, start);
+
+    circuit_write_path(oram, leaf_idx_plus_one);
+
+    /* Apply OP to the block, which is created zeroed if CREATE is set and this
+     * is a new block ID, and assign it the new leaf. */
+    bool cond = is_real_access & (accessed | create);
+    o_memset(hold_data, '\0', oram->block_size, !accessed);
+    op(hold_data, cond, aux);
+    hold->valid = cond;
+    hold->id = block_id;
+    hold->leaf_idx_plus_one = new_leaf_id + (1u << (oram->depth - 1));
+    accessed |= cond;
+
+    /* Insert the block into the first free slot in the stash. */
+    start = stats_begin();
+    bool inserted = !hold->valid;
+    for (size_t i = 0; i < oram->stash_size; i++) {
+        struct oram_block_meta *block = circuit_get_meta(oram, 0, i);
+        cond = !inserted & !block->valid;
+        o_copy_block(oram, block, circuit_get_data(oram, 0, i), hold,
+                hold_data, cond);
+        inserted |= cond;
+    }
+    stats_end(oram, ORAM_PHASE_SCAN, start);
+
+    /* Evict along the next two paths in reverse-lexicographic order. */
+    for (size_t i = 0; i < 2; i++) {
+        uint64_t evict_leaf_idx_plus_one = get_evict_leaf_idx_plus_one(oram);
+        circuit_read_path(oram, evict_leaf_idx_plus_one);
+        circuit_evict_once(oram, evict_leaf_idx_plus_one);
+        circuit_write_path(oram, evict_leaf_idx_plus_one);
+    }
+
+    if (overflowed) {
+        /* Obliviousness violation - stash overflowed. */
+        goto exit;
+    }
+
+    if (!accessed & is_real_access) {
+        goto exit;
+    }
+
+    return 0;
+
+exit:
+    return -1;
+}
+
+/* Ring ORAM. Evictions reuse the Path ORAM stash layout, with the blocks
+ * accessed since the last eviction kept at the start of the transient region,
+ * followed by the space for the path. */
+
+struct ring_shuffle_key {
+    uint64_t tag;
+    uint32_t slot_idx;
+};
+
+static int ring_shuffle_comparator(const void *a_, const void *b_,
+        void *aux UNUSED) {
+    const struct ring_shuffle_key *a = a_;
+    const struct ring_shuffle_key *b = b_;
+    return (a->tag > b->tag) - (a->tag < b->tag);
+}
+
+/* Helper function to return a pointer to the data of a block of the bucket
+ * being reshuffled. */
+static unsigned char *ring_get_data(oram_t *oram, size_t block_idx) {
+    return oram->path_data + block_idx * oram->block_size;
+}
+
+/* Sorts the bucket in the path buffer by the tags in KEYS, moving the metadata
+ * and data along with them. */
+static void ring_sort_bucket(oram_t *oram, struct ring_shuffle_key *keys) {
+    uint64_t start = stats_begin();
+    void *columns[] = { oram->path_metas, oram->path_data };
+    size_t column_sizes[] = { sizeof(*oram->path_metas), oram->block_size };
+    o_sort_columns(keys, oram->slots_per_bucket, sizeof(*keys), columns,
+            column_sizes, 2, ring_shuffle_comparator, NULL);
+    stats_end(oram, ORAM_PHASE_SORT, start);
+}
+
+/* Writes the bucket in the path buffer, whose first oram->blocks_per_bucket
+ * slots hold its blocks, to the bucket at BUCKET_IDX with its slots in a fresh
+ * random order, and resets the bucket's metadata. The shuffle is an oblivious
+ * sort on random tags, so the positions of the real slots are hidden. */
+static void ring_write_bucket(oram_t *oram, size_t bucket_idx,
+        uint64_t (*rand_func)(void)) {
+    struct ring_shuffle_key keys[oram->slots_per_bucket];
+    for (size_t i = 0; i < oram->slots_per_bucket; i++) {
+        keys[i].tag = rand_func();
+        keys[i].slot_idx = i;
+    }
+    for (size_t i = oram->blocks_per_bucket; i < oram->slots_per_bucket; i++) {
+        oram->path_metas[i].valid = false;
+    }
+
+    ring_sort_bucket(oram, keys);
+
+    write_whole_bucket(oram, bucket_idx, oram->path_metas, oram->path_data);
+    for (size_t i = 0; i < oram->slots_per_bucket; i++) {
+        oram->ring_slot_idxs[bucket_idx * oram->slots_per_bucket + i] =
+            keys[i].slot_idx;
+    }
+    oram->ring_buckets[bucket_idx].count = 0;
+    oram->ring_buckets[bucket_idx].next_dummy = 0;
+}
+
+static bool ring_is_valid(size_t index, void *oram_) {
+    oram_t *oram = oram_;
+    return oram->path_metas[index].valid;
+}
+
+static void ring_swap(size_t a, size_t b, bool should_swap, void *oram_) {
+    oram_t *oram = oram_;
+    o_memswap(&oram->path_metas[a], &oram->path_metas[b],
+            sizeof(*oram->path_metas), should_swap);
+    o_memswap(ring_get_data(oram, a), ring_get_data(oram, b),
+            oram->block_size, should_swap);
+}
+
+/* Reshuffles the bucket at BUCKET_IDX once all of its dummies have been read,
+ * moving its remaining blocks into the real slots by compacting valid blocks
+ * to the front. */
+static void ring_reshuffle_bucket(oram_t *oram, size_t bucket_idx,
+        uint64_t (*rand_func)(void)) {
+    read_whole_bucket(oram, bucket_idx, oram->path_metas, oram->path_data);
+    uint64_t start = stats_begin();
+    o_compact_generate_swaps(oram->slots_per_bucket, ring_is_valid, ring_swap,
+            oram);
+    stats_end(oram, ORAM_PHASE_SORT, start);
+    ring_write_bucket(oram, bucket_idx, rand_func);
+}
+
+/* Evicts along the next path in reverse-lexicographic order, reading every
+ * slot of its buckets into the stash and writing them back reshuffled. */
+static void ring_evict_path(oram_t *oram, uint64_t (*rand_func)(void)) {
+    size_t path_size = oram->depth * oram->blocks_per_bucket;
+    size_t transient_idx = oram->stash_size - get_stash_transient_size(oram);
+    uint64_t leaf_idx_plus_one = get_evict_leaf_idx_plus_one(oram);
+
+    path_read_path(oram, leaf_idx_plus_one, transient_idx + oram->evict_rate);
+    path_prepare_eviction(oram, leaf_idx_plus_one);
+
+    size_t stash_idx = oram->stash_size - path_size;
+    for (uint64_t bucket_idx_plus_one = leaf_idx_plus_one; bucket_idx_plus_one;
+            bucket_idx_plus_one >>= 1) {
+        for (size_t i = 0; i < oram->blocks_per_bucket; i++) {
+            oram->path_metas[i] = get_stash_meta(oram, stash_idx)->block;
+            memcpy(ring_get_data(oram, i), get_stash_data(oram, stash_idx),
+                    oram->block_size);
+            get_stash_meta(oram, stash_idx)->block.valid = false;
+            stash_idx++;
+        }
+        ring_write_bucket(oram, bucket_idx_plus_one - 1, rand_func);
+    }
+}
+
+static int ring_access(oram_t *oram, uint64_t block_id, uint64_t leaf_id,
+        void (*op)(void *block_data, bool cond, void *aux), void *aux,
+        bool create, uint64_t new_leaf_id, bool is_real_access,
+        uint64_t (*rand_func)(void)) {
+    size_t transient_idx = oram->stash_size - get_stash_transient_size(oram);
+    size_t accessed_idx = transient_idx + oram->round;
+    struct oram_block_meta metas[oram->slots_per_bucket];
+
+    /* If this is a dummy access, choose a random leaf ID. */
+    o_set64(&leaf_id, rand_func() % (1u << (oram->depth - 1)), !is_real_access);
+
+    if (leaf_id >= 1u << (oram->depth - 1)) {
+        /* Obliviousness violation - invalid leaf ID. */
+        goto exit;
+    }
+
+    /* The persistent blocks are packed at the front of the stash after each
+     * eviction, so it is sufficient to check that the first transient slot is
+     * a dummy. */
+    if (!oram->round && get_stash_meta(oram, transient_idx)->block.valid) {
+        /* Obliviousness violation - stash overflowed. */
+        goto exit;
+    }
+
+    /* Read one slot from each bucket on the path into the next transient slot
+     * of the stash: the block, if it is in the bucket, or else the next dummy
+     * slot in the bucket's shuffled order. Only the metadata is scanned, so
+     * each bucket costs one block read, with the path buffer holding the block
+     * read. */
+    uint64_t leaf_idx_plus_one = leaf_id + (1u << (oram->depth - 1));
+    struct oram_block_meta *accessed_meta =
+        &get_stash_meta(oram, accessed_idx)->block;
+    unsigned char *accessed_data = get_stash_data(oram, accessed_idx);
+    accessed_meta->valid = false;
+    bool accessed = false;
+    for (uint64_t bucket_idx_plus_one = leaf_idx_plus_one; bucket_idx_plus_one;
+            bucket_idx_plus_one >>= 1) {
+        size_t bucket_idx = bucket_idx_plus_one - 1;
+        struct oram_ring_bucket *bucket = &oram->ring_buckets[bucket_idx];
+        uint32_t *slot_idxs =
+            &oram->ring_slot_idxs[bucket_idx * oram->slots_per_bucket];
+        size_t dummy_slot_idx = oram->blocks_per_bucket + bucket->next_dummy;
+        size_t read_idx = 0;
+        size_t real_idx = 0;
+        bool found = false;
+        read_bucket_metas(oram, bucket_idx, 0, oram->slots_per_bucket, metas);
+        for (size_t i = 0; i < oram->slots_per_bucket; i++) {
+            struct oram_block_meta *block = &metas[i];
+            bool cond = (block->id == block_id) & block->valid
+                & is_real_access;
+            o_setsize(&real_idx, i, cond);
+            found |= cond;
+            o_setsize(&read_idx, i, slot_idxs[i] == dummy_slot_idx);
+        }
+        o_setsize(&read_idx, real_idx, found);
+        bucket->next_dummy += !found;
+        bucket->count++;
+
+        struct oram_block_meta *block = &metas[read_idx];
+        read_bucket_data(oram, bucket_idx, read_idx, 1, oram->path_data);
+        o_copy_block(oram, accessed_meta, accessed_data, block,
+                oram->path_data, found);
+        block->valid &= !found;
+        write_bucket_metas(oram, bucket_idx, read_idx, 1, block);
+        accessed |= found;
+    }
+
+    /* Obliviously remove the block from the stash if it is there instead. */
+    uint64_t start = stats_begin();
+    for (size_t i = 0; i < accessed_idx; i++) {
+        struct oram_block_meta *block = &get_stash_meta(oram, i)->block;
+        bool cond = (block->id == block_id) & block->valid & is_real_access;
+        o_copy_block(oram, accessed_meta, accessed_data, block,
+                get_stash_data(oram, i), cond);
+        block->valid &= !cond;
+        accessed |= cond;
+    }
+
+    /* Apply OP to the block, which is created zeroed if CREATE is set and this
+     * is a new block ID, and assign it the new leaf. */
+    bool cond = is_real_access & (accessed | create);
+    o_memset(accessed_data, '\0', oram->block_size, !accessed);
+    op(accessed_data, cond, aux);
+    accessed_meta->valid = cond;
+    accessed_meta->id = block_id;
+    accessed_meta->leaf_idx_plus_one =
+        new_leaf_id + (1u << (oram->depth - 1));
+    accessed |= cond;
+    stats_end(oram, ORAM_PHASE_SCAN, start);
+
+    /* Reshuffle the buckets whose dummies have all been read. This only
+     * depends on the public read counts. */
+    for (uint64_t bucket_idx_plus_one = leaf_idx_plus_one; bucket_idx_plus_one;
+            bucket_idx_plus_one >>= 1) {
+        if (oram->ring_buckets[bucket_idx_plus_one - 1].count
+                >= oram->dummies_per_bucket) {
+            ring_reshuffle_bucket(oram, bucket_idx_plus_one - 1, rand_func);
+        }
+    }
+
+    oram->round++;
+    if (oram->round == oram->evict_rate) {
+        oram->round = 0;
+        ring_evict_path(oram, rand_func);
+    }
+
+    if (!accessed & is_real_access) {
+        goto exit;
+    }
+
+    return 0;
+
+exit:
+    return -1;
+}
+
+/* Accesses the block with BLOCK_ID on the path to LEAF_ID, applying OP to its
+ * data, and moves it to NEW_LEAF_ID. The access fails if the storage has ever
+ * failed, since the tree may no longer hold every block. */
+static int access_op(oram_t *oram, uint64_t block_id, uint64_t leaf_id,
+        void (*op)(void *block_data, bool cond, void *aux), void *aux,
+        bool create, uint64_t new_leaf_id, bool is_real_access,
+        uint64_t (*rand_func)(void)) {
+    int ret = -1;
+    switch (oram->type) {
+        case ORAM_TYPE_PATH:
+            ret = path_access(oram, block_id, leaf_id, op, aux, create,
+                    new_leaf_id, is_real_access, rand_func);
+            break;
+        case ORAM_TYPE_CIRCUIT:
+            ret = circuit_access(oram, block_id, leaf_id, op, aux, create,
+                    new_leaf_id, is_real_access, rand_func);
+            break;
+        case ORAM_TYPE_RING:
+            ret = ring_access(oram, block_id, leaf_id, op, aux, create,
+                    new_leaf_id, is_real_access, rand_func);
+            break;
+    }
+    if (oram->storage_error) {
+        ret = -1;
+    }
+    stats_record_access(oram, 1, ret);
+    return ret;
+}
+
+struct memaccess_aux {
+    void *data;
+    size_t size;
+    bool write;
+};
+
+static void memaccess_op(void *block_data, bool cond, void *aux_) {
+    struct memaccess_aux *aux = aux_;
+    o_memaccess(aux->data, block_data, aux->size, aux->write, cond);
+}
+
+int oram_access(oram_t *oram, uint64_t block_id, uint64_t leaf_id, void *data,
+        bool write, uint64_t *new_leaf_id, bool is_real_access,
+        uint64_t (*rand_func)(void)) {
+    struct memaccess_aux aux = {
+        .data = data,
+        .size = oram->block_size,
+        .write = write,
+    };
+    uint64_t leaf = rand_func() % (1u << (oram->depth - 1));
+    if (access_op(oram, block_id, leaf_id, memaccess_op, &aux, write, leaf,
+                is_real_access, rand_func)) {
+        /* Leave the caller's leaf, where the block still is. */
+        return -1;
+    }
+    o_set64(new_leaf_id, leaf, is_real_access);
+    return 0;
+}
+
+/* Copies the new leaf ID of the last real request for each block ID to the
+ * earlier real requests for the same block ID, since the block ends up on the
+ * last request's leaf. */
+static void batch_propagate_new_leaf_ids(size_t num_requests,
+        const uint64_t *block_ids, const bool *is_real_accesses,
+        uint64_t *new_leaf_ids) {
+    for (size_t j = 0; j < num_requests; j++) {
+        for (size_t k = j + 1; k < num_requests; k++) {
+            bool cond = (block_ids[j] == block_ids[k]) & is_real_accesses[j]
+                & is_real_accesses[k];
+            o_set64(&new_leaf_ids[j], new_leaf_ids[k], cond);
+        }
+    }
+}
+
+int oram_access_batch(oram_t *oram, size_t num_requests,
+        const uint64_t *block_ids, const uint64_t *leaf_ids, void *data_,
+        const bool *writes, uint64_t *new_leaf_ids,
+        const bool *is_real_accesses, uint64_t (*rand_func)(void)) {
+    unsigned char *data = data_;
+    int ret = 0;
+
+    if (!num_requests) {
+        return 0;
+    }
+
+    if (oram->type == ORAM_TYPE_PATH) {
+        ret = path_access_batch(oram, num_requests, block_ids, leaf_ids, data,
+                writes, new_leaf_ids, is_real_accesses, rand_func);
+        if (oram->storage_error) {
+            ret = -1;
+        }
+        stats_record_access(oram, num_requests, ret);
+        if (!ret) {
+            batch_propagate_new_leaf_ids(num_requests, block_ids,
+                    is_real_accesses, new_leaf_ids);
+        }
+        return ret;
+    }
+
+    /* Circuit and Ring ORAM already evict only O(log N) blocks per access, so
+     * the requests are served one at a time, after validating every leaf ID.
+     * A request for a block that an earlier request has accessed looks it up
+     * on the earlier request's new leaf. */
+    for (size_t j = 0; j < num_requests; j++) {
+        if (is_real_accesses[j] & (leaf_ids[j] >= 1u << (oram->depth - 1))) {
+            /* Obliviousness violation - invalid leaf ID. */
+            return -1;
+        }
+    }
+    for (size_t j = 0; j < num_requests; j++) {
+        uint64_t leaf_id = leaf_ids[j];
+        for (size_t k = 0; k < j; k++) {
+            bool cond = (block_ids[j] == block_ids[k]) & is_real_accesses[j]
+                & is_real_accesses[k];
+            o_set64(&leaf_id, new_leaf_ids[k], cond);
+        }
+        if (oram_access(oram, block_ids[j], leaf_id,
+                    data + j * oram->block_size, writes[j], &new_leaf_ids[j],
+                    is_real_accesses[j], rand_func)) {
+            ret = -1;
+        }
+    }
+    batch_propagate_new_leaf_ids(num_requests, block_ids, is_real_accesses,
+            new_leaf_ids);
+    return ret;
+}
+
+/* Position map. Each entry holds a leaf ID plus one, with 0 meaning that the
+ * block has not been assigned a leaf. */
+
+struct posmap_update_aux {
+    size_t offset;
+    uint32_t new_leaf_plus_one;
+    uint32_t old_leaf_plus_one;
+    size_t entries_per_block;
+};
+
+static void posmap_update_op(void *block_data, bool cond, void *aux_) {
+    struct posmap_update_aux *aux = aux_;
+    uint32_t *entries = block_data;
+    for (size_t i = 0; i < aux->entries_per_block; i++) {
+        bool entry_cond = cond & (i == aux->offset);
+        o_set32(&aux->old_leaf_plus_one, entries[i], entry_cond);
+        o_set32(&entries[i], aux->new_leaf_plus_one, entry_cond);
+    }
+}
+
+static int oram_update(oram_t *oram, uint64_t block_id,
+        void (*op)(void *block_data, bool cond, void *aux), void *aux,
+        bool create, bool is_real_access, uint64_t (*rand_func)(void));
+
+/* Sets the entry for BLOCK_ID to NEW_LEAF_PLUS_ONE and writes the previous
+ * entry to OLD_LEAF_PLUS_ONE, either by a linear scan of the client-side map or
+ * through the position map ORAM. */
+static int posmap_update(oram_t *oram, uint64_t block_id,
+        uint32_t new_leaf_plus_one, uint32_t *old_leaf_plus_one,
+        bool is_real_access, uint64_t (*rand_func)(void)) {
+    if (!oram->posmap) {
+        *old_leaf_plus_one = 0;
+        for (size_t i = 0; i < oram->num_blocks; i++) {
+            bool cond = (i == block_id) & is_real_access;
+            o_set32(old_leaf_plus_one, oram->posmap_leaves[i], cond);
+            o_set32(&oram->posmap_leaves[i], new_leaf_plus_one, cond);
+        }
+        return 0;
+    }
+
+    struct posmap_update_aux aux = {
+        .offset = block_id % oram->posmap_entries_per_block,
+        .new_leaf_plus_one = new_leaf_plus_one,
+        .old_leaf_plus_one = 0,
+        .entries_per_block = oram->posmap_entries_per_block,
+    };
+    if (oram_update(oram->posmap, block_id / oram->posmap_entries_per_block,
+                posmap_update_op, &aux, true, is_real_access, rand_func)) {
+        return -1;
+    }
+    *old_leaf_plus_one = aux.old_leaf_plus_one;
+    return 0;
+}
+
+/* Looks up and remaps BLOCK_ID in the position map and then applies OP to the
+ * block. Blocks without a leaf are looked up on a random path. If the access
+ * fails, the entry is restored, since the block stays on its old leaf. */
+static int oram_update(oram_t *oram, uint64_t block_id,
+        void (*op)(void *block_data, bool cond, void *aux), void *aux,
+        bool create, bool is_real_access, uint64_t (*rand_func)(void)) {
+    if ((!oram->posmap && !oram->posmap_leaves)
+            || block_id >= oram->num_blocks) {
+        return -1;
+    }
+
+    uint64_t new_leaf_id = rand_func() % (1u << (oram->depth - 1));
+    uint32_t leaf_plus_one;
+    if (posmap_update(oram, block_id, new_leaf_id + 1, &leaf_plus_one,
+                is_real_access, rand_func)) {
+        return -1;
+    }
+
+    uint64_t leaf_id = leaf_plus_one - 1;
+    o_set64(&leaf_id, rand_func() % (1u << (oram->depth - 1)),
+            !leaf_plus_one);
+    if (access_op(oram, block_id, leaf_id, op, aux, create, new_leaf_id,
+                is_real_access, rand_func)) {
+        /* The block was not moved, so point its entry back at its old leaf.
+         * Only the failure, which is already visible, is leaked. */
+        uint32_t new_leaf_plus_one;
+        posmap_update(oram, block_id, leaf_plus_one, &new_leaf_plus_one,
+                is_real_access, rand_func);
+        return -1;
+    }
+    return 0;
+}
+
+int oram_read(oram_t *oram, uint64_t block_id, void *data, bool is_real_access,
+        uint64_t (*rand_func)(void)) {
+    struct memaccess_aux aux = {
+        .data = data,
+        .size = oram->block_size,
+        .write = false,
+    };
+    /* Blocks that have never been written are created zeroed, so that reads
+     * always succeed without revealing whether the block existed. */
+    return oram_update(oram, block_id, memaccess_op, &aux, true,
+            is_real_access, rand_func);
+}
+
+int oram_write(oram_t *oram, uint64_t block_id, const void *data,
+        bool is_real_access, uint64_t (*rand_func)(void)) {
+    /* The data is only read from for writes. */
+    struct memaccess_aux aux = {
+        .data = (void *) data,
+        .size = oram->block_size,
+        .write = true,
+    };
+    return oram_update(oram, block_id, memaccess_op, &aux, true,
+            is_real_access, rand_func);
+}
+
+/* Bulk initialization. The blocks are assigned to slots of the tree with a
+ * sort and a few scans of their metadata, and the data is then moved into
+ * place with one sort of the blocks and one expansion, so that every block is
+ * moved O(log^2 N) times in total rather than accessed individually. */
+
+/* Marks a block that did not fit in the tree and goes to the stash. */
+#define BULK_TARGET_STASH UINT64_MAX
+
+struct bulk_key {
+    uint64_t leaf_idx_plus_one;
+    uint64_t id;
+    uint64_t target;        /* The slot to place the block in, as
+                               bucket_idx * blocks_per_bucket + slot_idx, or
+                               BULK_TARGET_STASH. */
+    bool placed;
+};
+
+struct bulk_row {
+    uint64_t target;        /* The index of the row to move the block to. */
+    uint64_t distance;      /* The distance left to move the block by. */
+    struct oram_block_meta block;
+};
+
+static int bulk_leaf_comparator(const void *a_, const void *b_,
+        void *aux UNUSED) {
+    const struct bulk_key *a = a_;
+    const struct bulk_key *b = b_;
+    return (a->leaf_idx_plus_one > b->leaf_idx_plus_one)
+        - (a->leaf_idx_plus_one < b->leaf_idx_plus_one);
+}
+
+static int bulk_id_comparator(const void *a_, const void *b_,
+        void *aux UNUSED) {
+    const struct bulk_key *a = a_;
+    const struct bulk_key *b = b_;
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+static int bulk_target_comparator(const void *a_, const void *b_,
+        void *aux UNUSED) {
+    const struct bulk_row *a = a_;
+    const struct bulk_row *b = b_;
+    return (a->target > b->target) - (a->target < b->target);
+}
+
+/* Assigns every block in KEYS, which must be sorted by leaf, to the deepest
+ * bucket on its path with a free slot, filling the tree from the leaves up.
+ * Each level is one scan, since the blocks of a bucket are contiguous in leaf
+ * order. Blocks left over are assigned to the stash. */
+static void bulk_assign_slots(oram_t *oram, struct bulk_key *keys) {
+    for (size_t i = 0; i < oram->num_blocks; i++) {
+        keys[i].target = BULK_TARGET_STASH;
+        keys[i].placed = false;
+    }
+    for (size_t level = 0; level < oram->depth; level++) {
+        uint64_t prev_bucket_idx_plus_one = 0;
+        size_t bucket_fullness = 0;
+        for (size_t i = 0; i < oram->num_blocks; i++) {
+            uint64_t bucket_idx_plus_one = keys[i].leaf_idx_plus_one >> level;
+            o_setsize(&bucket_fullness, 0,
+                    bucket_idx_plus_one != prev_bucket_idx_plus_one);
+            bool cond = !keys[i].placed
+                & (bucket_fullness < oram->blocks_per_bucket);
+            o_set64(&keys[i].target,
+                    (bucket_idx_plus_one - 1) * oram->blocks_per_bucket
+                        + bucket_fullness,
+                    cond);
+            o_setsize(&bucket_fullness, bucket_fullness + 1, cond);
+            keys[i].placed |= cond;
+            prev_bucket_idx_plus_one = bucket_idx_plus_one;
+        }
+    }
+}
+
+/* Moves the first NUM_BLOCKS rows, which must be sorted by target, forward to
+ * their targets among the NUM_ROWS rows, the rest of which must be invalid.
+ * The distances are non-decreasing, so moving every block by the bits of its
+ * distance from the highest to the lowest never lands two blocks in the same
+ * row, and each bit is one pass of conditional swaps. */
+static void bulk_expand(oram_t *oram, struct bulk_row *rows,
+        unsigned char *data, size_t num_blocks, size_t num_rows) {
+    for (size_t i = 0; i < num_blocks; i++) {
+        rows[i].distance = rows[i].target - i;
+    }
+    size_t step = 1;
+    while (step * 2 < num_rows) {
+        step *= 2;
+    }
+    for (; step; step /= 2) {
+        /* Go from the end so that a block only moves into a row that has
+         * already been vacated. */
+        for (size_t i = num_rows - MIN(step, num_rows); i-- > 0;) {
+            bool cond = rows[i].block.valid & !!(rows[i].distance & step);
+            o_memswap(&rows[i], &rows[i + step], sizeof(*rows), cond);
+            o_memswap(data + i * oram->block_size,
+                    data + (i + step) * oram->block_size, oram->block_size,
+                    cond);
+        }
+    }
+}
+
+/* Writes the blocks in the first num_buckets * oram->blocks_per_bucket ROWS
+ * and DATA to the buckets in heap order. */
+static void bulk_write_buckets(oram_t *oram, const struct bulk_row *rows,
+        const unsigned char *data, uint64_t (*rand_func)(void)) {
+    struct oram_block_meta metas[oram->blocks_per_bucket];
+    size_t num_buckets = (1u << oram->depth) - 1;
+    for (size_t j = 0; j < num_buckets; j++) {
+        const struct bulk_row *bucket_rows = &rows[j * oram->blocks_per_bucket];
+        const unsigned char *bucket_data =
+            data + j * oram->blocks_per_bucket * oram->block_size;
+        if (oram->type == ORAM_TYPE_RING) {
+            for (size_t i = 0; i < oram->blocks_per_bucket; i++) {
+                oram->path_metas[i] = bucket_rows[i].block;
+            }
+            memcpy(oram->path_data, bucket_data,
+                    oram->blocks_per_bucket * oram->block_size);
+            ring_write_bucket(oram, j, rand_func);
+        } else {
+            for (size_t i = 0; i < oram->blocks_per_bucket; i++) {
+                metas[i] = bucket_rows[i].block;
+            }
+            write_whole_bucket(oram, j, metas, bucket_data);
+        }
+    }
+}
+
+/* Sets up the position map of the bulk-initialized ORAM from KEYS, which must
+ * be sorted by ID, writing the recursive position map's blocks in bulk as
+ * well. */
+static int bulk_init_posmap(oram_t *oram, const struct oram_config *config,
+        const struct bulk_key *keys, uint64_t (*rand_func)(void)) {
+    uint64_t first_leaf_idx_plus_one = 1u << (oram->depth - 1);
+    size_t posmap_block_size;
+    size_t posmap_cutoff;
+    get_posmap_params(config, &posmap_block_size, &posmap_cutoff);
+    oram->posmap_entries_per_block = posmap_block_size / sizeof(uint32_t);
+    if (oram->posmap_entries_per_block < 2) {
+        goto exit;
+    }
+
+    if (oram->num_blocks <= posmap_cutoff) {
+        oram->posmap_leaves =
+            oram_allocate(oram->allocator, get_posmap_leaves_size(oram));
+        if (!oram->posmap_leaves) {
+            /* Obliviousness violation - out of memory. */
+            goto exit;
+        }
+        for (size_t i = 0; i < oram->num_blocks; i++) {
+            oram->posmap_leaves[i] =
+                keys[i].leaf_idx_plus_one - first_leaf_idx_plus_one + 1;
+        }
+        return 0;
+    }
+
+    struct oram_config posmap_config = *config;
+    posmap_config.block_size = posmap_block_size;
+    posmap_config.storage = NULL;
+    posmap_config.num_blocks =
+        CEIL_DIV(oram->num_blocks, oram->posmap_entries_per_block);
+    unsigned char *entries =
+        calloc(posmap_config.num_blocks, posmap_block_size);
+    if (!entries) {
+        /* Obliviousness violation - out of memory. */
+        goto exit;
+    }
+    for (size_t i = 0; i < oram->num_blocks; i++) {
+        uint32_t leaf_plus_one =
+            keys[i].leaf_idx_plus_one - first_leaf_idx_plus_one + 1;
+        memcpy(entries + i / oram->posmap_entries_per_block * posmap_block_size
+                    + i % oram->posmap_entries_per_block
+                        * sizeof(leaf_plus_one),
+                &leaf_plus_one, sizeof(leaf_plus_one));
+    }
+    oram->posmap = malloc(sizeof(*oram->posmap));
+    if (!oram->posmap) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_free_entries;
+    }
+    if (oram_init_from_blocks(oram->posmap, &posmap_config, entries, NULL,
+                rand_func)) {
+        goto exit_free_posmap;
+    }
+    free(entries);
+    return 0;
+
+exit_free_posmap:
+    free(oram->posmap);
+    oram->posmap = NULL;
+exit_free_entries:
+    free(entries);
+exit:
+    return -1;
+}
+
+int oram_init_from_blocks(oram_t *oram, const struct oram_config *config,
+        const void *blocks, uint64_t *leaf_ids, uint64_t (*rand_func)(void)) {
+    struct oram_config tree_config = *config;
+    tree_config.position_map = false;
+    if (oram_init_config(oram, &tree_config)) {
+        goto exit;
+    }
+
+    size_t num_blocks = oram->num_blocks;
+    size_t num_buckets = (1u << oram->depth) - 1;
+    size_t tree_slots = num_buckets * oram->blocks_per_bucket;
+    size_t num_rows = tree_slots + num_blocks;
+    uint64_t first_leaf_idx_plus_one = 1u << (oram->depth - 1);
+    struct bulk_key *keys = malloc(MAX(num_blocks, 1) * sizeof(*keys));
+    if (!keys) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_destroy_oram;
+    }
+    struct bulk_row *rows = calloc(num_rows, sizeof(*rows));
+    if (!rows) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_free_keys;
+    }
+    unsigned char *data = calloc(num_rows, oram->block_size);
+    if (!data) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_free_rows;
+    }
+
+    /* Assign random leaves and then slots, and put the keys back in ID
+     * order. */
+    for (size_t i = 0; i < num_blocks; i++) {
+        keys[i].leaf_idx_plus_one =
+            first_leaf_idx_plus_one + rand_func() % first_leaf_idx_plus_one;
+        keys[i].id = i;
+    }
+    o_sort(keys, num_blocks, sizeof(*keys), bulk_leaf_comparator, NULL);
+    bulk_assign_slots(oram, keys);
+    o_sort(keys, num_blocks, sizeof(*keys), bulk_id_comparator, NULL);
+
+    /* Sort the blocks by target, giving the blocks for the stash, which come
+     * last, the rows after the tree's slots in order. */
+    size_t num_placed = 0;
+    for (size_t i = 0; i < num_blocks; i++) {
+        rows[i].target = keys[i].target;
+        rows[i].block.id = i;
+        rows[i].block.leaf_idx_plus_one = keys[i].leaf_idx_plus_one;
+        rows[i].block.valid = true;
+        num_placed += keys[i].placed;
+    }
+    memcpy(data, blocks, num_blocks * oram->block_size);
+    void *columns[] = { data };
+    size_t column_sizes[] = { oram->block_size };
+    o_sort_columns(rows, num_blocks, sizeof(*rows), columns, column_sizes, 1,
+            bulk_target_comparator, NULL);
+    for (size_t i = 0; i < num_blocks; i++) {
+        o_set64(&rows[i].target, tree_slots + i - num_placed,
+                rows[i].target == BULK_TARGET_STASH);
+    }
+    bulk_expand(oram, rows, data, num_blocks, num_rows);
+
+    bulk_write_buckets(oram, rows, data, rand_func);
+    if (oram->storage_error) {
+        goto exit_free_data;
+    }
+
+    /* Copy the remaining blocks to the persistent part of the stash. */
+    size_t persistent_size = oram->stash_size - get_stash_transient_size(oram);
+    bool overflow = false;
+    for (size_t i = 0; i < num_blocks; i++) {
+        const struct bulk_row *row = &rows[tree_slots + i];
+        if (i < persistent_size) {
+            get_stash_meta(oram, i)->block = row->block;
+            memcpy(get_stash_data(oram, i),
+                    data + (tree_slots + i) * oram->block_size,
+                    oram->block_size);
+        } else {
+            overflow |= row->block.valid;
+        }
+    }
+    if (overflow) {
+        /* Obliviousness violation - stash overflowed. */
+        goto exit_free_data;
+    }
+
+    if (leaf_ids) {
+        for (size_t i = 0; i < num_blocks; i++) {
+            leaf_ids[i] = keys[i].leaf_idx_plus_one - first_leaf_idx_plus_one;
+        }
+    }
+    if (config->position_map
+            && bulk_init_posmap(oram, config, keys, rand_func)) {
+        goto exit_free_data;
+    }
+
+    free(data);
+    free(rows);
+    free(keys);
+    return 0;
+
+exit_free_data:
+    free(data);
+exit_free_rows:
+    free(rows);
+exit_free_keys:
+    free(keys);
+exit_destroy_oram:
+    oram_destroy(oram);
+exit:
+    return -1;
+}
+
+int oram_get_stats(const oram_t *oram, struct oram_stats *stats) {
+#ifdef LIBOBLIVIOUS_ORAM_STATS
+    *stats = oram->stats;
+    return 0;
+#else
+    (void) oram;
+    (void) stats;
+    return -1;
+#endif
+}
+
+/* Snapshots. A snapshot is a header followed by sections at offsets that are
+ * multiples of ORAM_SNAPSHOT_ALIGNMENT, so that the tree section, which holds
+ * the buckets below the treetop in the storage's layout, can be mapped
+ * directly on load. The recursive position map, if any, is a nested snapshot
+ * in the last section. All values are in native byte order. */
+
+#define SNAPSHOT_MAGIC "LOBORAM"
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+enum snapshot_posmap {
+    SNAPSHOT_POSMAP_NONE,
+    SNAPSHOT_POSMAP_LEAVES,
+    SNAPSHOT_POSMAP_RECURSIVE,
+};
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t meta_size;
+    uint64_t stash_meta_size;
+
+    /* Parameters. */
+    uint64_t type;
+    uint64_t block_size;
+    uint64_t blocks_per_bucket;
+    uint64_t num_blocks;
+    uint64_t stash_size;
+    uint64_t dummies_per_bucket;
+    uint64_t evict_rate;
+    uint64_t subtree_levels;
+    uint64_t treetop_levels;
+    uint64_t depth;
+
+    /* State. */
+    uint64_t evict_counter;
+    uint64_t round;
+    uint64_t posmap;
+    uint64_t posmap_entries_per_block;
+
+    /* Section offsets, relative to the start of the snapshot. */
+    uint64_t treetop_offset;
+    uint64_t tree_offset;
+    uint64_t tree_size;
+    uint64_t stash_metas_offset;
+    uint64_t stash_data_offset;
+    uint64_t ring_buckets_offset;
+    uint64_t ring_slot_idxs_offset;
+    uint64_t posmap_offset;
+};
+
+static uint64_t snapshot_align(uint64_t offset) {
+    return CEIL_DIV(offset, ORAM_SNAPSHOT_ALIGNMENT) * ORAM_SNAPSHOT_ALIGNMENT;
+}
+
+/* Lays out the sections of a snapshot from the parameters in HEADER, setting
+ * its section offsets and tree size. Returns the end of the last section
+ * before the position map. */
+static uint64_t snapshot_lay_out(struct snapshot_header *header) {
+    uint64_t slots = header->blocks_per_bucket + header->dummies_per_bucket;
+    uint64_t bucket_size =
+        CEIL_DIV(slots * sizeof(struct oram_block_meta), ORAM_CACHE_LINE_SIZE)
+            * ORAM_CACHE_LINE_SIZE
+        + slots * header->block_size;
+    uint64_t num_buckets = ((uint64_t) 1 << header->depth) - 1;
+    uint64_t treetop_buckets = ((uint64_t) 1 << header->treetop_levels) - 1;
+    uint64_t stash_metas_size =
+        header->stash_size * sizeof(struct oram_stash_meta);
+    uint64_t stash_data_size = header->stash_size * header->block_size;
+    uint64_t ring_buckets_size = 0;
+    uint64_t ring_slot_idxs_size = 0;
+    if (header->type == ORAM_TYPE_RING) {
+        ring_buckets_size = num_buckets * sizeof(struct oram_ring_bucket);
+        ring_slot_idxs_size = num_buckets * slots * sizeof(uint32_t);
+    }
+    header->treetop_offset = snapshot_align(sizeof(*header));
+    header->tree_offset =
+        snapshot_align(header->treetop_offset + treetop_buckets * bucket_size);
+    header->tree_size = (num_buckets - treetop_buckets) * bucket_size;
+    header->stash_metas_offset =
+        snapshot_align(header->tree_offset + header->tree_size);
+    header->stash_data_offset =
+        snapshot_align(header->stash_metas_offset + stash_metas_size);
+    header->ring_buckets_offset =
+        snapshot_align(header->stash_data_offset + stash_data_size);
+    header->ring_slot_idxs_offset =
+        snapshot_align(header->ring_buckets_offset + ring_buckets_size);
+    header->posmap_offset =
+        snapshot_align(header->ring_slot_idxs_offset + ring_slot_idxs_size);
+    return header->ring_slot_idxs_offset + ring_slot_idxs_size;
+}
+
+/* Checks that HEADER, read from a snapshot with SIZE bytes from its start to
+ * the end of the file, holds parameters that oram_init_config accepts and
+ * sections that lie within the file where oram_save_fd would put them. Every
+ * factor of a section size is bounded by SIZE first so that the layout cannot
+ * overflow. */
+static int snapshot_check_header(const struct snapshot_header *header,
+        uint64_t size) {
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic))
+            || header->version != ORAM_SNAPSHOT_VERSION
+            || header->byte_order != SNAPSHOT_BYTE_ORDER
+            || header->meta_size != sizeof(struct oram_block_meta)
+            || header->stash_meta_size != sizeof(struct oram_stash_meta)) {
+        return -1;
+    }
+    switch (header->type) {
+        case ORAM_TYPE_PATH:
+        case ORAM_TYPE_CIRCUIT:
+            if (header->dummies_per_bucket || header->evict_rate) {
+                return -1;
+            }
+            break;
+        case ORAM_TYPE_RING:
+            if (!header->dummies_per_bucket || !header->evict_rate) {
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+    }
+    switch (header->posmap) {
+        case SNAPSHOT_POSMAP_NONE:
+            if (header->posmap_entries_per_block) {
+                return -1;
+            }
+            break;
+        case SNAPSHOT_POSMAP_LEAVES:
+        case SNAPSHOT_POSMAP_RECURSIVE:
+            if (header->posmap_entries_per_block < 2) {
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+    }
+    if (!header->block_size
+            || !header->blocks_per_bucket
+            || !header->subtree_levels
+            || header->depth < 1
+            || header->depth >= 32
+            || header->treetop_levels > header->depth) {
+        return -1;
+    }
+
+    uint64_t num_buckets = ((uint64_t) 1 << header->depth) - 1;
+    if (header->block_size > size
+            || header->blocks_per_bucket > size
+            || header->dummies_per_bucket > size
+            || header->blocks_per_bucket + header->dummies_per_bucket
+                > size / header->block_size
+            || num_buckets > size
+                / ((header->blocks_per_bucket + header->dummies_per_bucket)
+                    * header->block_size)
+            || header->stash_size > size / header->block_size
+            || header->num_blocks > num_buckets * header->blocks_per_bucket) {
+        return -1;
+    }
+
+    struct snapshot_header expected = *header;
+    uint64_t end = snapshot_lay_out(&expected);
+    if (header->treetop_offset != expected.treetop_offset
+            || header->tree_offset != expected.tree_offset
+            || header->tree_size != expected.tree_size
+            || header->stash_metas_offset != expected.stash_metas_offset
+            || header->stash_data_offset != expected.stash_data_offset
+            || header->ring_buckets_offset != expected.ring_buckets_offset
+            || header->ring_slot_idxs_offset != expected.ring_slot_idxs_offset
+            || header->posmap_offset != expected.posmap_offset
+            || end > size) {
+        return -1;
+    }
+    switch (header->posmap) {
+        case SNAPSHOT_POSMAP_NONE:
+            break;
+        case SNAPSHOT_POSMAP_LEAVES:
+            if (header->num_blocks
+                    && (header->posmap_offset > size
+                        || header->num_blocks * sizeof(uint32_t)
+                            > size - header->posmap_offset)) {
+                return -1;
+            }
+            break;
+        case SNAPSHOT_POSMAP_RECURSIVE:
+            if (header->posmap_offset > size
+                    || sizeof(*header) > size - header->posmap_offset) {
+                return -1;
+            }
+            break;
+    }
+    return 0;
+}
+
+/* Copies the tree section from the ORAM's storage to FILE at OFFSET, a chunk
+ * at a time. */
+static int snapshot_save_tree(oram_t *oram, struct oram_storage *file,
+        uint64_t offset, uint64_t size) {
+    size_t chunk_size = MAX(get_bucket_size(oram), ORAM_SNAPSHOT_ALIGNMENT);
+    unsigned char *chunk = malloc(chunk_size);
+    int ret = -1;
+    if (!chunk) {
+        goto exit;
+    }
+    for (uint64_t i = 0; i < size; i += chunk_size) {
+        size_t n = MIN(chunk_size, size - i);
+        if (oram->storage->read(oram->storage, i, chunk, n)
+                || file->write(file, offset + i, chunk, n)) {
+            goto exit_free_chunk;
+        }
+    }
+    ret = 0;
+exit_free_chunk:
+    free(chunk);
+exit:
+    return ret;
+}
+
+int oram_save_fd(oram_t *oram, int fd, uint64_t offset, uint64_t *size) {
+    struct oram_file_storage file;
+    struct snapshot_header header;
+    size_t num_buckets = (1u << oram->depth) - 1;
+
+    if (oram->storage_error) {
+        return -1;
+    }
+
+    oram_file_storage_init_fd(&file, fd);
+    memset(&header, '\0', sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = ORAM_SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.meta_size = sizeof(struct oram_block_meta);
+    header.stash_meta_size = sizeof(struct oram_stash_meta);
+    header.type = oram->type;
+    header.block_size = oram->block_size;
+    header.blocks_per_bucket = oram->blocks_per_bucket;
+    header.num_blocks = oram->num_blocks;
+    header.stash_size = oram->stash_size;
+    header.dummies_per_bucket = oram->dummies_per_bucket;
+    header.evict_rate = oram->evict_rate;
+    header.subtree_levels = oram->subtree_levels;
+    header.treetop_levels = oram->treetop_levels;
+    header.depth = oram->depth;
+    header.evict_counter = oram->evict_counter;
+    header.round = oram->round;
+    header.posmap = oram->posmap ? SNAPSHOT_POSMAP_RECURSIVE
+        : oram->posmap_leaves ? SNAPSHOT_POSMAP_LEAVES
+        : SNAPSHOT_POSMAP_NONE;
+    header.posmap_entries_per_block = oram->posmap_entries_per_block;
+
+    /* Lay out the sections. */
+    size_t treetop_size = get_treetop_buckets(oram) * get_bucket_size(oram);
+    size_t stash_metas_size = oram->stash_size * sizeof(*oram->stash_metas);
+    size_t stash_data_size = oram->stash_size * oram->block_size;
+    size_t ring_buckets_size =
+        oram->ring_buckets ? num_buckets * sizeof(*oram->ring_buckets) : 0;
+    size_t ring_slot_idxs_size = oram->ring_slot_idxs
+        ? num_buckets * oram->slots_per_bucket * sizeof(*oram->ring_slot_idxs)
+        : 0;
+    size_t posmap_leaves_size =
+        oram->posmap_leaves ? oram->num_blocks * sizeof(*oram->posmap_leaves)
+        : 0;
+    snapshot_lay_out(&header);
+
+    /* Write the sections, and the header last. */
+    struct oram_storage *f = &file.base;
+    if (f->write(f, offset + header.treetop_offset, oram->treetop,
+                treetop_size)
+            || snapshot_save_tree(oram, f, offset + header.tree_offset,
+                header.tree_size)
+            || f->write(f, offset + header.stash_metas_offset,
+                oram->stash_metas, stash_metas_size)
+            || f->write(f, offset + header.stash_data_offset, oram->stash_data,
+                stash_data_size)
+            || f->write(f, offset + header.ring_buckets_offset,
+                oram->ring_buckets, ring_buckets_size)
+            || f->write(f, offset + header.ring_slot_idxs_offset,
+                oram->ring_slot_idxs, ring_slot_idxs_size)
+            || f->write(f, offset + header.posmap_offset, oram->posmap_leaves,
+                posmap_leaves_size)) {
+        goto exit;
+    }
+    uint64_t posmap_size = posmap_leaves_size;
+    if (oram->posmap) {
+        if (oram_save_fd(oram->posmap, fd, offset + header.posmap_offset,
+                    &posmap_size)) {
+            goto exit;
+        }
+    }
+    if (f->write(f, offset, &header, sizeof(header))) {
+        goto exit;
+    }
+
+    *size = header.posmap_offset + posmap_size;
+    return 0;
+
+exit:
+    return -1;
+}
+
+/* Copies the tree section at OFFSET in FILE to the ORAM's storage, a chunk at a
+ * time. */
+static int snapshot_load_tree(oram_t *oram, struct oram_storage *file,
+        uint64_t offset, uint64_t size) {
+    size_t chunk_size = MAX(get_bucket_size(oram), ORAM_SNAPSHOT_ALIGNMENT);
+    unsigned char *chunk = malloc(chunk_size);
+    int ret = -1;
+    if (!chunk) {
+        goto exit;
+    }
+    for (uint64_t i = 0; i < size; i += chunk_size) {
+        size_t n = MIN(chunk_size, size - i);
+        if (file->read(file, offset + i, chunk, n)
+                || oram->storage->write(oram->storage, i, chunk, n)) {
+            goto exit_free_chunk;
+        }
+    }
+    ret = 0;
+exit_free_chunk:
+    free(chunk);
+exit:
+    return ret;
+}
+
+/* Storage for oram_load_fd to initialize the ORAM with, which skips allocating
+ * the tree, since it is loaded from the snapshot. */
+static int deferred_allocate(struct oram_storage *storage UNUSED,
+        uint64_t size UNUSED) {
+    return 0;
+}
+
+static struct oram_storage deferred_storage = {
+    .allocate = deferred_allocate,
+};
+
+int oram_load_fd(oram_t *oram, int fd, uint64_t offset,
+        struct oram_storage *storage) {
+    struct oram_file_storage file;
+    struct snapshot_header header;
+
+    oram_file_storage_init_fd(&file, fd);
+    struct oram_storage *f = &file.base;
+    struct stat st;
+    if (f->read(f, offset, &header, sizeof(header))
+            || fstat(fd, &st)
+            || (uint64_t) st.st_size < offset
+            || snapshot_check_header(&header, st.st_size - offset)) {
+        goto exit;
+    }
+
+    struct oram_config config = {
+        .type = header.type,
+        .block_size = header.block_size,
+        .blocks_per_bucket = header.blocks_per_bucket,
+        .num_blocks = header.num_blocks,
+        .stash_size = header.stash_size,
+        .dummies_per_bucket = header.dummies_per_bucket,
+        .evict_rate = header.evict_rate,
+        .storage = storage ? storage : &deferred_storage,
+        .subtree_levels = header.subtree_levels,
+        .treetop_levels = header.treetop_levels,
+    };
+    if (oram_init_config(oram, &config)) {
+        goto exit;
+    }
+    if (oram->depth != header.depth
+            || oram->treetop_levels != header.treetop_levels) {
+        goto exit_destroy_oram;
+    }
+    size_t num_buckets = (1u << oram->depth) - 1;
+    if (header.tree_size != (uint64_t) (num_buckets
+                - get_treetop_buckets(oram)) * get_bucket_size(oram)) {
+        goto exit_destroy_oram;
+    }
+
+    /* Copy the tree into the given storage, or else map it, and read
+     * everything else. */
+    if (storage) {
+        if (snapshot_load_tree(oram, f, offset + header.tree_offset,
+                    header.tree_size)) {
+            goto exit_destroy_oram;
+        }
+    } else {
+        if (oram_memory_storage_load(&oram->memory_storage, fd,
+                    offset + header.tree_offset, header.tree_size)) {
+            goto exit_destroy_oram;
+        }
+        oram->storage = &oram->memory_storage.base;
+    }
+    if (f->read(f, offset + header.treetop_offset, oram->treetop,
+                get_treetop_buckets(oram) * get_bucket_size(oram))
+            || f->read(f, offset + header.stash_metas_offset,
+                oram->stash_metas,
+                oram->stash_size * sizeof(*oram->stash_metas))
+            || f->read(f, offset + header.stash_data_offset, oram->stash_data,
+                oram->stash_size * oram->block_size)) {
+        goto exit_destroy_oram;
+    }
+    if (oram->type == ORAM_TYPE_RING) {
+        if (f->read(f, offset + header.ring_buckets_offset,
+                    oram->ring_buckets,
+                    num_buckets * sizeof(*oram->ring_buckets))
+                || f->read(f, offset + header.ring_slot_idxs_offset,
+                    oram->ring_slot_idxs,
+                    num_buckets * oram->slots_per_bucket
+                        * sizeof(*oram->ring_slot_idxs))) {
+            goto exit_destroy_oram;
+        }
+    }
+    oram->evict_counter = header.evict_counter;
+    oram->round = header.round;
+
+    /* Load the position map. */
+    oram->posmap_entries_per_block = header.posmap_entries_per_block;
+    switch (header.posmap) {
+        case SNAPSHOT_POSMAP_NONE:
+            break;
+        case SNAPSHOT_POSMAP_LEAVES:
+            oram->posmap_leaves = oram_allocate(oram->allocator,
+                    get_posmap_leaves_size(oram));
+            if (!oram->posmap_leaves) {
+                goto exit_destroy_oram;
+            }
+            if (f->read(f, offset + header.posmap_offset, oram->posmap_leaves,
+                        oram->num_blocks * sizeof(*oram->posmap_leaves))) {
+                goto exit_destroy_oram;
+            }
+            break;
+        case SNAPSHOT_POSMAP_RECURSIVE: {
+            oram_t *posmap = malloc(sizeof(*posmap));
+            if (!posmap) {
+                goto exit_destroy_oram;
+            }
+            if (oram_load_fd(posmap, fd, offset + header.posmap_offset,
+                        NULL)) {
+                free(posmap);
+                goto exit_destroy_oram;
+            }
+            oram->posmap = posmap;
+            break;
+        }
+        default:
+            goto exit_destroy_oram;
+    }
+
+    return 0;
+
+exit_destroy_oram:
+    oram_destroy(oram);
+exit:
+    return -1;
+}
+
+int oram_save(oram_t *oram, const char *path) {
+    uint64_t size;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        goto exit;
+    }
+    if (oram_save_fd(oram, fd, 0, &size)) {
+        goto exit_close;
+    }
+    if (close(fd)) {
+        goto exit;
+    }
+    return 0;
+
+exit_close:
+    close(fd);
+exit:
+    return -1;
+}
+
+int oram_load(oram_t *oram, const char *path, struct oram_storage *storage) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* A mapped tree stays mapped after the file is closed. */
+    int ret = oram_load_fd(oram, fd, 0, storage);
+    close(fd);
+    return ret;
 }
@@ -0,0 +1,153 @@
+#define _DEFAULT_SOURCE
+
+#include "liboblivious/oramallocator.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "liboblivious/internal/util.h"
+
+/* Default allocations of at least this many bytes are mapped directly, so that
+ * the kernel zeroes their pages lazily on first access rather than every page
+ * being faulted in by a memset at allocation time. */
+#define ORAM_MMAP_THRESHOLD ((size_t) 1 << 17)
+
+void *oram_allocate(struct oram_allocator *allocator, size_t size) {
+    if (allocator) {
+        return allocator->allocate(allocator, size);
+    }
+
+    if (size >= ORAM_MMAP_THRESHOLD) {
+        void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            return NULL;
+        }
+        return ptr;
+    }
+
+    /* aligned_alloc requires a multiple of the alignment. */
+    size = MAX(CEIL_DIV(size, ORAM_CACHE_LINE_SIZE), 1) * ORAM_CACHE_LINE_SIZE;
+    void *ptr = aligned_alloc(ORAM_CACHE_LINE_SIZE, size);
+    if (!ptr) {
+        return NULL;
+    }
+    memset(ptr, '\0', size);
+    return ptr;
+}
+
+void oram_free(struct oram_allocator *allocator, void *ptr, size_t size) {
+    if (allocator) {
+        if (ptr) {
+            allocator->free(allocator, ptr, size);
+        }
+        return;
+    }
+    if (ptr && size >= ORAM_MMAP_THRESHOLD) {
+        munmap(ptr, size);
+        return;
+    }
+    free(ptr);
+}
+
+/* Huge page allocator. */
+
+static size_t get_mapping_size(struct oram_hugepage_allocator *allocator,
+        size_t size) {
+    return MAX(CEIL_DIV(size, allocator->page_size), 1) * allocator->page_size;
+}
+
+/* Maps SIZE bytes with huge pages from the reserved pool, or returns NULL if
+ * there are not enough of them. */
+static void *map_hugetlb(struct oram_hugepage_allocator *allocator,
+        size_t size) {
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+        | (int) ilog2l(allocator->page_size) << MAP_HUGE_SHIFT;
+#ifdef MAP_POPULATE
+    if (allocator->prefault) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+    return ptr;
+#else
+    (void) allocator;
+    (void) size;
+    return NULL;
+#endif
+}
+
+/* Maps SIZE bytes aligned to the huge page size with regular pages, advised
+ * for transparent huge pages. The mapping is over-allocated by one huge page
+ * and trimmed to alignment. */
+static void *map_fallback(struct oram_hugepage_allocator *allocator,
+        size_t size) {
+    size_t map_size = size + allocator->page_size;
+    unsigned char *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    unsigned char *ptr = (unsigned char *)
+        (CEIL_DIV((uintptr_t) map, allocator->page_size)
+            * allocator->page_size);
+    if (ptr > map) {
+        munmap(map, ptr - map);
+    }
+    if (map + map_size > ptr + size) {
+        munmap(ptr + size, map + map_size - (ptr + size));
+    }
+
+#ifdef MADV_HUGEPAGE
+    /* This is only advice, so failure is fine. */
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+
+    /* Fault in the pages after advising, so that they are faulted in as huge
+     * pages where possible. */
+    if (allocator->prefault) {
+        long small_page_size = sysconf(_SC_PAGESIZE);
+        if (small_page_size <= 0) {
+            small_page_size = 4096;
+        }
+        for (size_t i = 0; i < size; i += small_page_size) {
+            ((volatile unsigned char *) ptr)[i] = 0;
+        }
+    }
+
+    return ptr;
+}
+
+static void *hugepage_allocate(struct oram_allocator *allocator_,
+        size_t size) {
+    struct oram_hugepage_allocator *allocator =
+        (struct oram_hugepage_allocator *) allocator_;
+    size = get_mapping_size(allocator, size);
+    void *ptr = map_hugetlb(allocator, size);
+    if (!ptr) {
+        ptr = map_fallback(allocator, size);
+    }
+    return ptr;
+}
+
+static void hugepage_free(struct oram_allocator *allocator_, void *ptr,
+        size_t size) {
+    struct oram_hugepage_allocator *allocator =
+        (struct oram_hugepage_allocator *) allocator_;
+    munmap(ptr, get_mapping_size(allocator, size));
+}
+
+void oram_hugepage_allocator_init(struct oram_hugepage_allocator *allocator,
+        size_t page_size, bool prefault) {
+    allocator->base.allocate = hugepage_allocate;
+    allocator->base.free = hugepage_free;
+    allocator->page_size = page_size;
+    allocator->prefault = prefault;
+}
@@ -0,0 +1,293 @@
+#define _DEFAULT_SOURCE
+
+#include "liboblivious/oramstorage.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Reads or writes exactly SIZE bytes at OFFSET in FD, retrying short
+ * transfers. */
+static int pread_all(int fd, void *buf_, size_t size, uint64_t offset) {
+    unsigned char *buf = buf_;
+    while (size) {
+        ssize_t bytes_read = pread(fd, buf, size, offset);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return -1;
+        }
+        buf += bytes_read;
+        offset += bytes_read;
+        size -= bytes_read;
+    }
+    return 0;
+}
+
+static int pwrite_all(int fd, const void *buf_, size_t size,
+        uint64_t offset) {
+    const unsigned char *buf = buf_;
+    while (size) {
+        ssize_t bytes_written = pwrite(fd, buf, size, offset);
+        if (bytes_written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_written <= 0) {
+            return -1;
+        }
+        buf += bytes_written;
+        offset += bytes_written;
+        size -= bytes_written;
+    }
+    return 0;
+}
+
+/* Transfers exactly the bytes of the NUM_SEGMENTS buffers in IOV at OFFSET in
+ * FD with preadv or pwritev, retrying short transfers. IOV is modified. */
+static int prwv_all(int fd, struct iovec *iov, size_t num_segments,
+        uint64_t offset, bool write) {
+    ssize_t bytes = 0;
+    for (;;) {
+        /* Skip the segments that have been transferred in full, including
+         * empty ones, and advance into the first partial one. */
+        while (num_segments && (size_t) bytes >= iov->iov_len) {
+            bytes -= iov->iov_len;
+            iov++;
+            num_segments--;
+        }
+        if (!num_segments) {
+            return 0;
+        }
+        iov->iov_base = (unsigned char *) iov->iov_base + bytes;
+        iov->iov_len -= bytes;
+
+        bytes = write
+            ? pwritev(fd, iov, num_segments, offset)
+            : preadv(fd, iov, num_segments, offset);
+        if (bytes < 0 && errno == EINTR) {
+            bytes = 0;
+            continue;
+        }
+        if (bytes <= 0) {
+            return -1;
+        }
+        offset += bytes;
+    }
+}
+
+int oram_storage_readv(struct oram_storage *storage, uint64_t offset,
+        const struct oram_storage_segment *segments, size_t num_segments) {
+    if (storage->readv) {
+        return storage->readv(storage, offset, segments, num_segments);
+    }
+    for (size_t i = 0; i < num_segments; i++) {
+        if (storage->read(storage, offset, segments[i].buf,
+                    segments[i].size)) {
+            return -1;
+        }
+        offset += segments[i].size;
+    }
+    return 0;
+}
+
+int oram_storage_writev(struct oram_storage *storage, uint64_t offset,
+        const struct oram_storage_segment *segments, size_t num_segments) {
+    if (storage->writev) {
+        return storage->writev(storage, offset, segments, num_segments);
+    }
+    for (size_t i = 0; i < num_segments; i++) {
+        if (storage->write(storage, offset, segments[i].buf,
+                    segments[i].size)) {
+            return -1;
+        }
+        offset += segments[i].size;
+    }
+    return 0;
+}
+
+/* Memory storage. */
+
+/* Frees the storage's data, whether allocated or mapped. */
+static void memory_free(struct oram_memory_storage *storage) {
+    if (storage->mapped) {
+        munmap(storage->data, storage->size);
+    } else {
+        oram_free(storage->allocator, storage->data, storage->size);
+    }
+    storage->data = NULL;
+    storage->size = 0;
+    storage->mapped = false;
+}
+
+static int memory_allocate(struct oram_storage *storage_, uint64_t size) {
+    struct oram_memory_storage *storage =
+        (struct oram_memory_storage *) storage_;
+    if (size > SIZE_MAX) {
+        goto exit;
+    }
+    memory_free(storage);
+    storage->size = size;
+    storage->data = oram_allocate(storage->allocator, storage->size);
+    if (!storage->data) {
+        goto exit;
+    }
+    return 0;
+
+exit:
+    return -1;
+}
+
+static int memory_read(struct oram_storage *storage_, uint64_t offset,
+        void *buf, size_t size) {
+    struct oram_memory_storage *storage =
+        (struct oram_memory_storage *) storage_;
+    memcpy(buf, storage->data + offset, size);
+    return 0;
+}
+
+static int memory_write(struct oram_storage *storage_, uint64_t offset,
+        const void *buf, size_t size) {
+    struct oram_memory_storage *storage =
+        (struct oram_memory_storage *) storage_;
+    memcpy(storage->data + offset, buf, size);
+    return 0;
+}
+
+void oram_memory_storage_init(struct oram_memory_storage *storage,
+        struct oram_allocator *allocator) {
+    storage->base.allocate = memory_allocate;
+    storage->base.read = memory_read;
+    storage->base.write = memory_write;
+    storage->base.readv = NULL;
+    storage->base.writev = NULL;
+    storage->allocator = allocator;
+    storage->data = NULL;
+    storage->size = 0;
+    storage->mapped = false;
+}
+
+int oram_memory_storage_load(struct oram_memory_storage *storage, int fd,
+        uint64_t offset, uint64_t size) {
+    if (size > SIZE_MAX) {
+        goto exit;
+    }
+    memory_free(storage);
+    if (!size) {
+        return 0;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size > 0 && offset % page_size == 0) {
+        void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                offset);
+        if (data != MAP_FAILED) {
+            storage->data = data;
+            storage->size = size;
+            storage->mapped = true;
+            return 0;
+        }
+    }
+
+    /* Fall back to reading the bytes. */
+    storage->size = size;
+    storage->data = oram_allocate(storage->allocator, storage->size);
+    if (!storage->data) {
+        goto exit;
+    }
+    if (pread_all(fd, storage->data, storage->size, offset)) {
+        goto exit_free_data;
+    }
+    return 0;
+
+exit_free_data:
+    memory_free(storage);
+exit:
+    return -1;
+}
+
+void oram_memory_storage_destroy(struct oram_memory_storage *storage) {
+    memory_free(storage);
+}
+
+/* File storage. */
+
+static int file_allocate(struct oram_storage *storage_, uint64_t size) {
+    struct oram_file_storage *storage = (struct oram_file_storage *) storage_;
+
+    /* Truncate to 0 first so that any previous contents are zeroed. */
+    if (ftruncate(storage->fd, 0) || ftruncate(storage->fd, size)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int file_read(struct oram_storage *storage_, uint64_t offset,
+        void *buf, size_t size) {
+    struct oram_file_storage *storage = (struct oram_file_storage *) storage_;
+    return pread_all(storage->fd, buf, size, offset);
+}
+
+static int file_write(struct oram_storage *storage_, uint64_t offset,
+        const void *buf, size_t size) {
+    struct oram_file_storage *storage = (struct oram_file_storage *) storage_;
+    return pwrite_all(storage->fd, buf, size, offset);
+}
+
+static int file_transferv(struct oram_storage *storage_, uint64_t offset,
+        const struct oram_storage_segment *segments, size_t num_segments,
+        bool write) {
+    struct oram_file_storage *storage = (struct oram_file_storage *) storage_;
+    struct iovec iov[num_segments ? num_segments : 1];
+    for (size_t i = 0; i < num_segments; i++) {
+        iov[i].iov_base = segments[i].buf;
+        iov[i].iov_len = segments[i].size;
+    }
+    return prwv_all(storage->fd, iov, num_segments, offset, write);
+}
+
+static int file_readv(struct oram_storage *storage, uint64_t offset,
+        const struct oram_storage_segment *segments, size_t num_segments) {
+    return file_transferv(storage, offset, segments, num_segments, false);
+}
+
+static int file_writev(struct oram_storage *storage, uint64_t offset,
+        const struct oram_storage_segment *segments, size_t num_segments) {
+    return file_transferv(storage, offset, segments, num_segments, true);
+}
+
+int oram_file_storage_init(struct oram_file_storage *storage,
+        const char *path) {
+    storage->base.allocate = file_allocate;
+    storage->base.read = file_read;
+    storage->base.write = file_write;
+    storage->base.readv = file_readv;
+    storage->base.writev = file_writev;
+    storage->fd = open(path, O_RDWR | O_CREAT, 0600);
+    storage->owns_fd = true;
+    if (storage->fd < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void oram_file_storage_init_fd(struct oram_file_storage *storage, int fd) {
+    storage->base.allocate = file_allocate;
+    storage->base.read = file_read;
+    storage->base.write = file_write;
+    storage->base.readv = file_readv;
+    storage->base.writev = file_writev;
+    storage->fd = fd;
+    storage->owns_fd = false;
+}
+
+void oram_file_storage_destroy(struct oram_file_storage *storage) {
+    if (storage->owns_fd) {
+        close(storage->fd);
+    }
+}
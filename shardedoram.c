@@ -0,0 +1,238 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "liboblivious/shardedoram.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "liboblivious/internal/util.h"
+#include "liboblivious/oram.h"
+
+struct shardedoram_request {
+    uint64_t shard_block_id;
+    void *data;
+    bool write;
+    bool is_real_access;
+    int ret;
+    bool done;
+};
+
+int shardedoram_init(shardedoram_t *shardedoram,
+        const struct oram_config *config, size_t num_shards) {
+    size_t i;
+
+    if (!num_shards || config->storage) {
+        goto exit;
+    }
+
+    shardedoram->num_shards = num_shards;
+    shardedoram->block_size = config->block_size;
+    shardedoram->num_blocks = config->num_blocks;
+    shardedoram->num_requests = 0;
+    shardedoram->num_active = 0;
+    shardedoram->num_collided = 0;
+    shardedoram->running = false;
+    shardedoram->round_ret = 0;
+
+    if (pthread_mutex_init(&shardedoram->lock, NULL)) {
+        goto exit;
+    }
+    if (pthread_cond_init(&shardedoram->cond, NULL)) {
+        goto exit_destroy_lock;
+    }
+
+    shardedoram->requests =
+        calloc(num_shards, sizeof(*shardedoram->requests));
+    if (!shardedoram->requests) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_destroy_cond;
+    }
+
+    shardedoram->shards = malloc(num_shards * sizeof(*shardedoram->shards));
+    if (!shardedoram->shards) {
+        /* Obliviousness violation - out of memory. */
+        goto exit_free_requests;
+    }
+
+    struct oram_config shard_config = *config;
+    shard_config.num_blocks = CEIL_DIV(config->num_blocks, num_shards);
+    shard_config.position_map = true;
+    for (i = 0; i < num_shards; i++) {
+        shardedoram->shards[i].dummy_data = malloc(config->block_size);
+        if (!shardedoram->shards[i].dummy_data) {
+            /* Obliviousness violation - out of memory. */
+            goto exit_destroy_shards;
+        }
+        if (oram_init_config(&shardedoram->shards[i].oram, &shard_config)) {
+            free(shardedoram->shards[i].dummy_data);
+            goto exit_destroy_shards;
+        }
+    }
+
+    return 0;
+
+exit_destroy_shards:
+    while (i--) {
+        oram_destroy(&shardedoram->shards[i].oram);
+        free(shardedoram->shards[i].dummy_data);
+    }
+    free(shardedoram->shards);
+exit_free_requests:
+    free(shardedoram->requests);
+exit_destroy_cond:
+    pthread_cond_destroy(&shardedoram->cond);
+exit_destroy_lock:
+    pthread_mutex_destroy(&shardedoram->lock);
+exit:
+    return -1;
+}
+
+void shardedoram_destroy(shardedoram_t *shardedoram) {
+    for (size_t i = 0; i < shardedoram->num_shards; i++) {
+        oram_destroy(&shardedoram->shards[i].oram);
+        free(shardedoram->shards[i].dummy_data);
+    }
+    free(shardedoram->shards);
+    free(shardedoram->requests);
+    pthread_cond_destroy(&shardedoram->cond);
+    pthread_mutex_destroy(&shardedoram->lock);
+}
+
+/* Starts the current round if it has a request and no more threads can join
+ * it, either because every shard has a request or because every active thread
+ * has joined or is waiting for the next round. Must be called with the lock
+ * held, after any change to the round's membership. */
+static void maybe_start_round(shardedoram_t *shardedoram) {
+    if (shardedoram->running || !shardedoram->num_requests) {
+        return;
+    }
+    if (shardedoram->num_requests < shardedoram->num_shards
+            && shardedoram->num_requests + shardedoram->num_collided
+                < shardedoram->num_active) {
+        return;
+    }
+
+    shardedoram->running = true;
+    shardedoram->next_shard = 0;
+    shardedoram->num_accessed = 0;
+    pthread_cond_broadcast(&shardedoram->cond);
+}
+
+/* Performs the access of the running round on the shard with index IDX, which
+ * is real if REQUEST is not NULL and dummy otherwise. Must be called without
+ * the lock held. */
+static int access_shard(shardedoram_t *shardedoram, size_t idx,
+        struct shardedoram_request *request, uint64_t (*rand_func)(void)) {
+    struct shardedoram_shard *shard = &shardedoram->shards[idx];
+
+    if (!request) {
+        return oram_read(&shard->oram, 0, shard->dummy_data, false, rand_func);
+    }
+    if (request->write) {
+        return oram_write(&shard->oram, request->shard_block_id, request->data,
+                request->is_real_access, rand_func);
+    }
+    return oram_read(&shard->oram, request->shard_block_id, request->data,
+            request->is_real_access, rand_func);
+}
+
+/* Joins the next round with no request on BLOCK_ID's shard, and then accesses
+ * the round's shards along with the other threads of the round until it is
+ * complete. */
+static int access_shards(shardedoram_t *shardedoram, uint64_t block_id,
+        void *data, bool write, bool is_real_access,
+        uint64_t (*rand_func)(void)) {
+    if (block_id >= shardedoram->num_blocks) {
+        return -1;
+    }
+
+    size_t shard_idx = block_id % shardedoram->num_shards;
+    struct shardedoram_request request = {
+        .shard_block_id = block_id / shardedoram->num_shards,
+        .data = data,
+        .write = write,
+        .is_real_access = is_real_access,
+        .ret = 0,
+        .done = false,
+    };
+    bool collided = false;
+
+    pthread_mutex_lock(&shardedoram->lock);
+    shardedoram->num_active++;
+
+    /* Wait for a round that hasn't started and has no request on the shard.
+     * While the shard is taken, this thread counts as collided, so that the
+     * round can start without it. */
+    while (shardedoram->running || shardedoram->requests[shard_idx]) {
+        if (!shardedoram->running && !collided) {
+            collided = true;
+            shardedoram->num_collided++;
+            maybe_start_round(shardedoram);
+        }
+        pthread_cond_wait(&shardedoram->cond, &shardedoram->lock);
+    }
+    if (collided) {
+        shardedoram->num_collided--;
+    }
+    shardedoram->requests[shard_idx] = &request;
+    shardedoram->num_requests++;
+    maybe_start_round(shardedoram);
+
+    /* Access the shards of the round until every shard has been accessed. */
+    while (!request.done) {
+        if (!shardedoram->running
+                || shardedoram->next_shard == shardedoram->num_shards) {
+            pthread_cond_wait(&shardedoram->cond, &shardedoram->lock);
+            continue;
+        }
+
+        size_t idx = shardedoram->next_shard++;
+        struct shardedoram_request *shard_request =
+            shardedoram->requests[idx];
+        pthread_mutex_unlock(&shardedoram->lock);
+        int ret = access_shard(shardedoram, idx, shard_request, rand_func);
+        pthread_mutex_lock(&shardedoram->lock);
+
+        if (ret) {
+            shardedoram->round_ret = -1;
+        }
+        shardedoram->num_accessed++;
+        if (shardedoram->num_accessed < shardedoram->num_shards) {
+            continue;
+        }
+
+        /* Complete the round. A failed access fails every request of the
+         * round, so that failures don't reveal which accesses were real. */
+        for (size_t i = 0; i < shardedoram->num_shards; i++) {
+            if (shardedoram->requests[i]) {
+                shardedoram->requests[i]->ret = shardedoram->round_ret;
+                shardedoram->requests[i]->done = true;
+                shardedoram->requests[i] = NULL;
+            }
+        }
+        shardedoram->num_requests = 0;
+        shardedoram->round_ret = 0;
+        shardedoram->running = false;
+        pthread_cond_broadcast(&shardedoram->cond);
+    }
+
+    shardedoram->num_active--;
+    maybe_start_round(shardedoram);
+    pthread_mutex_unlock(&shardedoram->lock);
+
+    return request.ret;
+}
+
+int shardedoram_read(shardedoram_t *shardedoram, uint64_t block_id, void *data,
+        bool is_real_access, uint64_t (*rand_func)(void)) {
+    return access_shards(shardedoram, block_id, data, false, is_real_access,
+            rand_func);
+}
+
+int shardedoram_write(shardedoram_t *shardedoram, uint64_t block_id,
+        const void *data, bool is_real_access, uint64_t (*rand_func)(void)) {
+    /* The data is only read from for writes. */
+    return access_shards(shardedoram, block_id, (void *) data, true,
+            is_real_access, rand_func);
+}
@@ -1,10 +1,13 @@
 #include "algorithms.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "liboblivious/algorithms.h"
 #include "common.h"
 
 #define SORT_SIZE 1000
+#define SORT_SMALL_DOMAIN_SIZE 70000
 
 struct comparator_aux {
     bool reverse;
@@ -57,6 +60,207 @@ exit:
     return ret;
 }
 
+char *test_sort_columns(void) {
+    char *ret;
+
+    unsigned long *keys = malloc(SORT_SIZE * sizeof(unsigned long));
+    if (!keys) {
+        ret = "Malloc keys";
+        goto exit;
+    }
+    unsigned long *tripled = malloc(SORT_SIZE * sizeof(unsigned long));
+    if (!tripled) {
+        ret = "Malloc tripled";
+        goto exit_free_keys;
+    }
+    unsigned char *low_bytes = malloc(SORT_SIZE);
+    if (!low_bytes) {
+        ret = "Malloc low_bytes";
+        goto exit_free_tripled;
+    }
+
+    for (size_t i = 0; i < SORT_SIZE; i++) {
+        keys[i] = get_random() % 1000;
+        tripled[i] = keys[i] * 3;
+        low_bytes[i] = keys[i] & 0xff;
+    }
+
+    void *columns[] = { tripled, low_bytes };
+    size_t column_sizes[] = { sizeof(*tripled), sizeof(*low_bytes) };
+    struct comparator_aux aux = {
+        .reverse = false,
+    };
+    o_sort_columns(keys, SORT_SIZE, sizeof(*keys), columns, column_sizes, 2,
+            comparator, &aux);
+
+    bool correct = true;
+    for (size_t i = 0; i < SORT_SIZE; i++) {
+        if ((i < SORT_SIZE - 1 && keys[i] > keys[i + 1])
+                || tripled[i] != keys[i] * 3
+                || low_bytes[i] != (keys[i] & 0xff)) {
+            correct = false;
+        }
+    }
+    if (!correct) {
+        ret = "Incorrectly sorted";
+        goto exit_free_low_bytes;
+    }
+
+    ret = NULL;
+
+exit_free_low_bytes:
+    free(low_bytes);
+exit_free_tripled:
+    free(tripled);
+exit_free_keys:
+    free(keys);
+exit:
+    return ret;
+}
+
+struct small_domain_elem {
+    size_t key;
+    size_t idx;
+};
+
+static size_t small_domain_get_key(const void *elem, void *aux UNUSED) {
+    return ((const struct small_domain_elem *) elem)->key;
+}
+
+char *test_sort_small_domain(void) {
+    /* The larger size takes the radix sort path even for the 256-value
+     * domain. */
+    static const size_t sizes[] = { SORT_SIZE, SORT_SMALL_DOMAIN_SIZE };
+    static const size_t domains[] = { 2, 3, 16, 256 };
+    char *ret;
+
+    struct small_domain_elem *arr =
+        malloc(SORT_SMALL_DOMAIN_SIZE * sizeof(*arr));
+    if (!arr) {
+        ret = "Malloc arr";
+        goto exit;
+    }
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        size_t n = sizes[i];
+        for (size_t j = 0; j < sizeof(domains) / sizeof(*domains); j++) {
+            for (size_t k = 0; k < n; k++) {
+                arr[k].key = get_random() % domains[j];
+                arr[k].idx = k;
+            }
+
+            if (o_sort_small_domain(arr, n, sizeof(*arr),
+                        small_domain_get_key, domains[j], NULL)) {
+                ret = "Sort failed";
+                goto exit_free_arr;
+            }
+
+            bool correct = true;
+            for (size_t k = 0; k < n - 1; k++) {
+                if (arr[k].key > arr[k + 1].key) {
+                    correct = false;
+                }
+            }
+            if (!correct) {
+                ret = "Incorrectly sorted";
+                goto exit_free_arr;
+            }
+
+            for (size_t k = 0; k < n - 1; k++) {
+                if (arr[k].key == arr[k + 1].key
+                        && arr[k].idx > arr[k + 1].idx) {
+                    correct = false;
+                }
+            }
+            if (!correct) {
+                ret = "Sort was not stable";
+                goto exit_free_arr;
+            }
+        }
+    }
+
+    ret = NULL;
+
+exit_free_arr:
+    free(arr);
+exit:
+    return ret;
+}
+
+static int ulong_comparator(const void *a_, const void *b_) {
+    const unsigned long *a = a_;
+    const unsigned long *b = b_;
+    return (*a > *b) - (*a < *b);
+}
+
+char *test_select_topk(void) {
+    static const size_t ks[] = { 1, 7, 10, SORT_SIZE / 2 + 1 };
+    char *ret;
+
+    unsigned long *arr = malloc(SORT_SIZE * sizeof(unsigned long));
+    if (!arr) {
+        ret = "Malloc arr";
+        goto exit;
+    }
+    unsigned long *expected = malloc(SORT_SIZE * sizeof(unsigned long));
+    if (!expected) {
+        ret = "Malloc expected";
+        goto exit_free_arr;
+    }
+
+    for (size_t i = 0; i < sizeof(ks) / sizeof(*ks); i++) {
+        for (size_t j = 0; j < SORT_SIZE; j++) {
+            arr[j] = get_random() % 1000;
+        }
+        memcpy(expected, arr, SORT_SIZE * sizeof(unsigned long));
+        qsort(expected, SORT_SIZE, sizeof(*expected), ulong_comparator);
+
+        struct comparator_aux aux = {
+            .reverse = false,
+        };
+        o_select_topk(arr, SORT_SIZE, sizeof(*arr), ks[i], comparator, &aux);
+
+        if (memcmp(arr, expected, ks[i] * sizeof(*arr))) {
+            ret = "Incorrect top-k elements";
+            goto exit_free_expected;
+        }
+    }
+
+    ret = NULL;
+
+exit_free_expected:
+    free(expected);
+exit_free_arr:
+    free(arr);
+exit:
+    return ret;
+}
+
+#define SORT_SMALL_MAX_SIZE 20
+
+char *test_sort_small(void) {
+    unsigned long arr[SORT_SMALL_MAX_SIZE];
+    struct comparator_aux aux = {
+        .reverse = false,
+    };
+
+    for (size_t n = 0; n <= SORT_SMALL_MAX_SIZE; n++) {
+        for (size_t i = 0; i < n; i++) {
+            arr[i] = get_random() % 10;
+        }
+
+        o_sort_small(arr, n, sizeof(*arr), comparator, &aux);
+
+        for (size_t i = 1; i < n; i++) {
+            if (arr[i - 1] > arr[i]) {
+                return "Incorrectly sorted";
+            }
+        }
+    }
+
+    return NULL;
+}
+
 static void swap(size_t a, size_t b, void *arr_) {
     unsigned long *arr = arr_;
     if (arr[a] > arr[b]) {
@@ -100,6 +304,82 @@ exit:
     return ret;
 }
 
+struct swap_layer_aux {
+    unsigned long *arr;
+    size_t *last_layer;
+    size_t layer;
+    bool disjoint;
+};
+
+static void swap_layer(const struct o_swap_pair *pairs, size_t num_pairs,
+        void *aux_) {
+    struct swap_layer_aux *aux = aux_;
+    aux->layer++;
+    for (size_t i = 0; i < num_pairs; i++) {
+        if (aux->last_layer[pairs[i].a] == aux->layer
+                || aux->last_layer[pairs[i].b] == aux->layer) {
+            aux->disjoint = false;
+        }
+        aux->last_layer[pairs[i].a] = aux->layer;
+        aux->last_layer[pairs[i].b] = aux->layer;
+        swap(pairs[i].a, pairs[i].b, aux->arr);
+    }
+}
+
+char *test_sort_generate_swap_layers(void) {
+    char *ret;
+
+    unsigned long *arr = malloc(SORT_SIZE * sizeof(unsigned long));
+    if (!arr) {
+        ret = "Malloc arr";
+        goto exit;
+    }
+    size_t *last_layer = calloc(SORT_SIZE, sizeof(size_t));
+    if (!last_layer) {
+        ret = "Malloc last_layer";
+        goto exit_free_arr;
+    }
+
+    for (size_t i = 0; i < SORT_SIZE; i++) {
+        arr[i] = get_random() % 1000;
+    }
+
+    struct swap_layer_aux aux = {
+        .arr = arr,
+        .last_layer = last_layer,
+        .layer = 0,
+        .disjoint = true,
+    };
+    if (o_sort_generate_swap_layers(SORT_SIZE, swap_layer, &aux)) {
+        ret = "Generating layers failed";
+        goto exit_free_last_layer;
+    }
+    if (!aux.disjoint) {
+        ret = "Layer contained overlapping pairs";
+        goto exit_free_last_layer;
+    }
+
+    bool correct = true;
+    for (size_t i = 0; i < SORT_SIZE - 1; i++) {
+        if (arr[i] > arr[i + 1]) {
+            correct = false;
+        }
+    }
+    if (!correct) {
+        ret = "Incorrectly sorted";
+        goto exit_free_last_layer;
+    }
+
+    ret = NULL;
+
+exit_free_last_layer:
+    free(last_layer);
+exit_free_arr:
+    free(arr);
+exit:
+    return ret;
+}
+
 static bool is_marked(const void *elem,  void *aux UNUSED) {
     return *((const bool *) elem);
 }
@@ -138,3 +418,409 @@ char *test_compact(void) {
 exit:
     return ret;
 }
+
+#define COMPACT_LOOSE_SIZE 10000
+#define COMPACT_LOOSE_MARKED 150
+
+static bool compact_loose_is_marked(const void *elem, void *aux UNUSED) {
+    return *((const unsigned long *) elem) < COMPACT_LOOSE_MARKED;
+}
+
+char *test_compact_loose(void) {
+    char *ret;
+
+    unsigned long *arr = malloc(COMPACT_LOOSE_SIZE * sizeof(*arr));
+    if (!arr) {
+        ret = "Malloc arr";
+        goto exit;
+    }
+    bool *seen = calloc(COMPACT_LOOSE_SIZE, sizeof(*seen));
+    if (!seen) {
+        ret = "Malloc seen";
+        goto exit_free_arr;
+    }
+    for (size_t i = 0; i < COMPACT_LOOSE_SIZE; i++) {
+        arr[i] = i;
+    }
+
+    size_t out_n;
+    if (o_compact_loose(arr, COMPACT_LOOSE_SIZE, sizeof(*arr),
+                COMPACT_LOOSE_MARKED, compact_loose_is_marked, NULL, &out_n,
+                get_random)) {
+        ret = "Compaction failed";
+        goto exit_free_seen;
+    }
+
+    if (out_n > COMPACT_LOOSE_MARKED * 5) {
+        ret = "Output too large";
+        goto exit_free_seen;
+    }
+    for (size_t i = 0; i < COMPACT_LOOSE_SIZE; i++) {
+        if (arr[i] >= COMPACT_LOOSE_SIZE || seen[arr[i]]) {
+            ret = "Not a permutation";
+            goto exit_free_seen;
+        }
+        seen[arr[i]] = true;
+        if (i >= out_n && arr[i] < COMPACT_LOOSE_MARKED) {
+            ret = "Marked element outside of output";
+            goto exit_free_seen;
+        }
+    }
+
+    /* A bound below the number of marked elements must be refused. */
+    if (!o_compact_loose(arr, COMPACT_LOOSE_SIZE, sizeof(*arr),
+                COMPACT_LOOSE_MARKED - 1, compact_loose_is_marked, NULL,
+                &out_n, get_random)) {
+        ret = "Compaction with a violated bound succeeded";
+        goto exit_free_seen;
+    }
+
+    ret = NULL;
+
+exit_free_seen:
+    free(seen);
+exit_free_arr:
+    free(arr);
+exit:
+    return ret;
+}
+
+#define GROUP_COUNT 50
+
+struct group_elem {
+    unsigned long key;
+    unsigned long sum;
+};
+
+static int group_comparator(const void *a_, const void *b_, void *aux UNUSED) {
+    const struct group_elem *a = a_;
+    const struct group_elem *b = b_;
+    return (a->key > b->key) - (a->key < b->key);
+}
+
+static void group_combine(void *dest_, const void *src_, void *aux UNUSED) {
+    struct group_elem *dest = dest_;
+    const struct group_elem *src = src_;
+    dest->sum += src->sum;
+}
+
+char *test_group_aggregate(void) {
+    char *ret;
+    unsigned long expected[GROUP_COUNT] = { 0 };
+
+    struct group_elem *arr = malloc(SORT_SIZE * sizeof(*arr));
+    if (!arr) {
+        ret = "Malloc arr";
+        goto exit;
+    }
+
+    for (size_t i = 0; i < SORT_SIZE; i++) {
+        arr[i].key = get_random() % GROUP_COUNT;
+        arr[i].sum = get_random() % 1000;
+        expected[arr[i].key] += arr[i].sum;
+    }
+
+    size_t num_groups;
+    if (o_group_aggregate(arr, SORT_SIZE, sizeof(*arr), group_comparator,
+                group_combine, NULL, &num_groups)) {
+        ret = "Aggregate failed";
+        goto exit_free_arr;
+    }
+
+    size_t expected_groups = 0;
+    for (size_t i = 0; i < GROUP_COUNT; i++) {
+        expected_groups += expected[i] > 0;
+    }
+    if (num_groups != expected_groups) {
+        ret = "Incorrect number of groups";
+        goto exit_free_arr;
+    }
+
+    bool correct = true;
+    for (size_t i = 0; i < num_groups; i++) {
+        if (arr[i].sum != expected[arr[i].key]
+                || (i > 0 && arr[i - 1].key >= arr[i].key)) {
+            correct = false;
+        }
+    }
+    if (!correct) {
+        ret = "Incorrectly aggregated";
+        goto exit_free_arr;
+    }
+
+    ret = NULL;
+
+exit_free_arr:
+    free(arr);
+exit:
+    return ret;
+}
+
+static size_t histogram_get_bucket(const void *elem, void *aux) {
+    const size_t *num_buckets = aux;
+    return *((const unsigned long *) elem) % *num_buckets;
+}
+
+char *test_histogram(void) {
+    /* Covers both the scanning and the sorting strategies. */
+    static const size_t bucket_counts[] = { 16, 1000 };
+    char *ret;
+
+    unsigned long *arr = malloc(SORT_SIZE * sizeof(*arr));
+    if (!arr) {
+        ret = "Malloc arr";
+        goto exit;
+    }
+    size_t *counts = malloc(1000 * sizeof(*counts));
+    if (!counts) {
+        ret = "Malloc counts";
+        goto exit_free_arr;
+    }
+    size_t *expected = malloc(1000 * sizeof(*expected));
+    if (!expected) {
+        ret = "Malloc expected";
+        goto exit_free_counts;
+    }
+
+    for (size_t i = 0; i < sizeof(bucket_counts) / sizeof(*bucket_counts);
+            i++) {
+        size_t num_buckets = bucket_counts[i];
+        memset(expected, 0, num_buckets * sizeof(*expected));
+        for (size_t j = 0; j < SORT_SIZE; j++) {
+            arr[j] = get_random();
+            expected[arr[j] % num_buckets]++;
+        }
+
+        if (o_histogram(arr, SORT_SIZE, sizeof(*arr), histogram_get_bucket,
+                    &num_buckets, num_buckets, counts)) {
+            ret = "Histogram failed";
+            goto exit_free_expected;
+        }
+
+        if (memcmp(counts, expected, num_buckets * sizeof(*counts))) {
+            ret = "Incorrect counts";
+            goto exit_free_expected;
+        }
+    }
+
+    ret = NULL;
+
+exit_free_expected:
+    free(expected);
+exit_free_counts:
+    free(counts);
+exit_free_arr:
+    free(arr);
+exit:
+    return ret;
+}
+
+#define DISTINCT_DOMAIN 300
+
+char *test_count_distinct(void) {
+    char *ret;
+
+    unsigned long *arr = malloc(SORT_SIZE * sizeof(*arr));
+    if (!arr) {
+        ret = "Malloc arr";
+        goto exit;
+    }
+
+    bool seen[DISTINCT_DOMAIN] = { false };
+    size_t expected = 0;
+    for (size_t i = 0; i < SORT_SIZE; i++) {
+        arr[i] = get_random() % DISTINCT_DOMAIN;
+        expected += !seen[arr[i]];
+        seen[arr[i]] = true;
+    }
+
+    struct comparator_aux aux = {
+        .reverse = false,
+    };
+    if (o_count_distinct(arr, SORT_SIZE, sizeof(*arr), comparator, &aux)
+            != expected) {
+        ret = "Incorrect count";
+        goto exit_free_arr;
+    }
+
+    ret = NULL;
+
+exit_free_arr:
+    free(arr);
+exit:
+    return ret;
+}
+
+#define LOOKUP_TABLE_SIZE 1000
+#define LOOKUP_QUERY_COUNT 500
+
+char *test_batch_lookup(void) {
+    char *ret;
+    static uint64_t table_keys[LOOKUP_TABLE_SIZE];
+    static unsigned long table_values[LOOKUP_TABLE_SIZE];
+    static uint64_t query_keys[LOOKUP_QUERY_COUNT];
+    static unsigned long values[LOOKUP_QUERY_COUNT];
+    static bool found[LOOKUP_QUERY_COUNT];
+
+    /* The table holds the even keys. */
+    for (size_t i = 0; i < LOOKUP_TABLE_SIZE; i++) {
+        table_keys[i] = i * 2;
+        table_values[i] = i * 7;
+    }
+    for (size_t i = 0; i < LOOKUP_QUERY_COUNT; i++) {
+        query_keys[i] = get_random() % (LOOKUP_TABLE_SIZE * 3);
+    }
+
+    if (o_batch_lookup(table_keys, table_values, LOOKUP_TABLE_SIZE,
+                sizeof(*table_values), query_keys, LOOKUP_QUERY_COUNT, values,
+                found)) {
+        ret = "Lookup failed";
+        goto exit;
+    }
+
+    for (size_t i = 0; i < LOOKUP_QUERY_COUNT; i++) {
+        bool expected_found = query_keys[i] % 2 == 0
+            && query_keys[i] < LOOKUP_TABLE_SIZE * 2;
+        if (found[i] != expected_found) {
+            ret = "Incorrect found flag";
+            goto exit;
+        }
+        if (found[i] && values[i] != query_keys[i] / 2 * 7) {
+            ret = "Incorrect value";
+            goto exit;
+        }
+    }
+
+    ret = NULL;
+
+exit:
+    return ret;
+}
+
+#define JOIN_SIZE 100
+#define JOIN_KEYS 10
+
+struct join_elem {
+    unsigned long key;
+    unsigned long idx;
+};
+
+static uint64_t join_get_key(const void *elem, bool is_right UNUSED,
+        void *aux UNUSED) {
+    return ((const struct join_elem *) elem)->key;
+}
+
+char *test_join_pk_fk(void) {
+    char *ret;
+    struct join_elem left[JOIN_SIZE];
+    struct join_elem right[JOIN_SIZE];
+    struct join_elem out[JOIN_SIZE][2];
+
+    /* Left keys are a shuffled subset of 0..2 * JOIN_SIZE - 1. */
+    for (size_t i = 0; i < JOIN_SIZE; i++) {
+        left[i].key = i * 2 + get_random() % 2;
+        left[i].idx = i;
+    }
+    for (size_t i = JOIN_SIZE - 1; i > 0; i--) {
+        size_t j = get_random() % (i + 1);
+        struct join_elem t = left[i];
+        left[i] = left[j];
+        left[j] = t;
+    }
+    for (size_t i = 0; i < JOIN_SIZE; i++) {
+        right[i].key = get_random() % (JOIN_SIZE * 2);
+        right[i].idx = i;
+    }
+    size_t expected_n = 0;
+    for (size_t i = 0; i < JOIN_SIZE; i++) {
+        for (size_t j = 0; j < JOIN_SIZE; j++) {
+            expected_n += left[j].key == right[i].key;
+        }
+    }
+
+    size_t out_n;
+    if (o_join_pk_fk(left, JOIN_SIZE, sizeof(*left), right, JOIN_SIZE,
+                sizeof(*right), join_get_key, NULL, out, &out_n)) {
+        ret = "Join failed";
+        goto exit;
+    }
+    if (out_n != expected_n) {
+        ret = "Incorrect number of joined elements";
+        goto exit;
+    }
+
+    bool seen[JOIN_SIZE] = { false };
+    for (size_t i = 0; i < out_n; i++) {
+        if (out[i][0].key != out[i][1].key || seen[out[i][1].idx]) {
+            ret = "Incorrectly joined";
+            goto exit;
+        }
+        seen[out[i][1].idx] = true;
+    }
+
+    ret = NULL;
+
+exit:
+    return ret;
+}
+
+char *test_join(void) {
+    char *ret;
+    struct join_elem left[JOIN_SIZE];
+    struct join_elem right[JOIN_SIZE];
+    size_t out_bound = JOIN_SIZE * JOIN_SIZE / JOIN_KEYS * 2;
+
+    struct join_elem (*out)[2] = malloc(out_bound * sizeof(*out));
+    if (!out) {
+        ret = "Malloc out";
+        goto exit;
+    }
+
+    for (size_t i = 0; i < JOIN_SIZE; i++) {
+        left[i].key = get_random() % JOIN_KEYS;
+        left[i].idx = i;
+        right[i].key = get_random() % JOIN_KEYS;
+        right[i].idx = i;
+    }
+    size_t expected_n = 0;
+    for (size_t i = 0; i < JOIN_SIZE; i++) {
+        for (size_t j = 0; j < JOIN_SIZE; j++) {
+            expected_n += left[i].key == right[j].key;
+        }
+    }
+
+    size_t out_n;
+    if (!o_join(left, JOIN_SIZE, sizeof(*left), right, JOIN_SIZE,
+                sizeof(*right), join_get_key, NULL, out, expected_n - 1,
+                &out_n)) {
+        ret = "Join exceeding output bound succeeded";
+        goto exit_free_out;
+    }
+    if (o_join(left, JOIN_SIZE, sizeof(*left), right, JOIN_SIZE,
+                sizeof(*right), join_get_key, NULL, out, out_bound, &out_n)) {
+        ret = "Join failed";
+        goto exit_free_out;
+    }
+    if (out_n != expected_n) {
+        ret = "Incorrect number of joined elements";
+        goto exit_free_out;
+    }
+
+    static bool seen[JOIN_SIZE][JOIN_SIZE];
+    memset(seen, '\0', sizeof(seen));
+    for (size_t i = 0; i < out_n; i++) {
+        if (out[i][0].key != out[i][1].key
+                || seen[out[i][0].idx][out[i][1].idx]) {
+            ret = "Incorrectly joined";
+            goto exit_free_out;
+        }
+        seen[out[i][0].idx][out[i][1].idx] = true;
+    }
+
+    ret = NULL;
+
+exit_free_out:
+    free(out);
+exit:
+    return ret;
+}
@@ -2,7 +2,20 @@
 #define LIBOBLIVIOUS_TEST_ALGORITHMS_H
 
 char *test_sort(void);
+char *test_sort_small(void);
+char *test_sort_cpp(void);
 char *test_sort_generate_swaps(void);
+char *test_sort_generate_swap_layers(void);
+char *test_sort_columns(void);
+char *test_sort_small_domain(void);
+char *test_select_topk(void);
 char *test_compact(void);
+char *test_compact_loose(void);
+char *test_group_aggregate(void);
+char *test_histogram(void);
+char *test_count_distinct(void);
+char *test_batch_lookup(void);
+char *test_join_pk_fk(void);
+char *test_join(void);
 
 #endif /* liboblivious/test/algorithms.h */
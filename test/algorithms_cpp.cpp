@@ -0,0 +1,91 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include "liboblivious/algorithms.hpp"
+
+extern "C" {
+#include "algorithms.h"
+#include "common.h"
+}
+
+#define SORT_SIZE 1000
+
+namespace {
+
+/* An odd-sized record, which is swapped a byte at a time. The key is stored as
+ * bytes so that the record has no padding. */
+struct record {
+    unsigned char key[2];
+    unsigned char tag;
+
+    unsigned get_key() const {
+        return key[0] << 8 | key[1];
+    }
+};
+static_assert(sizeof(record) == 3, "record must have an odd size");
+
+struct record_comparator {
+    bool operator()(const record &a, const record &b) const {
+        return a.get_key() < b.get_key();
+    }
+};
+
+/* A record whose size is a multiple of 2 but not 4, which is swapped a
+ * halfword at a time. */
+struct half_record {
+    std::uint16_t key;
+    std::uint16_t tag[2];
+};
+static_assert(sizeof(half_record) == 6,
+        "half_record must be swapped by halfwords");
+
+struct half_record_comparator {
+    bool operator()(const half_record &a, const half_record &b) const {
+        return a.key < b.key;
+    }
+};
+
+} /* namespace */
+
+char *test_sort_cpp(void) {
+    static record records[SORT_SIZE];
+    static half_record half_records[SORT_SIZE];
+    static std::uint64_t words[SORT_SIZE];
+
+    for (std::size_t i = 0; i < SORT_SIZE; i++) {
+        unsigned key = get_random() % 1000;
+        records[i].key[0] = key >> 8;
+        records[i].key[1] = key & 0xff;
+        records[i].tag = key % 251;
+        half_records[i].key = get_random() % 1000;
+        half_records[i].tag[0] = half_records[i].key * 3;
+        half_records[i].tag[1] = half_records[i].key * 7;
+        words[i] = get_random();
+    }
+
+    liboblivious::o_sort(records, SORT_SIZE, record_comparator());
+    liboblivious::o_sort(half_records, SORT_SIZE, half_record_comparator());
+    liboblivious::o_sort(words, SORT_SIZE);
+
+    for (std::size_t i = 0; i < SORT_SIZE; i++) {
+        if (records[i].tag != records[i].get_key() % 251) {
+            return (char *) "Record corrupted";
+        }
+        if (i > 0 && records[i - 1].get_key() > records[i].get_key()) {
+            return (char *) "Records not sorted";
+        }
+        if (half_records[i].tag[0] != (std::uint16_t) (half_records[i].key * 3)
+                || half_records[i].tag[1]
+                    != (std::uint16_t) (half_records[i].key * 7)) {
+            return (char *) "Halfword record corrupted";
+        }
+        if (i > 0 && half_records[i - 1].key > half_records[i].key) {
+            return (char *) "Halfword records not sorted";
+        }
+        if (i > 0 && words[i - 1] > words[i]) {
+            return (char *) "Words not sorted";
+        }
+    }
+
+    return NULL;
+}
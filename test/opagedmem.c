@@ -1,7 +1,14 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "opagedmem.h"
+#include <stdlib.h>
+#include <unistd.h>
 #include "liboblivious/opagedmem.h"
 #include "common.h"
 
+#define OPAGEDMEM_SNAPSHOT_TEMPLATE "/tmp/liboblivious-test-XXXXXX"
+#define OPAGEDMEM_SNAPSHOT_ADDRS 16
+
 char *test_opagedmem(void) {
     char *ret;
     int64_t val;
@@ -156,3 +163,66 @@ exit_destroy_opagedmem:
 exit:
     return ret;
 }
+
+char *test_opagedmem_snapshot(void) {
+    opagedmem_t opagedmem;
+    char path[] = OPAGEDMEM_SNAPSHOT_TEMPLATE;
+    char *ret;
+    int64_t val;
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        ret = "Create snapshot file";
+        goto exit;
+    }
+    close(fd);
+
+    if (opagedmem_init(&opagedmem, 1048576)) {
+        ret = "Init page table";
+        goto exit_unlink;
+    }
+
+    /* Write a value to each of a set of addresses. */
+    for (int64_t i = 0; i < OPAGEDMEM_SNAPSHOT_ADDRS; i++) {
+        val = i * 1000 + 1;
+        if (opagedmem_access(&opagedmem, 0xdeadbeef00000000 + i * 4096, &val,
+                    sizeof(val), true, true, get_random)) {
+            ret = "Write before save failed";
+            goto exit_destroy_opagedmem;
+        }
+    }
+
+    /* Save, destroy, and load the paged memory. */
+    if (opagedmem_save(&opagedmem, path)) {
+        ret = "Save page table";
+        goto exit_destroy_opagedmem;
+    }
+    opagedmem_destroy(&opagedmem);
+    if (opagedmem_load(&opagedmem, path)) {
+        ret = "Load page table";
+        goto exit_unlink;
+    }
+
+    /* Read back the values. */
+    for (int64_t i = 0; i < OPAGEDMEM_SNAPSHOT_ADDRS; i++) {
+        val = 0;
+        if (opagedmem_access(&opagedmem, 0xdeadbeef00000000 + i * 4096, &val,
+                    sizeof(val), false, true, get_random)) {
+            ret = "Read after load failed";
+            goto exit_destroy_opagedmem;
+        }
+        if (val != i * 1000 + 1) {
+            ret = "Read after load produced incorrect value";
+            goto exit_destroy_opagedmem;
+        }
+    }
+
+    ret = NULL;
+
+exit_destroy_opagedmem:
+    opagedmem_destroy(&opagedmem);
+exit_unlink:
+    unlink(path);
+exit:
+    return ret;
+}
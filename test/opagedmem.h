@@ -2,5 +2,6 @@
 #define LIBOBLIVIOUS_TEST_OPAGEDMEM_H
 
 char *test_opagedmem(void);
+char *test_opagedmem_snapshot(void);
 
 #endif /* liboblivious/test/opagedmem.h */
@@ -1,22 +1,80 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "oram.h"
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "liboblivious/oram.h"
+#include "liboblivious/oramallocator.h"
+#include "liboblivious/oramstorage.h"
 #include "common.h"
 
 #define ORAM_BLOCK_SIZE 4096
 #define ORAM_BLOCKS_PER_BUCKET 4
 #define ORAM_NUM_BLOCKS 1024
 #define ORAM_STASH_SIZE 256
+#define ORAM_CIRCUIT_STASH_SIZE 32
+#define ORAM_RING_DUMMIES_PER_BUCKET 6
+#define ORAM_RING_EVICT_RATE 3
+#define ORAM_WORKLOAD_BLOCKS 256
+#define ORAM_WORKLOAD_ACCESSES 1024
+#define ORAM_POSMAP_BLOCK_SIZE_TEST 16
+#define ORAM_BATCH_SIZE 4
+#define ORAM_BATCH_STASH_SIZE 512
+#define ORAM_POSMAP_CUTOFF_TEST 64
+#define ORAM_SUBTREE_LEVELS 3
+#define ORAM_TREETOP_LEVELS 2
+#define ORAM_OVERFLOW_STASH_SIZE 2
+#define ORAM_OVERFLOW_ROUNDS 100
+#define ORAM_TRACKED_ALLOCATIONS 64
+#define ORAM_FILE_STORAGE_TEMPLATE "/tmp/liboblivious-test-XXXXXX"
 
-char *test_oram(void) {
+/* Writes ORAM_WORKLOAD_BLOCKS distinct blocks along random paths and then
+ * reads and rewrites random ones, checking their contents, with a position map
+ * kept by the test. */
+static char *run_oram_workload(oram_t *oram, unsigned char *data) {
+    uint64_t leaf_ids[ORAM_WORKLOAD_BLOCKS];
+    unsigned char contents[ORAM_WORKLOAD_BLOCKS];
+
+    for (size_t i = 0; i < ORAM_WORKLOAD_BLOCKS; i++) {
+        contents[i] = get_random();
+        memset(data, contents[i], ORAM_BLOCK_SIZE);
+        uint64_t leaf_id = get_random() % (1u << (oram->depth - 1));
+        if (oram_access(oram, i, leaf_id, data, true, &leaf_ids[i], true,
+                    get_random)) {
+            return "Workload write failed";
+        }
+    }
+
+    for (size_t i = 0; i < ORAM_WORKLOAD_ACCESSES; i++) {
+        size_t id = get_random() % ORAM_WORKLOAD_BLOCKS;
+        bool write = get_random() % 2;
+        memset(data, 0, ORAM_BLOCK_SIZE);
+        if (write) {
+            contents[id] = get_random();
+            memset(data, contents[id], ORAM_BLOCK_SIZE);
+        }
+        if (oram_access(oram, id, leaf_ids[id], data, write, &leaf_ids[id],
+                    true, get_random)) {
+            return "Workload access failed";
+        }
+        for (size_t j = 0; j < ORAM_BLOCK_SIZE; j++) {
+            if (data[j] != contents[id]) {
+                return "Workload read produced incorrect data";
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static char *test_oram_config(const struct oram_config *config) {
     oram_t oram;
     uint64_t next_leaf_id;
     unsigned char *data;
     char *ret = NULL;
 
-    if (oram_init(&oram, ORAM_BLOCK_SIZE, ORAM_BLOCKS_PER_BUCKET,
-                ORAM_NUM_BLOCKS, ORAM_STASH_SIZE)) {
+    if (oram_init_config(&oram, config)) {
         ret = "Init ORAM";
         goto exit;
     }
@@ -89,8 +147,8 @@ char *test_oram(void) {
 
     /* Write to ORAM. */
     memset(data, 'B', ORAM_BLOCK_SIZE);
-    if (oram_access(&oram, 0x123, 0, data, true, &next_leaf_id, true,
-                get_random)) {
+    if (oram_access(&oram, 0x123, next_leaf_id, data, true, &next_leaf_id,
+                true, get_random)) {
         ret = "Overwrite";
         goto exit_free_data;
     }
@@ -109,6 +167,160 @@ char *test_oram(void) {
         }
     }
 
+    ret = run_oram_workload(&oram, data);
+    if (ret) {
+        goto exit_free_data;
+    }
+
+    ret = NULL;
+
+exit_free_data:
+    free(data);
+exit_destroy_oram:
+    oram_destroy(&oram);
+exit:
+    return ret;
+}
+
+char *test_oram(void) {
+    struct oram_config config = {
+        .type = ORAM_TYPE_PATH,
+        .block_size = ORAM_BLOCK_SIZE,
+        .blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET,
+        .num_blocks = ORAM_NUM_BLOCKS,
+        .stash_size = ORAM_STASH_SIZE,
+    };
+
+    /* A tree deeper than ORAM_MAX_DEPTH is rejected before anything is
+     * allocated. */
+    struct oram_config deep_config = config;
+    deep_config.num_blocks =
+        ((size_t) 1 << ORAM_MAX_DEPTH) * ORAM_BLOCKS_PER_BUCKET;
+    oram_t oram;
+    if (!oram_init_config(&oram, &deep_config)) {
+        oram_destroy(&oram);
+        return "Init ORAM deeper than ORAM_MAX_DEPTH succeeded";
+    }
+
+    return test_oram_config(&config);
+}
+
+char *test_oram_circuit(void) {
+    struct oram_config config = {
+        .type = ORAM_TYPE_CIRCUIT,
+        .block_size = ORAM_BLOCK_SIZE,
+        .blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET,
+        .num_blocks = ORAM_NUM_BLOCKS,
+        .stash_size = ORAM_CIRCUIT_STASH_SIZE,
+    };
+    return test_oram_config(&config);
+}
+
+char *test_oram_ring(void) {
+    struct oram_config config = {
+        .type = ORAM_TYPE_RING,
+        .block_size = ORAM_BLOCK_SIZE,
+        .blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET,
+        .num_blocks = ORAM_NUM_BLOCKS,
+        .stash_size = ORAM_STASH_SIZE,
+        .dummies_per_bucket = ORAM_RING_DUMMIES_PER_BUCKET,
+        .evict_rate = ORAM_RING_EVICT_RATE,
+    };
+    return test_oram_config(&config);
+}
+
+/* Whether overflow_random returns 0, so that every block is assigned leaf 0. */
+static bool overflow_fixed_leaves;
+
+static uint64_t overflow_random(void) {
+    return overflow_fixed_leaves ? 0 : get_random();
+}
+
+/* Writes or reads BLOCK_ID through the position map, if ORAM has one, or
+ * else on *LEAF_ID, which is updated on success. */
+static int overflow_access(oram_t *oram, uint64_t block_id, uint64_t *leaf_id,
+        void *data, bool write) {
+    if (oram->posmap_leaves) {
+        if (write) {
+            return oram_write(oram, block_id, data, true, overflow_random);
+        }
+        return oram_read(oram, block_id, data, true, overflow_random);
+    }
+    return oram_access(oram, block_id, *leaf_id, data, write, leaf_id, true,
+            overflow_random);
+}
+
+static char *test_oram_circuit_overflow_config(
+        const struct oram_config *config) {
+    oram_t oram;
+    uint64_t leaf_ids[ORAM_WORKLOAD_BLOCKS];
+    bool read[ORAM_WORKLOAD_BLOCKS] = { false };
+    unsigned char *data;
+    char *ret = NULL;
+
+    if (oram_init_config(&oram, config)) {
+        ret = "Init ORAM";
+        goto exit;
+    }
+
+    data = malloc(ORAM_BLOCK_SIZE);
+    if (!data) {
+        ret = "Malloc data";
+        goto exit_destroy_oram;
+    }
+
+    /* Write blocks that all map to leaf 0 until the path and the stash are
+     * full and a write fails. */
+    overflow_fixed_leaves = true;
+    size_t num_written;
+    for (num_written = 0; num_written < ORAM_WORKLOAD_BLOCKS; num_written++) {
+        memset(data, num_written, ORAM_BLOCK_SIZE);
+        leaf_ids[num_written] = 0;
+        if (overflow_access(&oram, num_written, &leaf_ids[num_written], data,
+                    true)) {
+            break;
+        }
+    }
+    if (num_written == ORAM_WORKLOAD_BLOCKS) {
+        ret = "Stash did not overflow";
+        goto exit_free_data;
+    }
+
+    /* Read back every block with random leaves. Reads of blocks in the tree
+     * fail while the stash is full, but must neither lose the block nor leave
+     * the position map pointing elsewhere, and the failed accesses' evictions
+     * drain the stash. */
+    overflow_fixed_leaves = false;
+    size_t num_read = 0;
+    for (size_t round = 0; round < ORAM_OVERFLOW_ROUNDS; round++) {
+        for (size_t i = 0; i < num_written; i++) {
+            if (read[i]) {
+                continue;
+            }
+            memset(data, '\0', ORAM_BLOCK_SIZE);
+            uint32_t entry = oram.posmap_leaves ? oram.posmap_leaves[i] : 0;
+            if (overflow_access(&oram, i, &leaf_ids[i], data, false)) {
+                if (oram.posmap_leaves && oram.posmap_leaves[i] != entry) {
+                    ret = "Failed access changed the position map";
+                    goto exit_free_data;
+                }
+                continue;
+            }
+            for (size_t j = 0; j < ORAM_BLOCK_SIZE; j++) {
+                if (data[j] != (unsigned char) i) {
+                    ret = "Read after overflow produced incorrect data";
+                    goto exit_free_data;
+                }
+            }
+            read[i] = true;
+            num_read++;
+        }
+    }
+    if (num_read != num_written) {
+        ret = "Blocks could not be read after overflow";
+        goto exit_free_data;
+    }
+
     ret = NULL;
 
 exit_free_data:
@@ -118,3 +330,920 @@ exit_destroy_oram:
 exit:
     return ret;
 }
+
+char *test_oram_circuit_overflow(void) {
+    /* The second config keeps a client-side position map, which must be
+     * restored when an access fails. */
+    struct oram_config configs[] = {
+        {
+            .position_map = false,
+        },
+        {
+            .position_map = true,
+            .posmap_cutoff = ORAM_NUM_BLOCKS,
+        },
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(*configs); i++) {
+        configs[i].type = ORAM_TYPE_CIRCUIT;
+        configs[i].block_size = ORAM_BLOCK_SIZE;
+        configs[i].blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET;
+        configs[i].num_blocks = ORAM_NUM_BLOCKS;
+        configs[i].stash_size = ORAM_OVERFLOW_STASH_SIZE;
+        char *ret = test_oram_circuit_overflow_config(&configs[i]);
+        if (ret) {
+            return ret;
+        }
+    }
+    return NULL;
+}
+
+/* Runs the workload through oram_read and oram_write with a position map small
+ * enough to be stored recursively in two levels of ORAMs. */
+static char *test_oram_posmap_config(struct oram_config *config) {
+    oram_t oram;
+    unsigned char contents[ORAM_WORKLOAD_BLOCKS];
+    unsigned char *data;
+    char *ret = NULL;
+
+    config->position_map = true;
+    config->posmap_block_size = ORAM_POSMAP_BLOCK_SIZE_TEST;
+    config->posmap_cutoff = ORAM_POSMAP_CUTOFF_TEST;
+    if (oram_init_config(&oram, config)) {
+        ret = "Init ORAM";
+        goto exit;
+    }
+    if (!oram.posmap || !oram.posmap->posmap
+            || !oram.posmap->posmap->posmap_leaves) {
+        ret = "Position map is not recursive";
+        goto exit_destroy_oram;
+    }
+
+    data = malloc(ORAM_BLOCK_SIZE);
+    if (!data) {
+        ret = "Malloc data";
+        goto exit_destroy_oram;
+    }
+
+    /* Out-of-range access. */
+    if (!oram_read(&oram, ORAM_NUM_BLOCKS, data, true, get_random)) {
+        ret = "Out-of-range read succeeded";
+        goto exit_free_data;
+    }
+
+    /* Unwritten blocks read as zeroes. */
+    memset(data, 'A', ORAM_BLOCK_SIZE);
+    if (oram_read(&oram, 0, data, true, get_random)) {
+        ret = "Unwritten read failed";
+        goto exit_free_data;
+    }
+    for (size_t i = 0; i < ORAM_BLOCK_SIZE; i++) {
+        if (data[i] != '\0') {
+            ret = "Unwritten read produced incorrect data";
+            goto exit_free_data;
+        }
+    }
+
+    for (size_t i = 0; i < ORAM_WORKLOAD_BLOCKS; i++) {
+        contents[i] = get_random();
+        memset(data, contents[i], ORAM_BLOCK_SIZE);
+        if (oram_write(&oram, i, data, true, get_random)) {
+            ret = "Workload write failed";
+            goto exit_free_data;
+        }
+    }
+
+    for (size_t i = 0; i < ORAM_WORKLOAD_ACCESSES; i++) {
+        size_t id = get_random() % ORAM_WORKLOAD_BLOCKS;
+        bool write = get_random() % 2;
+        bool is_real_access = get_random() % 4;
+        memset(data, 0, ORAM_BLOCK_SIZE);
+        if (write) {
+            unsigned char c = get_random();
+            if (is_real_access) {
+                contents[id] = c;
+            }
+            memset(data, c, ORAM_BLOCK_SIZE);
+            if (oram_write(&oram, id, data, is_real_access, get_random)) {
+                ret = "Workload write failed";
+                goto exit_free_data;
+            }
+            continue;
+        }
+        if (oram_read(&oram, id, data, is_real_access, get_random)) {
+            ret = "Workload read failed";
+            goto exit_free_data;
+        }
+        if (!is_real_access) {
+            continue;
+        }
+        for (size_t j = 0; j < ORAM_BLOCK_SIZE; j++) {
+            if (data[j] != contents[id]) {
+                ret = "Workload read produced incorrect data";
+                goto exit_free_data;
+            }
+        }
+    }
+
+    ret = NULL;
+
+exit_free_data:
+    free(data);
+exit_destroy_oram:
+    oram_destroy(&oram);
+exit:
+    return ret;
+}
+
+char *test_oram_posmap(void) {
+    struct oram_config configs[] = {
+        {
+            .type = ORAM_TYPE_PATH,
+            .stash_size = ORAM_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_CIRCUIT,
+            .stash_size = ORAM_CIRCUIT_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_RING,
+            .stash_size = ORAM_STASH_SIZE,
+            .dummies_per_bucket = ORAM_RING_DUMMIES_PER_BUCKET,
+            .evict_rate = ORAM_RING_EVICT_RATE,
+        },
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(*configs); i++) {
+        configs[i].block_size = ORAM_BLOCK_SIZE;
+        configs[i].blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET;
+        configs[i].num_blocks = ORAM_NUM_BLOCKS;
+        char *ret = test_oram_posmap_config(&configs[i]);
+        if (ret) {
+            return ret;
+        }
+    }
+    return NULL;
+}
+
+/* Runs the workload in batches of ORAM_BATCH_SIZE requests, which may include
+ * dummy requests and repeated block IDs. */
+static char *test_oram_batch_config(const struct oram_config *config) {
+    oram_t oram;
+    uint64_t leaf_ids[ORAM_WORKLOAD_BLOCKS];
+    unsigned char contents[ORAM_WORKLOAD_BLOCKS];
+    uint64_t block_ids[ORAM_BATCH_SIZE];
+    uint64_t req_leaf_ids[ORAM_BATCH_SIZE];
+    uint64_t new_leaf_ids[ORAM_BATCH_SIZE];
+    bool writes[ORAM_BATCH_SIZE];
+    bool is_real_accesses[ORAM_BATCH_SIZE];
+    unsigned char expected[ORAM_BATCH_SIZE];
+    unsigned char *data;
+    char *ret = NULL;
+
+    if (oram_init_config(&oram, config)) {
+        ret = "Init ORAM";
+        goto exit;
+    }
+
+    data = malloc(ORAM_BATCH_SIZE * ORAM_BLOCK_SIZE);
+    if (!data) {
+        ret = "Malloc data";
+        goto exit_destroy_oram;
+    }
+
+    for (size_t i = 0; i < ORAM_WORKLOAD_BLOCKS; i += ORAM_BATCH_SIZE) {
+        for (size_t j = 0; j < ORAM_BATCH_SIZE; j++) {
+            block_ids[j] = i + j;
+            req_leaf_ids[j] = get_random() % (1u << (oram.depth - 1));
+            writes[j] = true;
+            is_real_accesses[j] = true;
+            contents[i + j] = get_random();
+            memset(data + j * ORAM_BLOCK_SIZE, contents[i + j],
+                    ORAM_BLOCK_SIZE);
+        }
+        if (oram_access_batch(&oram, ORAM_BATCH_SIZE, block_ids, req_leaf_ids,
+                    data, writes, &leaf_ids[i], is_real_accesses,
+                    get_random)) {
+            ret = "Batch write failed";
+            goto exit_free_data;
+        }
+    }
+
+    for (size_t i = 0; i < ORAM_WORKLOAD_ACCESSES; i += ORAM_BATCH_SIZE) {
+        /* Requests for the same block must use the same leaf, so the leaves
+         * are taken before any of the batch's new leaves are recorded. */
+        for (size_t j = 0; j < ORAM_BATCH_SIZE; j++) {
+            block_ids[j] = get_random() % ORAM_WORKLOAD_BLOCKS;
+            req_leaf_ids[j] = leaf_ids[block_ids[j]];
+            writes[j] = get_random() % 2;
+            is_real_accesses[j] = get_random() % 4;
+            memset(data + j * ORAM_BLOCK_SIZE, 0, ORAM_BLOCK_SIZE);
+            if (writes[j]) {
+                unsigned char c = get_random();
+                memset(data + j * ORAM_BLOCK_SIZE, c, ORAM_BLOCK_SIZE);
+                if (is_real_accesses[j]) {
+                    contents[block_ids[j]] = c;
+                }
+            }
+            expected[j] = contents[block_ids[j]];
+        }
+        if (oram_access_batch(&oram, ORAM_BATCH_SIZE, block_ids, req_leaf_ids,
+                    data, writes, new_leaf_ids, is_real_accesses,
+                    get_random)) {
+            ret = "Batch access failed";
+            goto exit_free_data;
+        }
+        for (size_t j = 0; j < ORAM_BATCH_SIZE; j++) {
+            if (!is_real_accesses[j]) {
+                continue;
+            }
+            leaf_ids[block_ids[j]] = new_leaf_ids[j];
+            for (size_t k = 0; k < j; k++) {
+                if (is_real_accesses[k] && block_ids[k] == block_ids[j]
+                        && new_leaf_ids[k] != new_leaf_ids[j]) {
+                    ret = "Batch requests for the same block got different "
+                        "leaves";
+                    goto exit_free_data;
+                }
+            }
+            for (size_t k = 0; k < ORAM_BLOCK_SIZE; k++) {
+                if (data[j * ORAM_BLOCK_SIZE + k] != expected[j]) {
+                    ret = "Batch read produced incorrect data";
+                    goto exit_free_data;
+                }
+            }
+        }
+    }
+
+    /* A batch with an invalid leaf must fail without outputting any leaves. */
+    for (size_t j = 0; j < ORAM_BATCH_SIZE; j++) {
+        block_ids[j] = j;
+        req_leaf_ids[j] = leaf_ids[j];
+        writes[j] = false;
+        is_real_accesses[j] = true;
+        new_leaf_ids[j] = UINT64_MAX;
+    }
+    req_leaf_ids[ORAM_BATCH_SIZE - 1] = 1u << (oram.depth - 1);
+    if (!oram_access_batch(&oram, ORAM_BATCH_SIZE, block_ids, req_leaf_ids,
+                data, writes, new_leaf_ids, is_real_accesses, get_random)) {
+        ret = "Batch access with an invalid leaf succeeded";
+        goto exit_free_data;
+    }
+    for (size_t j = 0; j < ORAM_BATCH_SIZE; j++) {
+        if (new_leaf_ids[j] != UINT64_MAX) {
+            ret = "Failed batch access output a leaf";
+            goto exit_free_data;
+        }
+    }
+
+    ret = NULL;
+
+exit_free_data:
+    free(data);
+exit_destroy_oram:
+    oram_destroy(&oram);
+exit:
+    return ret;
+}
+
+char *test_oram_batch(void) {
+    struct oram_config configs[] = {
+        {
+            .type = ORAM_TYPE_PATH,
+            .stash_size = ORAM_BATCH_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_CIRCUIT,
+            .stash_size = ORAM_CIRCUIT_STASH_SIZE,
+        },
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(*configs); i++) {
+        configs[i].block_size = ORAM_BLOCK_SIZE;
+        configs[i].blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET;
+        configs[i].num_blocks = ORAM_NUM_BLOCKS;
+        char *ret = test_oram_batch_config(&configs[i]);
+        if (ret) {
+            return ret;
+        }
+    }
+    return NULL;
+}
+
+char *test_oram_file_storage(void) {
+    struct oram_config configs[] = {
+        {
+            .type = ORAM_TYPE_PATH,
+            .stash_size = ORAM_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_CIRCUIT,
+            .stash_size = ORAM_CIRCUIT_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_RING,
+            .stash_size = ORAM_STASH_SIZE,
+            .dummies_per_bucket = ORAM_RING_DUMMIES_PER_BUCKET,
+            .evict_rate = ORAM_RING_EVICT_RATE,
+        },
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(*configs); i++) {
+        struct oram_file_storage storage;
+        char path[] = ORAM_FILE_STORAGE_TEMPLATE;
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            return "Create storage file";
+        }
+        close(fd);
+        if (oram_file_storage_init(&storage, path)) {
+            unlink(path);
+            return "Init file storage";
+        }
+        configs[i].block_size = ORAM_BLOCK_SIZE;
+        configs[i].blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET;
+        configs[i].num_blocks = ORAM_NUM_BLOCKS;
+        configs[i].storage = &storage.base;
+        char *ret = test_oram_config(&configs[i]);
+        oram_file_storage_destroy(&storage);
+        unlink(path);
+        if (ret) {
+            return ret;
+        }
+    }
+    return NULL;
+}
+
+char *test_oram_layout(void) {
+    struct oram_config configs[] = {
+        {
+            .type = ORAM_TYPE_PATH,
+            .stash_size = ORAM_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_CIRCUIT,
+            .stash_size = ORAM_CIRCUIT_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_RING,
+            .stash_size = ORAM_STASH_SIZE,
+            .dummies_per_bucket = ORAM_RING_DUMMIES_PER_BUCKET,
+            .evict_rate = ORAM_RING_EVICT_RATE,
+        },
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(*configs); i++) {
+        configs[i].block_size = ORAM_BLOCK_SIZE;
+        configs[i].blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET;
+        configs[i].num_blocks = ORAM_NUM_BLOCKS;
+        configs[i].subtree_levels = ORAM_SUBTREE_LEVELS;
+        configs[i].treetop_levels = ORAM_TREETOP_LEVELS;
+        char *ret = test_oram_config(&configs[i]);
+        if (ret) {
+            return ret;
+        }
+    }
+    return NULL;
+}
+
+char *test_oram_hugepage(void) {
+    struct oram_hugepage_allocator allocator;
+    oram_hugepage_allocator_init(&allocator, ORAM_HUGEPAGE_2MB, true);
+    struct oram_config config = {
+        .type = ORAM_TYPE_PATH,
+        .block_size = ORAM_BLOCK_SIZE,
+        .blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET,
+        .num_blocks = ORAM_NUM_BLOCKS,
+        .stash_size = ORAM_STASH_SIZE,
+        .treetop_levels = ORAM_TREETOP_LEVELS,
+        .allocator = &allocator.base,
+    };
+    return test_oram_config(&config);
+}
+
+/* An allocator that records its outstanding allocations, so that the test can
+ * check which arrays came from it and that each was freed with its size. */
+struct tracking_allocator {
+    struct oram_allocator base;
+    void *ptrs[ORAM_TRACKED_ALLOCATIONS];
+    size_t sizes[ORAM_TRACKED_ALLOCATIONS];
+    size_t num_allocations;
+    bool failed;
+};
+
+static void *tracking_allocate(struct oram_allocator *allocator_,
+        size_t size) {
+    struct tracking_allocator *allocator =
+        (struct tracking_allocator *) allocator_;
+    if (allocator->num_allocations == ORAM_TRACKED_ALLOCATIONS) {
+        allocator->failed = true;
+        return NULL;
+    }
+    void *ptr = oram_allocate(NULL, size);
+    if (ptr) {
+        allocator->ptrs[allocator->num_allocations] = ptr;
+        allocator->sizes[allocator->num_allocations] = size;
+        allocator->num_allocations++;
+    }
+    return ptr;
+}
+
+static void tracking_free(struct oram_allocator *allocator_, void *ptr,
+        size_t size) {
+    struct tracking_allocator *allocator =
+        (struct tracking_allocator *) allocator_;
+    for (size_t i = 0; i < allocator->num_allocations; i++) {
+        if (allocator->ptrs[i] == ptr) {
+            allocator->failed |= allocator->sizes[i] != size;
+            allocator->num_allocations--;
+            allocator->ptrs[i] = allocator->ptrs[allocator->num_allocations];
+            allocator->sizes[i] = allocator->sizes[allocator->num_allocations];
+            oram_free(NULL, ptr, size);
+            return;
+        }
+    }
+    allocator->failed = true;
+}
+
+/* Returns whether PTR is NULL or an outstanding allocation of ALLOCATOR. */
+static bool tracking_owns(const struct tracking_allocator *allocator,
+        const void *ptr) {
+    if (!ptr) {
+        return true;
+    }
+    for (size_t i = 0; i < allocator->num_allocations; i++) {
+        if (allocator->ptrs[i] == ptr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static char *test_oram_allocator_config(struct oram_config *config) {
+    struct tracking_allocator allocator = {
+        .base = {
+            .allocate = tracking_allocate,
+            .free = tracking_free,
+        },
+    };
+    oram_t oram;
+    unsigned char *data;
+    char *ret;
+
+    config->block_size = ORAM_BLOCK_SIZE;
+    config->blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET;
+    config->num_blocks = ORAM_NUM_BLOCKS;
+    config->position_map = true;
+    config->posmap_block_size = ORAM_POSMAP_BLOCK_SIZE_TEST;
+    config->posmap_cutoff = ORAM_POSMAP_CUTOFF_TEST;
+    config->allocator = &allocator.base;
+    if (oram_init_config(&oram, config)) {
+        ret = "Init ORAM";
+        goto exit;
+    }
+
+    /* Every array of every level of the position map comes from the
+     * allocator. */
+    for (oram_t *level = &oram; level; level = level->posmap) {
+        if (!tracking_owns(&allocator, level->treetop)
+                || !tracking_owns(&allocator, level->stash_metas)
+                || !tracking_owns(&allocator, level->stash_data)
+                || !tracking_owns(&allocator, level->path_metas)
+                || !tracking_owns(&allocator, level->path_data)
+                || !tracking_owns(&allocator, level->ring_buckets)
+                || !tracking_owns(&allocator, level->ring_slot_idxs)
+                || !tracking_owns(&allocator, level->posmap_leaves)) {
+            ret = "ORAM array not allocated with the allocator";
+            goto exit_destroy_oram;
+        }
+    }
+
+    data = malloc(ORAM_BLOCK_SIZE);
+    if (!data) {
+        ret = "Malloc data";
+        goto exit_destroy_oram;
+    }
+    for (uint64_t id = 0; id < ORAM_WORKLOAD_BLOCKS; id++) {
+        memset(data, (unsigned char) id, ORAM_BLOCK_SIZE);
+        if (oram_write(&oram, id, data, true, get_random)) {
+            ret = "Write failed";
+            goto exit_free_data;
+        }
+    }
+    for (uint64_t id = 0; id < ORAM_WORKLOAD_BLOCKS; id++) {
+        if (oram_read(&oram, id, data, true, get_random)) {
+            ret = "Read failed";
+            goto exit_free_data;
+        }
+        if (data[0] != (unsigned char) id) {
+            ret = "Read produced incorrect data";
+            goto exit_free_data;
+        }
+    }
+
+    ret = NULL;
+
+exit_free_data:
+    free(data);
+exit_destroy_oram:
+    oram_destroy(&oram);
+    if (!ret && (allocator.num_allocations || allocator.failed)) {
+        ret = "ORAM arrays not freed with their sizes";
+    }
+exit:
+    return ret;
+}
+
+char *test_oram_allocator(void) {
+    struct oram_config configs[] = {
+        {
+            .type = ORAM_TYPE_PATH,
+            .stash_size = ORAM_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_CIRCUIT,
+            .stash_size = ORAM_CIRCUIT_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_RING,
+            .stash_size = ORAM_STASH_SIZE,
+            .dummies_per_bucket = ORAM_RING_DUMMIES_PER_BUCKET,
+            .evict_rate = ORAM_RING_EVICT_RATE,
+        },
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(*configs); i++) {
+        char *ret = test_oram_allocator_config(&configs[i]);
+        if (ret) {
+            return ret;
+        }
+    }
+    return NULL;
+}
+
+char *test_oram_stats(void) {
+    oram_t oram;
+    struct oram_stats stats;
+    unsigned char *data;
+    char *ret;
+
+    if (oram_init(&oram, ORAM_BLOCK_SIZE, ORAM_BLOCKS_PER_BUCKET,
+                ORAM_NUM_BLOCKS, ORAM_STASH_SIZE)) {
+        ret = "Init ORAM";
+        goto exit;
+    }
+
+    data = malloc(ORAM_BLOCK_SIZE);
+    if (!data) {
+        ret = "Malloc data";
+        goto exit_destroy_oram;
+    }
+
+    ret = run_oram_workload(&oram, data);
+    if (ret) {
+        goto exit_free_data;
+    }
+
+    /* Statistics are only collected with LIBOBLIVIOUS_ORAM_STATS. */
+    if (oram_get_stats(&oram, &stats)) {
+        ret = NULL;
+        goto exit_free_data;
+    }
+
+    if (stats.accesses != ORAM_WORKLOAD_BLOCKS + ORAM_WORKLOAD_ACCESSES
+            || stats.failed_accesses) {
+        ret = "Incorrect access counts";
+        goto exit_free_data;
+    }
+    uint64_t histogram_total = 0;
+    for (size_t i = 0; i < ORAM_STASH_HISTOGRAM_SIZE; i++) {
+        histogram_total += stats.stash_histogram[i];
+    }
+    if (histogram_total != stats.accesses) {
+        ret = "Incorrect stash histogram";
+        goto exit_free_data;
+    }
+    if (!stats.stash_high_water || stats.stash_high_water > oram.stash_size) {
+        ret = "Incorrect stash high-water mark";
+        goto exit_free_data;
+    }
+    if (!stats.cycles[ORAM_PHASE_READ] || !stats.cycles[ORAM_PHASE_WRITE]) {
+        ret = "Missing phase timings";
+        goto exit_free_data;
+    }
+
+    ret = NULL;
+
+exit_free_data:
+    free(data);
+exit_destroy_oram:
+    oram_destroy(&oram);
+exit:
+    return ret;
+}
+
+/* Saves and loads an ORAM, loading its tree into STORAGE if it is not NULL. */
+static char *test_oram_snapshot_config(struct oram_config *config,
+        struct oram_storage *storage) {
+    oram_t oram;
+    unsigned char contents[ORAM_WORKLOAD_BLOCKS];
+    unsigned char *data;
+    char path[] = ORAM_FILE_STORAGE_TEMPLATE;
+    char *ret = NULL;
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        ret = "Create snapshot file";
+        goto exit;
+    }
+    close(fd);
+
+    config->position_map = true;
+    config->posmap_block_size = ORAM_POSMAP_BLOCK_SIZE_TEST;
+    config->posmap_cutoff = ORAM_POSMAP_CUTOFF_TEST;
+    config->subtree_levels = ORAM_SUBTREE_LEVELS;
+    config->treetop_levels = ORAM_TREETOP_LEVELS;
+    if (oram_init_config(&oram, config)) {
+        ret = "Init ORAM";
+        goto exit_unlink;
+    }
+
+    data = malloc(ORAM_BLOCK_SIZE);
+    if (!data) {
+        ret = "Malloc data";
+        goto exit_destroy_oram;
+    }
+
+    for (size_t i = 0; i < ORAM_WORKLOAD_BLOCKS; i++) {
+        contents[i] = get_random();
+        memset(data, contents[i], ORAM_BLOCK_SIZE);
+        if (oram_write(&oram, i, data, true, get_random)) {
+            ret = "Write before save failed";
+            goto exit_free_data;
+        }
+    }
+
+    /* Save, destroy, and load the ORAM. */
+    if (oram_save(&oram, path)) {
+        ret = "Save ORAM";
+        goto exit_free_data;
+    }
+    oram_destroy(&oram);
+    if (oram_load(&oram, path, storage)) {
+        free(data);
+        ret = "Load ORAM";
+        goto exit_unlink;
+    }
+    if (storage && oram.storage != storage) {
+        ret = "Loaded ORAM does not use the given storage";
+        goto exit_free_data;
+    }
+    if (!oram.posmap || !oram.posmap->posmap
+            || !oram.posmap->posmap->posmap_leaves) {
+        ret = "Loaded position map is not recursive";
+        goto exit_free_data;
+    }
+
+    /* Read back every block, and then keep writing and reading. */
+    for (size_t i = 0; i < ORAM_WORKLOAD_BLOCKS; i++) {
+        if (oram_read(&oram, i, data, true, get_random)) {
+            ret = "Read after load failed";
+            goto exit_free_data;
+        }
+        for (size_t j = 0; j < ORAM_BLOCK_SIZE; j++) {
+            if (data[j] != contents[i]) {
+                ret = "Read after load produced incorrect data";
+                goto exit_free_data;
+            }
+        }
+    }
+    for (size_t i = 0; i < ORAM_WORKLOAD_ACCESSES; i++) {
+        size_t id = get_random() % ORAM_WORKLOAD_BLOCKS;
+        if (get_random() % 2) {
+            contents[id] = get_random();
+            memset(data, contents[id], ORAM_BLOCK_SIZE);
+            if (oram_write(&oram, id, data, true, get_random)) {
+                ret = "Write after load failed";
+                goto exit_free_data;
+            }
+            continue;
+        }
+        if (oram_read(&oram, id, data, true, get_random)) {
+            ret = "Read after load failed";
+            goto exit_free_data;
+        }
+        for (size_t j = 0; j < ORAM_BLOCK_SIZE; j++) {
+            if (data[j] != contents[id]) {
+                ret = "Read after load produced incorrect data";
+                goto exit_free_data;
+            }
+        }
+    }
+
+    /* A snapshot whose sections run past the end of the file must not
+     * load. */
+    oram_t truncated;
+    if (truncate(path, ORAM_SNAPSHOT_ALIGNMENT)) {
+        ret = "Truncate snapshot file";
+        goto exit_free_data;
+    }
+    if (!oram_load(&truncated, path, NULL)) {
+        oram_destroy(&truncated);
+        ret = "Load of truncated snapshot succeeded";
+        goto exit_free_data;
+    }
+
+    ret = NULL;
+
+exit_free_data:
+    free(data);
+exit_destroy_oram:
+    oram_destroy(&oram);
+exit_unlink:
+    unlink(path);
+exit:
+    return ret;
+}
+
+char *test_oram_snapshot(void) {
+    struct oram_config configs[] = {
+        {
+            .type = ORAM_TYPE_PATH,
+            .stash_size = ORAM_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_CIRCUIT,
+            .stash_size = ORAM_CIRCUIT_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_RING,
+            .stash_size = ORAM_STASH_SIZE,
+            .dummies_per_bucket = ORAM_RING_DUMMIES_PER_BUCKET,
+            .evict_rate = ORAM_RING_EVICT_RATE,
+        },
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(*configs); i++) {
+        configs[i].block_size = ORAM_BLOCK_SIZE;
+        configs[i].blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET;
+        configs[i].num_blocks = ORAM_NUM_BLOCKS;
+        char *ret = test_oram_snapshot_config(&configs[i], NULL);
+        if (ret) {
+            return ret;
+        }
+
+        /* Load into a file storage as well. */
+        struct oram_file_storage storage;
+        char path[] = ORAM_FILE_STORAGE_TEMPLATE;
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            return "Create storage file";
+        }
+        close(fd);
+        if (oram_file_storage_init(&storage, path)) {
+            unlink(path);
+            return "Init file storage";
+        }
+        ret = test_oram_snapshot_config(&configs[i], &storage.base);
+        oram_file_storage_destroy(&storage);
+        unlink(path);
+        if (ret) {
+            return ret;
+        }
+    }
+    return NULL;
+}
+
+static char *test_oram_init_from_blocks_config(struct oram_config *config) {
+    oram_t oram;
+    unsigned char contents[ORAM_NUM_BLOCKS];
+    unsigned char *blocks;
+    uint64_t *leaf_ids;
+    unsigned char *data;
+    char *ret = NULL;
+
+    blocks = malloc(ORAM_NUM_BLOCKS * ORAM_BLOCK_SIZE);
+    if (!blocks) {
+        ret = "Malloc blocks";
+        goto exit;
+    }
+    leaf_ids = malloc(ORAM_NUM_BLOCKS * sizeof(*leaf_ids));
+    if (!leaf_ids) {
+        ret = "Malloc leaf IDs";
+        goto exit_free_blocks;
+    }
+    data = malloc(ORAM_BLOCK_SIZE);
+    if (!data) {
+        ret = "Malloc data";
+        goto exit_free_leaf_ids;
+    }
+    for (size_t i = 0; i < ORAM_NUM_BLOCKS; i++) {
+        contents[i] = get_random();
+        memset(blocks + i * ORAM_BLOCK_SIZE, contents[i], ORAM_BLOCK_SIZE);
+    }
+
+    /* Without a position map, every block must be at its returned leaf. */
+    config->position_map = false;
+    if (oram_init_from_blocks(&oram, config, blocks, leaf_ids, get_random)) {
+        ret = "Init ORAM from blocks";
+        goto exit_free_data;
+    }
+    for (size_t i = 0; i < ORAM_NUM_BLOCKS; i++) {
+        if (oram_access(&oram, i, leaf_ids[i], data, false, &leaf_ids[i], true,
+                    get_random)) {
+            ret = "Access after init failed";
+            goto exit_destroy_oram;
+        }
+        for (size_t j = 0; j < ORAM_BLOCK_SIZE; j++) {
+            if (data[j] != contents[i]) {
+                ret = "Access after init produced incorrect data";
+                goto exit_destroy_oram;
+            }
+        }
+    }
+    oram_destroy(&oram);
+
+    /* With a recursive position map, read back every block and then keep
+     * writing and reading. */
+    config->position_map = true;
+    config->posmap_block_size = ORAM_POSMAP_BLOCK_SIZE_TEST;
+    config->posmap_cutoff = ORAM_POSMAP_CUTOFF_TEST;
+    if (oram_init_from_blocks(&oram, config, blocks, NULL, get_random)) {
+        ret = "Init ORAM from blocks with position map";
+        goto exit_free_data;
+    }
+    if (!oram.posmap || !oram.posmap->posmap
+            || !oram.posmap->posmap->posmap_leaves) {
+        ret = "Position map is not recursive";
+        goto exit_destroy_oram;
+    }
+    for (size_t i = 0; i < ORAM_NUM_BLOCKS; i++) {
+        if (oram_read(&oram, i, data, true, get_random)) {
+            ret = "Read after init failed";
+            goto exit_destroy_oram;
+        }
+        for (size_t j = 0; j < ORAM_BLOCK_SIZE; j++) {
+            if (data[j] != contents[i]) {
+                ret = "Read after init produced incorrect data";
+                goto exit_destroy_oram;
+            }
+        }
+    }
+    for (size_t i = 0; i < ORAM_WORKLOAD_ACCESSES; i++) {
+        size_t id = get_random() % ORAM_NUM_BLOCKS;
+        if (get_random() % 2) {
+            contents[id] = get_random();
+            memset(data, contents[id], ORAM_BLOCK_SIZE);
+            if (oram_write(&oram, id, data, true, get_random)) {
+                ret = "Write after init failed";
+                goto exit_destroy_oram;
+            }
+            continue;
+        }
+        if (oram_read(&oram, id, data, true, get_random)) {
+            ret = "Read after init failed";
+            goto exit_destroy_oram;
+        }
+        for (size_t j = 0; j < ORAM_BLOCK_SIZE; j++) {
+            if (data[j] != contents[id]) {
+                ret = "Read after init produced incorrect data";
+                goto exit_destroy_oram;
+            }
+        }
+    }
+
+    ret = NULL;
+
+exit_destroy_oram:
+    oram_destroy(&oram);
+exit_free_data:
+    free(data);
+exit_free_leaf_ids:
+    free(leaf_ids);
+exit_free_blocks:
+    free(blocks);
+exit:
+    return ret;
+}
+
+char *test_oram_init_from_blocks(void) {
+    struct oram_config configs[] = {
+        {
+            .type = ORAM_TYPE_PATH,
+            .stash_size = ORAM_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_CIRCUIT,
+            .stash_size = ORAM_CIRCUIT_STASH_SIZE,
+        },
+        {
+            .type = ORAM_TYPE_RING,
+            .stash_size = ORAM_STASH_SIZE,
+            .dummies_per_bucket = ORAM_RING_DUMMIES_PER_BUCKET,
+            .evict_rate = ORAM_RING_EVICT_RATE,
+        },
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(*configs); i++) {
+        configs[i].block_size = ORAM_BLOCK_SIZE;
+        configs[i].blocks_per_bucket = ORAM_BLOCKS_PER_BUCKET;
+        configs[i].num_blocks = ORAM_NUM_BLOCKS;
+        char *ret = test_oram_init_from_blocks_config(&configs[i]);
+        if (ret) {
+            return ret;
+        }
+    }
+    return NULL;
+}
@@ -2,5 +2,17 @@
 #define LIBOBLIVIOUS_TEST_ORAM_H
 
 char *test_oram(void);
+char *test_oram_circuit(void);
+char *test_oram_ring(void);
+char *test_oram_circuit_overflow(void);
+char *test_oram_posmap(void);
+char *test_oram_batch(void);
+char *test_oram_file_storage(void);
+char *test_oram_layout(void);
+char *test_oram_hugepage(void);
+char *test_oram_allocator(void);
+char *test_oram_stats(void);
+char *test_oram_snapshot(void);
+char *test_oram_init_from_blocks(void);
 
 #endif /* liboblivious/test/oram.h */
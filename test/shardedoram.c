@@ -0,0 +1,143 @@
+#include "shardedoram.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "liboblivious/shardedoram.h"
+#include "common.h"
+
+#define SHARDEDORAM_BLOCK_SIZE 64
+#define SHARDEDORAM_BLOCKS_PER_BUCKET 4
+#define SHARDEDORAM_NUM_BLOCKS 1024
+#define SHARDEDORAM_STASH_SIZE 128
+#define SHARDEDORAM_NUM_SHARDS 4
+/* More threads than shards, so that rounds see requests on the same shard. */
+#define SHARDEDORAM_NUM_THREADS 8
+#define SHARDEDORAM_ACCESSES 256
+
+struct thread_args {
+    shardedoram_t *shardedoram;
+    size_t thread_idx;
+    char *ret;
+};
+
+/* Each thread writes and then reads and rewrites the block IDs congruent to
+ * its index, so that the threads' contents don't interfere. */
+static void *run_thread(void *args_) {
+    struct thread_args *args = args_;
+    unsigned char contents[SHARDEDORAM_NUM_BLOCKS / SHARDEDORAM_NUM_THREADS];
+    unsigned char data[SHARDEDORAM_BLOCK_SIZE];
+
+    for (size_t i = 0; i < SHARDEDORAM_NUM_BLOCKS / SHARDEDORAM_NUM_THREADS;
+            i++) {
+        uint64_t id = i * SHARDEDORAM_NUM_THREADS + args->thread_idx;
+        contents[i] = get_random();
+        memset(data, contents[i], sizeof(data));
+        if (shardedoram_write(args->shardedoram, id, data, true, get_random)) {
+            args->ret = "Concurrent write failed";
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; i < SHARDEDORAM_ACCESSES; i++) {
+        size_t idx =
+            get_random() % (SHARDEDORAM_NUM_BLOCKS / SHARDEDORAM_NUM_THREADS);
+        uint64_t id = idx * SHARDEDORAM_NUM_THREADS + args->thread_idx;
+        if (get_random() % 2) {
+            contents[idx] = get_random();
+            memset(data, contents[idx], sizeof(data));
+            if (shardedoram_write(args->shardedoram, id, data, true,
+                        get_random)) {
+                args->ret = "Concurrent write failed";
+                return NULL;
+            }
+            continue;
+        }
+        memset(data, '\0', sizeof(data));
+        if (shardedoram_read(args->shardedoram, id, data, true, get_random)) {
+            args->ret = "Concurrent read failed";
+            return NULL;
+        }
+        for (size_t j = 0; j < sizeof(data); j++) {
+            if (data[j] != contents[idx]) {
+                args->ret = "Concurrent read produced incorrect data";
+                return NULL;
+            }
+        }
+    }
+
+    args->ret = NULL;
+    return NULL;
+}
+
+char *test_shardedoram(void) {
+    shardedoram_t shardedoram;
+    struct oram_config config = {
+        .type = ORAM_TYPE_CIRCUIT,
+        .block_size = SHARDEDORAM_BLOCK_SIZE,
+        .blocks_per_bucket = SHARDEDORAM_BLOCKS_PER_BUCKET,
+        .num_blocks = SHARDEDORAM_NUM_BLOCKS,
+        .stash_size = SHARDEDORAM_STASH_SIZE,
+    };
+    pthread_t threads[SHARDEDORAM_NUM_THREADS];
+    struct thread_args args[SHARDEDORAM_NUM_THREADS];
+    unsigned char data[SHARDEDORAM_BLOCK_SIZE];
+    size_t num_threads;
+    char *ret;
+
+    if (shardedoram_init(&shardedoram, &config, SHARDEDORAM_NUM_SHARDS)) {
+        ret = "Init sharded ORAM";
+        goto exit;
+    }
+
+    /* Out-of-range access. */
+    if (!shardedoram_read(&shardedoram, SHARDEDORAM_NUM_BLOCKS, data, true,
+                get_random)) {
+        ret = "Out-of-range read succeeded";
+        goto exit_destroy_shardedoram;
+    }
+
+    /* Dummy write, then read, expecting 0. */
+    memset(data, 'A', sizeof(data));
+    if (shardedoram_write(&shardedoram, 0x123, data, false, get_random)) {
+        ret = "Dummy write failed";
+        goto exit_destroy_shardedoram;
+    }
+    if (shardedoram_read(&shardedoram, 0x123, data, true, get_random)) {
+        ret = "Read after dummy write failed";
+        goto exit_destroy_shardedoram;
+    }
+    for (size_t i = 0; i < sizeof(data); i++) {
+        if (data[i] != '\0') {
+            ret = "Read after dummy write produced incorrect data";
+            goto exit_destroy_shardedoram;
+        }
+    }
+
+    for (num_threads = 0; num_threads < SHARDEDORAM_NUM_THREADS;
+            num_threads++) {
+        args[num_threads].shardedoram = &shardedoram;
+        args[num_threads].thread_idx = num_threads;
+        args[num_threads].ret = "Thread did not finish";
+        if (pthread_create(&threads[num_threads], NULL, run_thread,
+                    &args[num_threads])) {
+            ret = "Create thread";
+            goto exit_join_threads;
+        }
+    }
+
+    ret = NULL;
+
+exit_join_threads:
+    for (size_t i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        if (!ret) {
+            ret = args[i].ret;
+        }
+    }
+exit_destroy_shardedoram:
+    shardedoram_destroy(&shardedoram);
+exit:
+    return ret;
+}
@@ -0,0 +1,6 @@
+#ifndef LIBOBLIVIOUS_TEST_SHARDEDORAM_H
+#define LIBOBLIVIOUS_TEST_SHARDEDORAM_H
+
+char *test_shardedoram(void);
+
+#endif /* liboblivious/test/shardedoram.h */
@@ -2,6 +2,7 @@
 #include "algorithms.h"
 #include "opagedmem.h"
 #include "oram.h"
+#include "shardedoram.h"
 
 int main(void) {
     char *err;
@@ -10,25 +11,160 @@ int main(void) {
         printf("Failed o_sort: %s\n", err);
         return 1;
     }
+    err = test_sort_small();
+    if (err) {
+        printf("Failed o_sort_small: %s\n", err);
+        return 1;
+    }
+    err = test_sort_cpp();
+    if (err) {
+        printf("Failed liboblivious::o_sort: %s\n", err);
+        return 1;
+    }
     err = test_sort_generate_swaps();
     if (err) {
         printf("Failed o_sort_generate_swaps: %s\n", err);
         return 1;
     }
+    err = test_sort_generate_swap_layers();
+    if (err) {
+        printf("Failed o_sort_generate_swap_layers: %s\n", err);
+        return 1;
+    }
+    err = test_sort_columns();
+    if (err) {
+        printf("Failed o_sort_columns: %s\n", err);
+        return 1;
+    }
+    err = test_sort_small_domain();
+    if (err) {
+        printf("Failed o_sort_small_domain: %s\n", err);
+        return 1;
+    }
+    err = test_select_topk();
+    if (err) {
+        printf("Failed o_select_topk: %s\n", err);
+        return 1;
+    }
     err = test_compact();
     if (err) {
         printf("Failed o_compact: %s\n", err);
         return 1;
     }
+    err = test_compact_loose();
+    if (err) {
+        printf("Failed o_compact_loose: %s\n", err);
+        return 1;
+    }
+    err = test_group_aggregate();
+    if (err) {
+        printf("Failed o_group_aggregate: %s\n", err);
+        return 1;
+    }
+    err = test_histogram();
+    if (err) {
+        printf("Failed o_histogram: %s\n", err);
+        return 1;
+    }
+    err = test_count_distinct();
+    if (err) {
+        printf("Failed o_count_distinct: %s\n", err);
+        return 1;
+    }
+    err = test_batch_lookup();
+    if (err) {
+        printf("Failed o_batch_lookup: %s\n", err);
+        return 1;
+    }
+    err = test_join_pk_fk();
+    if (err) {
+        printf("Failed o_join_pk_fk: %s\n", err);
+        return 1;
+    }
+    err = test_join();
+    if (err) {
+        printf("Failed o_join: %s\n", err);
+        return 1;
+    }
     err = test_oram();
     if (err) {
         printf("Failed oram: %s\n", err);
         return 1;
     }
+    err = test_oram_circuit();
+    if (err) {
+        printf("Failed oram circuit: %s\n", err);
+        return 1;
+    }
+    err = test_oram_ring();
+    if (err) {
+        printf("Failed oram ring: %s\n", err);
+        return 1;
+    }
+    err = test_oram_circuit_overflow();
+    if (err) {
+        printf("Failed oram circuit overflow: %s\n", err);
+        return 1;
+    }
+    err = test_oram_posmap();
+    if (err) {
+        printf("Failed oram posmap: %s\n", err);
+        return 1;
+    }
+    err = test_oram_batch();
+    if (err) {
+        printf("Failed oram batch: %s\n", err);
+        return 1;
+    }
+    err = test_oram_file_storage();
+    if (err) {
+        printf("Failed oram file storage: %s\n", err);
+        return 1;
+    }
+    err = test_oram_layout();
+    if (err) {
+        printf("Failed oram layout: %s\n", err);
+        return 1;
+    }
+    err = test_oram_hugepage();
+    if (err) {
+        printf("Failed oram hugepage: %s\n", err);
+        return 1;
+    }
+    err = test_oram_allocator();
+    if (err) {
+        printf("Failed oram allocator: %s\n", err);
+        return 1;
+    }
+    err = test_oram_stats();
+    if (err) {
+        printf("Failed oram stats: %s\n", err);
+        return 1;
+    }
+    err = test_oram_snapshot();
+    if (err) {
+        printf("Failed oram snapshot: %s\n", err);
+        return 1;
+    }
+    err = test_oram_init_from_blocks();
+    if (err) {
+        printf("Failed oram init from blocks: %s\n", err);
+        return 1;
+    }
     err = test_opagedmem();
     if (err) {
         printf("Failed opagedmem: %s\n", err);
         return 1;
     }
+    err = test_opagedmem_snapshot();
+    if (err) {
+        printf("Failed opagedmem snapshot: %s\n", err);
+        return 1;
+    }
+    err = test_shardedoram();
+    if (err) {
+        printf("Failed shardedoram: %s\n", err);
+        return 1;
+    }
     return 0;
 }